@@ -0,0 +1,180 @@
+#pragma once
+
+#include "Defn.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define ORDME_AUCTION_SSE2 1
+#endif
+
+using TAuctionQty = std::int64_t;	// cumulative depth can exceed TQty
+
+// In place inclusive prefix sum, two lanes at a time where SSE2 is available
+inline void prefixSum(TAuctionQty* pQty, std::size_t count)
+{
+	std::size_t i(0);
+	TAuctionQty carry(0);
+
+#ifdef ORDME_AUCTION_SSE2
+	__m128i vCarry(_mm_setzero_si128());
+
+	for (; i + 2 <= count; i += 2) {
+		__m128i v(_mm_loadu_si128(reinterpret_cast<const __m128i*>(pQty + i)));
+
+		v = _mm_add_epi64(v, _mm_slli_si128(v, 8));
+		v = _mm_add_epi64(v, vCarry);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(pQty + i), v);
+		vCarry = _mm_shuffle_epi32(v, _MM_SHUFFLE(3, 2, 3, 2));
+	}
+	if (i > 0) {
+		carry = pQty[i - 1];
+	}
+#endif
+
+	for (; i < count; ++i) {
+		carry += pQty[i];
+		pQty[i] = carry;
+	}
+}
+
+struct AuctionResult
+{
+	TPrice		px;			// 0 when nothing crosses
+	TAuctionQty	qtyExec;
+	TAuctionQty	surplus;	// buy minus sell volume left at px
+
+	AuctionResult() : px(0), qtyExec(0), surplus(0) {}
+};
+
+// Dense depth over the candidate prices of a call auction, ascending.
+// Cumulative demand at a price is every bid at or above it plus the market
+// bids, cumulative supply every ask at or below it plus the market asks.
+class AuctionDepth
+{
+public:
+	inline void clear()
+	{
+		m_prices.clear();
+		m_bidQty.clear();
+		m_askQty.clear();
+	}
+
+	inline void reserve(std::size_t count)
+	{
+		m_prices.reserve(count);
+		m_bidQty.reserve(count);
+		m_askQty.reserve(count);
+	}
+
+	// Prices must be added in ascending order
+	inline void add(const TPrice& px, TAuctionQty qtyBid, TAuctionQty qtyAsk)
+	{
+		m_prices.push_back(px);
+		m_bidQty.push_back(qtyBid);
+		m_askQty.push_back(qtyAsk);
+	}
+
+	inline std::size_t size() const { return m_prices.size(); }
+
+	// Price maximising the executable volume. Ties go to the smallest
+	// surplus, then to the highest price under buy pressure or the lowest
+	// under sell pressure, then to the price closest to pxRef. Accumulates
+	// the depth in place, clear() before adding the next book.
+	AuctionResult equilibrium(TAuctionQty qtyMktBid, TAuctionQty qtyMktAsk, const TPrice& pxRef)
+	{
+		AuctionResult	result;
+		std::size_t		count(m_prices.size());
+
+		if (count == 0) {
+			// Market orders only, they can only meet at the reference price
+			if (pxRef > TPrice(0)) {
+				result.px = pxRef;
+				result.qtyExec = std::min(qtyMktBid, qtyMktAsk);
+				result.surplus = qtyMktBid - qtyMktAsk;
+			}
+			return result.qtyExec > 0 ? result : AuctionResult();
+		}
+
+		// Demand accumulates from the top, sum the bids back to front
+		for (std::size_t i = 0, j = count - 1; i < j; ++i, --j) {
+			std::swap(m_bidQty[i], m_bidQty[j]);
+		}
+		prefixSum(m_bidQty.data(), count);
+		prefixSum(m_askQty.data(), count);
+
+		std::size_t	best(count);
+		std::size_t	last(count);	// tied range is [best, last]
+		TAuctionQty	bestAbsSurplus(0);
+		bool		hasBuyPressure(false);
+		bool		hasSellPressure(false);
+
+		for (std::size_t i = 0; i < count; ++i) {
+			TAuctionQty demand(m_bidQty[count - 1 - i] + qtyMktBid);
+			TAuctionQty supply(m_askQty[i] + qtyMktAsk);
+			TAuctionQty qtyExec(std::min(demand, supply));
+			TAuctionQty surplus(demand - supply);
+			TAuctionQty absSurplus(surplus < 0 ? -surplus : surplus);
+
+			if (qtyExec == 0) continue;
+
+			if (qtyExec > result.qtyExec || (qtyExec == result.qtyExec && absSurplus < bestAbsSurplus)) {
+				result.qtyExec = qtyExec;
+				bestAbsSurplus = absSurplus;
+				best = last = i;
+				hasBuyPressure = surplus > 0;
+				hasSellPressure = surplus < 0;
+			}
+			else if (qtyExec == result.qtyExec && absSurplus == bestAbsSurplus) {
+				last = i;
+				hasBuyPressure = hasBuyPressure || surplus > 0;
+				hasSellPressure = hasSellPressure || surplus < 0;
+			}
+		}
+
+		if (best == count) return result;
+
+		std::size_t pick(best);
+
+		if (best != last) {
+			if (hasBuyPressure && !hasSellPressure) {
+				pick = last;
+			}
+			else if (hasSellPressure == hasBuyPressure && pxRef > TPrice(0)) {
+				// Only prices within the tie that share the best volume and
+				// surplus qualify, skip any in between that do not
+				TAuctionQty bestDist(-1);
+
+				for (std::size_t i = best; i <= last; ++i) {
+					TAuctionQty demand(m_bidQty[count - 1 - i] + qtyMktBid);
+					TAuctionQty supply(m_askQty[i] + qtyMktAsk);
+					TAuctionQty surplus(demand - supply);
+
+					if (std::min(demand, supply) != result.qtyExec || (surplus < 0 ? -surplus : surplus) != bestAbsSurplus) continue;
+
+					TAuctionQty dist(m_prices[i].rawValue() - pxRef.rawValue());
+
+					if (dist < 0) dist = -dist;
+					if (bestDist < 0 || dist < bestDist) {
+						bestDist = dist;
+						pick = i;
+					}
+				}
+			}
+		}
+
+		result.px = m_prices[pick];
+		result.surplus = m_bidQty[count - 1 - pick] + qtyMktBid - m_askQty[pick] - qtyMktAsk;
+		return result;
+	}
+
+protected:
+	std::vector<TPrice>			m_prices;
+	std::vector<TAuctionQty>	m_bidQty;
+	std::vector<TAuctionQty>	m_askQty;
+};
@@ -0,0 +1,339 @@
+#pragma once
+
+#include "BookUpdate.h"
+#include "Defn.h"
+#include "MappedFile.h"
+#include "OrdMatchingEngine.h"
+#include "Snapshot.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Mirror of a book's depth rebuilt from its BookUpdates, for consumers of
+// the engine's market by order stream. Orders sit in an open addressing
+// table keyed by bookOrderKey, so each update finds its order in O(1), and
+// each side's levels in a flat array ordered best last: updates mostly hit
+// the top of the book and are looked up from the end, and the top N levels
+// are the last N entries. Start from an engine's snapshot with
+// loadSnapshot(), then apply the updates made since; those the snapshot
+// already holds are skipped. Not thread safe.
+class BookBuilder : public OrdME::BookListener
+{
+public:
+	struct Level
+	{
+		TPrice			px;
+		TQty			qty;
+		std::uint32_t	orders;
+	};
+
+	static constexpr std::size_t DefaultOrderCapacity = std::size_t(1) << 16;
+
+	// orderCapacity is a sizing hint, the order table grows past it
+	BookBuilder(std::size_t orderCapacity = DefaultOrderCapacity) : m_shift(64), m_orderCount(0)
+	{
+		std::size_t slots(16);
+
+		while (slots < orderCapacity * 2) {
+			slots <<= 1;
+		}
+		resize(slots);
+		clear();
+	}
+
+	// Back to an empty book at seq 0, e.g. to follow an engine from its start
+	void clear()
+	{
+		std::fill(m_slots.begin(), m_slots.end(), OrderSlot{ 0, TPrice(0), 0, OrdSide::NONE });
+		m_orderCount = 0;
+		m_bids.clear();
+		m_asks.clear();
+		m_mktBid = Level{ TPrice(0), 0, 0 };
+		m_mktAsk = Level{ TPrice(0), 0, 0 };
+		m_pxLastTrade = TPrice(0);
+		m_volume = 0;
+		m_tradeCount = 0;
+		m_seq = 0;
+		m_isInSync = true;
+	}
+
+	// Rebuilds the book from an engine snapshot in one pass, the updates
+	// after its seq are then to be applied. Returns false, with the book
+	// cleared, if the file is not a usable snapshot.
+	bool loadSnapshot(const std::string& path)
+	{
+		MappedFile file;
+
+		clear();
+		if (!file.openRead(path.c_str())) return false;
+
+		SnapshotIn in(file.data(), file.size());
+		const SnapshotHeader* pHdr = in.next<SnapshotHeader>();
+
+		if (!pHdr || std::memcmp(pHdr->magic, SnapshotMagic, sizeof(pHdr->magic)) != 0 || pHdr->version != SnapshotVersion ||
+			file.size() != snapshotSize(pHdr->clientCount, pHdr->orderCount)) {
+			return false;
+		}
+		for (std::uint64_t i = 0; i < pHdr->clientCount; ++i) {
+			in.next<SnapshotClient>();
+		}
+		for (std::uint64_t i = 0; i < pHdr->orderCount; ++i) {
+			const SnapshotOrder& refRec(*in.next<SnapshotOrder>());
+
+			if (refRec.place != static_cast<std::uint8_t>(SnapshotOrdPlace::LEVEL)) continue;
+
+			if (!add(bookOrderKey(refRec.clientId, refRec.ordId), static_cast<OrdSide>(refRec.side),
+				TPrice(TPrice::RawValue{ refRec.px }), refRec.qtyShown)) {
+				clear();
+				return false;
+			}
+		}
+		m_pxLastTrade = TPrice(TPrice::RawValue{ pHdr->pxLastTrade });
+		m_seq = pHdr->updateSeq;
+		return true;
+	}
+
+	// Returns false, and stays out of sync until cleared or reloaded, on a
+	// gap in the seqs or an update that does not fit the book
+	bool apply(const BookUpdate& update)
+	{
+		if (!m_isInSync) return false;
+		if (update.seq <= m_seq) return true;
+		if (update.seq != m_seq + 1) {
+			m_isInSync = false;
+			return false;
+		}
+		m_seq = update.seq;
+
+		switch (update.type) {
+		case BookUpdateType::ADD:
+			m_isInSync = add(update.ordKey, update.side, update.px, update.qty);
+			break;
+		case BookUpdateType::EXECUTE:
+		case BookUpdateType::DELETE:
+			m_isInSync = reduce(update.ordKey, update.qty, update.type == BookUpdateType::DELETE);
+			break;
+		case BookUpdateType::TRADE:
+			m_pxLastTrade = update.px;
+			m_volume += update.qty;
+			++m_tradeCount;
+			break;
+		default:
+			m_isInSync = false;
+			break;
+		}
+		return m_isInSync;
+	}
+
+	void onBookUpdate(const BookUpdate& update) override { apply(update); }
+
+	inline bool isInSync() const { return m_isInSync; }
+	// Seq of the last update applied
+	inline std::uint64_t seq() const { return m_seq; }
+	inline std::size_t orderCount() const { return m_orderCount; }
+
+	// Limit levels, 0 being the best
+	inline std::size_t bidDepth() const { return m_bids.size(); }
+	inline std::size_t askDepth() const { return m_asks.size(); }
+	inline const Level& bid(std::size_t i) const { return m_bids[m_bids.size() - 1 - i]; }
+	inline const Level& ask(std::size_t i) const { return m_asks[m_asks.size() - 1 - i]; }
+
+	// Copies up to n levels from the best, returns how many
+	inline std::size_t topBids(Level* pLevels, std::size_t n) const { return top(m_bids, pLevels, n); }
+	inline std::size_t topAsks(Level* pLevels, std::size_t n) const { return top(m_asks, pLevels, n); }
+
+	// Market orders resting in an auction
+	inline const Level& mktBid() const { return m_mktBid; }
+	inline const Level& mktAsk() const { return m_mktAsk; }
+
+	inline const TPrice& lastTradePx() const { return m_pxLastTrade; }
+	inline std::uint64_t volume() const { return m_volume; }
+	inline std::uint64_t tradeCount() const { return m_tradeCount; }
+
+protected:
+	struct OrderSlot
+	{
+		std::uint64_t	key;		// 0 when free, order ids start at 1
+		TPrice			px;
+		TQty			qty;
+		OrdSide			side;
+	};
+
+	inline std::size_t home(std::uint64_t key) const
+	{
+		return static_cast<std::size_t>((key * 0x9e3779b97f4a7c15ULL) >> m_shift);
+	}
+
+	inline OrderSlot* find(std::uint64_t key)
+	{
+		std::size_t mask(m_slots.size() - 1);
+
+		for (std::size_t i = home(key); m_slots[i].key != 0; i = (i + 1) & mask) {
+			if (m_slots[i].key == key) return &m_slots[i];
+		}
+		return nullptr;
+	}
+
+	// Linear probing, a freed slot is refilled by shifting back the entries
+	// probed past it so that no tombstones build up
+	inline void erase(OrderSlot* pSlot)
+	{
+		std::size_t mask(m_slots.size() - 1);
+		std::size_t hole(static_cast<std::size_t>(pSlot - m_slots.data()));
+
+		for (std::size_t i = (hole + 1) & mask; m_slots[i].key != 0; i = (i + 1) & mask) {
+			std::size_t h(home(m_slots[i].key));
+
+			// Moved back unless its home lies cyclically in (hole, i]
+			if (((i - h) & mask) >= ((i - hole) & mask)) {
+				m_slots[hole] = m_slots[i];
+				hole = i;
+			}
+		}
+		m_slots[hole].key = 0;
+		--m_orderCount;
+	}
+
+	void resize(std::size_t slots)
+	{
+		std::vector<OrderSlot> old;
+
+		old.swap(m_slots);
+		m_slots.assign(slots, OrderSlot{ 0, TPrice(0), 0, OrdSide::NONE });
+		m_shift = 64;
+		for (std::size_t n = slots; n > 1; n >>= 1) {
+			--m_shift;
+		}
+
+		std::size_t mask(slots - 1);
+
+		for (const OrderSlot& refSlot : old) {
+			if (refSlot.key == 0) continue;
+
+			std::size_t i(home(refSlot.key));
+
+			while (m_slots[i].key != 0) {
+				i = (i + 1) & mask;
+			}
+			m_slots[i] = refSlot;
+		}
+	}
+
+	bool add(std::uint64_t key, OrdSide side, const TPrice& px, const TQty& qty)
+	{
+		if (key == 0 || qty == 0 || (side != OrdSide::BUY && side != OrdSide::SELL)) return false;
+		if ((m_orderCount + 1) * 2 > m_slots.size()) {
+			resize(m_slots.size() * 2);
+		}
+
+		std::size_t mask(m_slots.size() - 1);
+		std::size_t i(home(key));
+
+		for (; m_slots[i].key != 0; i = (i + 1) & mask) {
+			if (m_slots[i].key == key) return false;
+		}
+		m_slots[i] = OrderSlot{ key, px, qty, side };
+		++m_orderCount;
+
+		Level& refLevel(level(side, px));
+
+		refLevel.qty += qty;
+		++refLevel.orders;
+		return true;
+	}
+
+	// Takes qty off the order, all it has left when it is deleted
+	bool reduce(std::uint64_t key, const TQty& qty, bool isDelete)
+	{
+		OrderSlot* pSlot(find(key));
+
+		if (!pSlot || qty > pSlot->qty) return false;
+
+		TQty qtyOff(isDelete ? pSlot->qty : qty);
+		OrdSide side(pSlot->side);
+		TPrice px(pSlot->px);
+
+		pSlot->qty -= qtyOff;
+		bool isGone(pSlot->qty == 0);
+
+		if (isGone) {
+			erase(pSlot);
+		}
+
+		if (px == TPrice(0)) {
+			Level& refMkt(side == OrdSide::BUY ? m_mktBid : m_mktAsk);
+
+			refMkt.qty -= qtyOff;
+			refMkt.orders -= isGone ? 1 : 0;
+			return true;
+		}
+
+		std::vector<Level>& levels(side == OrdSide::BUY ? m_bids : m_asks);
+		std::size_t pos(levelPos(levels, side, px));
+
+		if (pos == 0 || levels[pos - 1].px != px) return false;
+
+		Level& refLevel(levels[pos - 1]);
+
+		refLevel.qty -= qtyOff;
+		if (isGone && --refLevel.orders == 0) {
+			levels.erase(levels.begin() + (pos - 1));
+		}
+		return true;
+	}
+
+	// One past where px is or goes, scanning from the best level down
+	inline static std::size_t levelPos(const std::vector<Level>& levels, OrdSide side, const TPrice& px)
+	{
+		std::size_t pos(levels.size());
+
+		if (side == OrdSide::BUY) {
+			while (pos > 0 && levels[pos - 1].px > px) {
+				--pos;
+			}
+		}
+		else {
+			while (pos > 0 && levels[pos - 1].px < px) {
+				--pos;
+			}
+		}
+		return pos;
+	}
+
+	inline Level& level(OrdSide side, const TPrice& px)
+	{
+		if (px == TPrice(0)) return side == OrdSide::BUY ? m_mktBid : m_mktAsk;
+
+		std::vector<Level>& levels(side == OrdSide::BUY ? m_bids : m_asks);
+		std::size_t pos(levelPos(levels, side, px));
+
+		if (pos > 0 && levels[pos - 1].px == px) return levels[pos - 1];
+		return *levels.insert(levels.begin() + pos, Level{ px, 0, 0 });
+	}
+
+	inline static std::size_t top(const std::vector<Level>& levels, Level* pLevels, std::size_t n)
+	{
+		std::size_t count(n < levels.size() ? n : levels.size());
+
+		for (std::size_t i = 0; i < count; ++i) {
+			pLevels[i] = levels[levels.size() - 1 - i];
+		}
+		return count;
+	}
+
+	std::vector<OrderSlot>	m_slots;		// power of 2 count, at most half full
+	unsigned				m_shift;		// 64 - log2 of the slot count
+	std::size_t				m_orderCount;
+	std::vector<Level>		m_bids;			// ascending, best last
+	std::vector<Level>		m_asks;			// descending, best last
+	Level					m_mktBid;
+	Level					m_mktAsk;
+	TPrice					m_pxLastTrade;
+	std::uint64_t			m_volume;
+	std::uint64_t			m_tradeCount;
+	std::uint64_t			m_seq;
+	bool					m_isInSync;
+};
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "Defn.h"
+#include "Order.h"
+
+#include <cstdint>
+
+// Order independent hash of a book's open orders: the sum, modulo 2^64, of
+// a 64 bit mix of each order's client, id, side and price times its
+// quantity outstanding. Being linear in the quantity, an insert, fill,
+// cancel or expiry updates it in O(1) from the event alone, in whatever
+// sequence the updates come. Books holding the same orders with the same
+// quantities have the same value, queue positions aside; an empty book has 0.
+class BookChecksum
+{
+public:
+	BookChecksum() : m_value(0) {}
+
+	inline std::uint64_t value() const { return m_value; }
+
+	inline void onOpen(const Order* pOrd, const TQty& qty)
+	{
+		m_value += key(pOrd->clientId(), pOrd->ordId(), pOrd->side(), pOrd->px()) * qty;
+	}
+
+	inline void onRelease(const Order* pOrd, const TQty& qty)
+	{
+		m_value -= key(pOrd->clientId(), pOrd->ordId(), pOrd->side(), pOrd->px()) * qty;
+	}
+
+	static inline std::uint64_t key(const TClientId& clientId, const TOrdId& ordId, OrdSide side, const TPrice& px)
+	{
+		std::uint64_t id(static_cast<std::uint64_t>(static_cast<std::uint32_t>(clientId)) << 32 | ordId);
+
+		return mix(mix(id) ^ static_cast<std::uint64_t>(px.rawValue()) ^ static_cast<std::uint64_t>(side) << 62);
+	}
+
+protected:
+	// splitmix64 finaliser
+	static inline std::uint64_t mix(std::uint64_t x)
+	{
+		x += 0x9e3779b97f4a7c15ULL;
+		x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+		return x ^ (x >> 31);
+	}
+
+	std::uint64_t	m_value;
+};
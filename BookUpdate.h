@@ -0,0 +1,37 @@
+#pragma once
+
+#include "Defn.h"
+
+#include <cstdint>
+
+// Market by order changes to the orders resting in a book's levels
+enum class BookUpdateType : std::uint8_t {
+	ADD,		// an order starts resting with qty
+	EXECUTE,	// a resting order traded qty, it leaves the book once none is left
+	DELETE,		// a resting order was cancelled or expired with qty left
+	TRADE		// a trade of qty at px, followed by the EXECUTE of the resting side(s)
+};
+
+static const std::string BookUpdateTypeStr[] = {
+	"ADD",
+	"EXECUTE",
+	"DELETE",
+	"TRADE"
+};
+
+struct BookUpdate
+{
+	std::uint64_t	seq;		// the book's update count, gapless from 1
+	std::uint64_t	ordKey;		// bookOrderKey, 0 for a TRADE
+	TExecId			execId;		// EXECUTE and TRADE
+	TPrice			px;			// 0 for market orders resting in an auction
+	TQty			qty;
+	OrdSide			side;		// order side, aggressor side of a TRADE or NONE in an auction
+	BookUpdateType	type;
+};
+
+// Book wide key of an order, order ids being per client
+inline std::uint64_t bookOrderKey(const TClientId& clientId, const TOrdId& ordId)
+{
+	return static_cast<std::uint64_t>(static_cast<std::uint32_t>(clientId)) << 32 | ordId;
+}
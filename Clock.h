@@ -0,0 +1,64 @@
+#pragma once
+
+#include "Defn.h"
+
+#include <chrono>
+
+class Clock
+{
+public:
+	virtual ~Clock() {}
+
+	// Nanoseconds since epoch
+	virtual TTimestamp now() const = 0;
+};
+
+class SystemClock : public Clock
+{
+public:
+	TTimestamp now() const override
+	{
+		return static_cast<TTimestamp>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::system_clock::now().time_since_epoch()).count());
+	}
+};
+
+// Clock advanced explicitly by the owner, for tests and replay
+class ManualClock : public Clock
+{
+public:
+	ManualClock(const TTimestamp& ts = 0) : m_now(ts) {}
+
+	TTimestamp now() const override { return m_now; }
+
+	inline void set(const TTimestamp& ts) { m_now = ts; }
+	inline void advance(const TTimestamp& ns) { m_now += ns; }
+
+protected:
+	TTimestamp	m_now;
+};
+
+// Shows the readings a standby replays until it goes live, then follows
+// the system clock without going back past the last reading replayed
+class ReplayClock : public Clock
+{
+public:
+	ReplayClock(const TTimestamp& ts = 0) : m_now(ts), m_isLive(false) {}
+
+	TTimestamp now() const override
+	{
+		if (!m_isLive) return m_now;
+
+		TTimestamp ts(m_sysClock.now());
+		return ts > m_now ? ts : m_now;
+	}
+
+	inline void set(const TTimestamp& ts) { m_now = ts; }
+	inline void goLive() { m_isLive = true; }
+	inline bool isLive() const { return m_isLive; }
+
+protected:
+	SystemClock	m_sysClock;
+	TTimestamp	m_now;
+	bool		m_isLive;
+};
@@ -60,6 +60,8 @@ public:
 		return *this;
 	}
 
+	inline value_type rawValue() const { return m_value; }
+
 	inline operator double() const {
 		return static_cast<double>(m_value / DecPointMult);
 	}
@@ -68,6 +70,7 @@ public:
 	}
 
 	inline bool operator==(const TMyself& rhs) const { return m_value == rhs.m_value; }
+	inline bool operator!=(const TMyself& rhs) const { return m_value != rhs.m_value; }
 	inline bool operator<(const TMyself& rhs) const { return m_value < rhs.m_value; }
 	inline bool operator<=(const TMyself& rhs) const { return m_value <= rhs.m_value; }
 	inline bool operator>(const TMyself& rhs) const { return m_value > rhs.m_value; }
@@ -10,6 +10,11 @@ using TQty = std::uint32_t;
 using TOrdId = std::uint32_t;
 using TExecId = std::uint32_t;
 using TClientId = int;
+using TSessionId = std::uint32_t;	// dense index assigned by OrdME::registerClient
+using TTimestamp = std::uint64_t;
+using TNotional = std::int64_t;	// raw price (1/100) times qty
+
+static constexpr TSessionId InvalidSessionId = static_cast<TSessionId>(-1);
 
 enum class OrdEventType {
 	NONE,
@@ -30,7 +35,7 @@ static const std::string OrdEventTypeStr[] = {
 	"NEW_REJECT",
 	"CANCEL",
 	"CANCEL_ACK",
-	"CANCAL_REJECT",
+	"CANCEL_REJECT",
 	"EXECUTION",
 	"EXPIRY"
 };
@@ -67,17 +72,104 @@ static const std::string OrdSideStr[] = {
 	"SELL"
 };
 
-static const std::string& toString(OrdEventType evt)
+enum class OrdTif {
+	GTC,
+	DAY,
+	GTD
+};
+
+static const std::string OrdTifStr[] = {
+	"GTC",
+	"DAY",
+	"GTD"
+};
+
+enum class OrdRejReason {
+	NONE,
+	UNKNOWN_CLIENT,
+	UNKNOWN_SIDE,
+	INVALID_QTY,
+	DUPLICATE_ORDER_ID,
+	UNKNOWN_ORDER,
+	TOO_LATE_TO_CANCEL,
+	NOT_IN_BOOK,
+	MAX_ORDER_QTY,
+	MAX_NOTIONAL,
+	PRICE_BAND,
+	MAX_GROSS_EXPOSURE,
+	MAX_NET_EXPOSURE,
+	INVALID_PRICE,
+	CROSSED_BOOK,
+	TOO_MANY_QUOTES,
+	THROTTLED,
+	MAX_OPEN_ORDERS
+};
+
+static const std::string OrdRejReasonStr[] = {
+	"NONE",
+	"UNKNOWN_CLIENT",
+	"UNKNOWN_SIDE",
+	"INVALID_QTY",
+	"DUPLICATE_ORDER_ID",
+	"UNKNOWN_ORDER",
+	"TOO_LATE_TO_CANCEL",
+	"NOT_IN_BOOK",
+	"MAX_ORDER_QTY",
+	"MAX_NOTIONAL",
+	"PRICE_BAND",
+	"MAX_GROSS_EXPOSURE",
+	"MAX_NET_EXPOSURE",
+	"INVALID_PRICE",
+	"CROSSED_BOOK",
+	"TOO_MANY_QUOTES",
+	"THROTTLED",
+	"MAX_OPEN_ORDERS"
+};
+
+inline const std::string& toString(OrdEventType evt)
 {
 	return OrdEventTypeStr[static_cast<std::underlying_type<OrdEventType>::type>(evt)];
 }
 
-static const std::string& toString(OrdStateType state)
+inline const std::string& toString(OrdStateType state)
 {
 	return OrdStateTypeStr[static_cast<std::underlying_type<OrdStateType>::type>(state)];
 }
 
-static const std::string& toString(OrdSide side)
+inline const std::string& toString(OrdSide side)
 {
 	return OrdSideStr[static_cast<std::underlying_type<OrdSide>::type>(side)];
 }
+
+inline const std::string& toString(OrdTif tif)
+{
+	return OrdTifStr[static_cast<std::underlying_type<OrdTif>::type>(tif)];
+}
+
+inline const std::string& toString(OrdRejReason reason)
+{
+	return OrdRejReasonStr[static_cast<std::underlying_type<OrdRejReason>::type>(reason)];
+}
+
+enum class TradingPhase {
+	CONTINUOUS,
+	CALL,
+	BATCH
+};
+
+static const std::string TradingPhaseStr[] = {
+	"CONTINUOUS",
+	"CALL",
+	"BATCH"
+};
+
+inline const std::string& toString(TradingPhase phase)
+{
+	return TradingPhaseStr[static_cast<std::underlying_type<TradingPhase>::type>(phase)];
+}
+
+enum class LevelAllocation {
+	FIFO,
+	PRO_RATA,
+	FIFO_TOP_PRO_RATA
+};
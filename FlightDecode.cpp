@@ -0,0 +1,130 @@
+// FlightDecode.cpp : Prints a flight recorder dump, one record per line.
+//
+
+#include "Defn.h"
+#include "FlightDump.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+template <std::size_t N>
+static const std::string& enumString(const std::string (&strs)[N], std::uint32_t value)
+{
+	static const std::string unknown("?");
+	return value < N ? strs[value] : unknown;
+}
+
+static TPrice rawPx(std::int64_t raw)
+{
+	return TPrice(TPrice::RawValue{ raw });
+}
+
+static void dumpRecord(const FlightRecord& refRec, std::uint64_t ns, double ticksPerNs)
+{
+	char stamp[32];
+
+	std::snprintf(stamp, sizeof(stamp), "%llu.%09llu", static_cast<unsigned long long>(ns / 1000000000ULL),
+		static_cast<unsigned long long>(ns % 1000000000ULL));
+	std::cout << stamp << " ";
+
+	switch (static_cast<FlightRecordKind>(refRec.kind)) {
+	case FlightRecordKind::NEW:
+		std::cout << "NEW clientId " << refRec.clientId << " " << enumString(OrdSideStr, refRec.code & 3);
+		std::cout << " " << enumString(OrdTifStr, (refRec.code >> 2) & 3) << ((refRec.code & FlightNewStop) ? " STOP" : "");
+		std::cout << " px " << rawPx(refRec.px) << " qty " << refRec.qty;
+		if (refRec.aux != 0) {
+			std::cout << " display " << refRec.aux;
+		}
+		break;
+	case FlightRecordKind::CANCEL:
+		std::cout << "CANCEL clientId " << refRec.clientId << " ordId " << refRec.ordId;
+		break;
+	case FlightRecordKind::BULK_LOAD:
+		std::cout << "BULK_LOAD orders " << refRec.qty;
+		break;
+	case FlightRecordKind::MASS_QUOTE:
+		std::cout << "MASS_QUOTE clientId " << refRec.clientId << " bids " << refRec.qty << " asks " << refRec.aux;
+		break;
+	case FlightRecordKind::UNCROSS:
+		std::cout << "UNCROSS";
+		break;
+	case FlightRecordKind::TIMER:
+		std::cout << "TIMER";
+		break;
+	case FlightRecordKind::DONE:
+		std::cout << "DONE clientId " << refRec.clientId << " " << enumString(OrdRejReasonStr, refRec.code);
+		std::cout << " took " << static_cast<std::uint64_t>(refRec.aux / ticksPerNs) << "ns";
+		break;
+	case FlightRecordKind::EVENT:
+		std::cout << "  " << enumString(OrdEventTypeStr, refRec.code) << " clientId " << refRec.clientId << " ordId " << refRec.ordId;
+		switch (static_cast<OrdEventType>(refRec.code)) {
+		case OrdEventType::NEW:
+		case OrdEventType::NEW_ACK:
+			std::cout << " px " << rawPx(refRec.px) << " qty " << refRec.qty;
+			break;
+		case OrdEventType::NEW_REJECT:
+		case OrdEventType::CANCEL_REJECT:
+			std::cout << " reason " << enumString(OrdRejReasonStr, refRec.aux);
+			break;
+		case OrdEventType::EXECUTION:
+			std::cout << " execId " << refRec.aux << " px " << rawPx(refRec.px) << " qty " << refRec.qty;
+			break;
+		case OrdEventType::CANCEL_ACK:
+		case OrdEventType::EXPIRY:
+			std::cout << " cancelled " << refRec.qty;
+			break;
+		default:
+			break;
+		}
+		break;
+	default:
+		std::cout << "UNKNOWN kind " << static_cast<int>(refRec.kind);
+		break;
+	}
+	std::cout << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+	static const char* causes[] = { "REQUEST", "SIGNAL", "LATENCY" };
+
+	if (argc != 2) {
+		std::cerr << "Usage: FlightDecode <dump file>" << std::endl;
+		return 1;
+	}
+
+	std::ifstream in(argv[1], std::ios::binary);
+	FlightDumpHeader hdr;
+
+	if (!in.read(reinterpret_cast<char*>(&hdr), sizeof(hdr)) || std::memcmp(hdr.magic, FlightDumpMagic, sizeof(hdr.magic)) != 0 ||
+		hdr.version != FlightDumpVersion || hdr.recordSize != sizeof(FlightRecord) || hdr.count > hdr.recorded) {
+		std::cerr << "Not a flight recorder dump " << argv[1] << std::endl;
+		return 1;
+	}
+
+	std::vector<FlightRecord> records(static_cast<std::size_t>(hdr.count));
+
+	in.read(reinterpret_cast<char*>(records.data()), records.size() * sizeof(FlightRecord));
+	records.resize(static_cast<std::size_t>(in.gcount()) / sizeof(FlightRecord));
+
+	// Counter rate over the recorder's lifetime, 1 tick per ns without one
+	double ticksPerNs(hdr.nsDump > hdr.nsStart && hdr.tscDump > hdr.tscStart ?
+		static_cast<double>(hdr.tscDump - hdr.tscStart) / (hdr.nsDump - hdr.nsStart) : 1.0);
+
+	std::cout << "cause " << (hdr.cause < 3 ? causes[hdr.cause] : "?");
+	if (hdr.signal != 0) {
+		std::cout << " signal " << hdr.signal;
+	}
+	std::cout << " recorded " << hdr.recorded << " held " << records.size() << " ticks/ns " << ticksPerNs << std::endl;
+
+	for (const FlightRecord& refRec : records) {
+		std::int64_t ticksBefore(static_cast<std::int64_t>(hdr.tscDump - refRec.tsc));
+
+		dumpRecord(refRec, hdr.nsDump - static_cast<std::uint64_t>(ticksBefore / ticksPerNs), ticksPerNs);
+	}
+	return 0;
+}
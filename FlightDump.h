@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+
+// Record and dump file layout of the FlightRecorder, shared with
+// FlightDecode
+enum class FlightRecordKind : std::uint8_t {
+	NONE,
+	NEW,			// code side | tif << 2 | FlightNewStop, aux display qty
+	CANCEL,
+	BULK_LOAD,		// qty orders
+	UNCROSS,
+	TIMER,			// a timer that expired or released orders
+	DONE,			// end of the command record before, code OrdRejReason, aux ticks taken
+	EVENT,			// code OrdEventType, aux exec id or OrdRejReason
+	MASS_QUOTE		// qty bid levels, aux ask levels
+};
+
+static constexpr std::uint8_t FlightNewStop = 1 << 4;
+
+// One command or event. Fields a record has no use for are 0. Aligned for
+// the streaming stores that write it.
+struct alignas(16) FlightRecord
+{
+	std::uint64_t	tsc;
+	std::int64_t	px;				// raw
+	std::uint32_t	ordId;
+	std::uint32_t	qty;
+	std::uint32_t	aux;
+	std::uint16_t	clientId;
+	std::uint8_t	kind;			// FlightRecordKind
+	std::uint8_t	code;
+};
+
+enum class FlightDumpCause : std::uint16_t {
+	REQUEST,
+	SIGNAL,
+	LATENCY
+};
+
+// Dump file layout: the header then the records held, oldest first. The
+// two clock pairs let a decoder turn counter readings into wall time.
+static constexpr char FlightDumpMagic[8] = { 'O', 'R', 'D', 'M', 'E', 'F', 'L', 'T' };
+static constexpr std::uint16_t FlightDumpVersion = 1;
+
+struct FlightDumpHeader
+{
+	char			magic[8];
+	std::uint16_t	version;
+	std::uint16_t	recordSize;
+	std::uint16_t	cause;			// FlightDumpCause
+	std::uint16_t	signal;
+	std::uint64_t	recorded;		// since the recorder was created
+	std::uint64_t	count;			// in the file
+	std::uint64_t	tscStart;
+	std::uint64_t	nsStart;
+	std::uint64_t	tscDump;
+	std::uint64_t	nsDump;
+};
+
+static_assert(sizeof(FlightRecord) == 32, "FlightRecord layout");
+static_assert(sizeof(FlightDumpHeader) == 64, "FlightDumpHeader layout");
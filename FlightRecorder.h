@@ -0,0 +1,436 @@
+#pragma once
+
+#include "Defn.h"
+#include "FlightDump.h"
+#include "OrdEvent.h"
+#include "Order.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <string>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include <fcntl.h>
+#ifdef _WIN32
+#include <io.h>
+#include <sys/stat.h>
+#else
+#include <time.h>
+#include <unistd.h>
+#endif
+
+// Time stamp counter where the CPU has one, steady clock ns elsewhere
+inline std::uint64_t readTsc()
+{
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+}
+
+// Nanoseconds since epoch, safe to read from a signal handler
+inline std::uint64_t wallClockNs()
+{
+#ifdef _WIN32
+	return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count());
+#else
+	struct timespec ts;
+
+	::clock_gettime(CLOCK_REALTIME, &ts);
+	return static_cast<std::uint64_t>(ts.tv_sec) * 1000000000ULL + static_cast<std::uint64_t>(ts.tv_nsec);
+#endif
+}
+
+// Fixed size ring of the engine's latest commands and events, always on.
+// Recording is a few stores into a preallocated slot, the oldest record
+// being overwritten once the ring is full. The ring is written out on
+// request, when a command takes longer than the latency threshold and,
+// once installCrashHandlers() is called, on a fatal signal or abort (a
+// failed assert, an uncaught exception) and on SIGUSR1. Automatic dumps go
+// to <dump path>.<n>. Recording is for the engine thread only.
+class FlightRecorder
+{
+public:
+	static constexpr std::size_t DefaultCapacity = std::size_t(1) << 16;
+	static constexpr std::size_t MaxPath = 512;
+
+	FlightRecorder(std::size_t capacity = DefaultCapacity) :
+		m_capacity(roundUpPow2(std::max<std::size_t>(capacity, 2))),
+		m_mask(m_capacity - 1),
+		m_pRecords(new FlightRecord[m_capacity]()),
+		m_recorded(0),
+		m_tscStart(readTsc()),
+		m_tscLast(m_tscStart),
+		m_nsStart(wallClockNs()),
+		m_thresholdTicks(std::numeric_limits<std::uint64_t>::max()),
+		m_rearmAt(0),
+		m_dumps(0)
+	{
+		std::strcpy(m_dumpPath, "flight");
+	}
+	FlightRecorder(const FlightRecorder&) = delete;
+	FlightRecorder& operator=(const FlightRecorder&) = delete;
+
+	~FlightRecorder()
+	{
+		FlightRecorder* pThis(this);
+
+		crashRecorder().compare_exchange_strong(pThis, nullptr);
+	}
+
+	inline std::size_t capacity() const { return m_capacity; }
+	inline std::uint64_t recorded() const { return m_recorded.load(std::memory_order_relaxed); }
+	// Automatic dumps written so far
+	inline std::uint32_t dumps() const { return m_dumps.load(std::memory_order_relaxed); }
+
+	// Prefix of the automatic dumps, false if longer than MaxPath allows
+	bool setDumpPath(const std::string& path)
+	{
+		if (path.empty() || path.size() + 12 >= MaxPath) return false;
+
+		std::memcpy(m_dumpPath, path.c_str(), path.size() + 1);
+		return true;
+	}
+	inline const char* dumpPath() const { return m_dumpPath; }
+
+	// Commands taking longer than ns dump the ring, at most once per ring's
+	// worth of records so that dumps do not overlap. 0 turns it off.
+	// Calibrating the counter takes about 10ms.
+	void setLatencyThreshold(const TTimestamp& ns)
+	{
+		m_thresholdTicks = ns == 0 ? std::numeric_limits<std::uint64_t>::max() : static_cast<std::uint64_t>(ns * ticksPerNs());
+	}
+
+	// This recorder is dumped on SIGSEGV, SIGBUS, SIGILL, SIGFPE and SIGABRT,
+	// after which the signal takes its default course, and on SIGUSR1. Only
+	// one recorder in the process can be installed, the last one wins.
+	void installCrashHandlers()
+	{
+		crashRecorder().store(this, std::memory_order_release);
+#ifdef _WIN32
+		for (int sig : { SIGSEGV, SIGILL, SIGFPE, SIGABRT }) {
+			std::signal(sig, onFatalSignal);
+		}
+#else
+		struct sigaction action;
+
+		std::memset(&action, 0, sizeof(action));
+		sigemptyset(&action.sa_mask);
+		action.sa_handler = onFatalSignal;
+		action.sa_flags = SA_RESETHAND;
+		for (int sig : { SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT }) {
+			::sigaction(sig, &action, nullptr);
+		}
+		action.sa_handler = onDumpSignal;
+		action.sa_flags = SA_RESTART;
+		::sigaction(SIGUSR1, &action, nullptr);
+#endif
+	}
+
+	bool dump(const std::string& path) const { return writeDump(path.c_str(), FlightDumpCause::REQUEST, 0); }
+
+	inline std::uint64_t recordNew(const Order& refOrd)
+	{
+		FlightRecord rec(start(FlightRecordKind::NEW, refOrd.clientId()));
+
+		rec.px = refOrd.px().rawValue();
+		rec.qty = refOrd.qty();
+		rec.aux = refOrd.qtyDisplay();
+		rec.code = static_cast<std::uint8_t>(static_cast<std::uint8_t>(refOrd.side()) | static_cast<std::uint8_t>(refOrd.tif()) << 2 |
+			(refOrd.isStop() ? FlightNewStop : 0));
+		push(rec);
+		return rec.tsc;
+	}
+
+	inline std::uint64_t recordCancel(const TClientId& clientId, const TOrdId& ordId)
+	{
+		FlightRecord rec(start(FlightRecordKind::CANCEL, clientId));
+
+		rec.ordId = ordId;
+		push(rec);
+		return rec.tsc;
+	}
+
+	inline std::uint64_t recordMassQuote(const TClientId& clientId, std::size_t bidCount, std::size_t askCount)
+	{
+		FlightRecord rec(start(FlightRecordKind::MASS_QUOTE, clientId));
+
+		rec.qty = static_cast<std::uint32_t>(std::min<std::size_t>(bidCount, std::numeric_limits<std::uint32_t>::max()));
+		rec.aux = static_cast<std::uint32_t>(std::min<std::size_t>(askCount, std::numeric_limits<std::uint32_t>::max()));
+		push(rec);
+		return rec.tsc;
+	}
+
+	inline std::uint64_t recordBulkLoad(std::size_t count)
+	{
+		FlightRecord rec(start(FlightRecordKind::BULK_LOAD, 0));
+
+		rec.qty = static_cast<std::uint32_t>(std::min<std::size_t>(count, std::numeric_limits<std::uint32_t>::max()));
+		push(rec);
+		return rec.tsc;
+	}
+
+	inline std::uint64_t recordUncross() { return record(FlightRecordKind::UNCROSS); }
+	inline std::uint64_t recordTimer() { return record(FlightRecordKind::TIMER); }
+
+	// Closes the command that started at tscStart
+	inline void recordDone(const TClientId& clientId, std::uint64_t tscStart, OrdRejReason reason)
+	{
+		FlightRecord rec(start(FlightRecordKind::DONE, clientId));
+		std::uint64_t ticks(rec.tsc - tscStart);
+
+		rec.code = static_cast<std::uint8_t>(reason);
+		rec.aux = static_cast<std::uint32_t>(std::min<std::uint64_t>(ticks, std::numeric_limits<std::uint32_t>::max()));
+		push(rec);
+		if (ticks > m_thresholdTicks && m_recorded.load(std::memory_order_relaxed) >= m_rearmAt) {
+			m_rearmAt = m_recorded.load(std::memory_order_relaxed) + m_capacity;
+			autoDump(FlightDumpCause::LATENCY, 0);
+		}
+	}
+
+	inline void recordEvent(const TClientId& clientId, const Order* pOrd, const OrdEvent* pEvent)
+	{
+		FlightRecord rec(start(FlightRecordKind::EVENT, clientId));
+
+		rec.ordId = pOrd ? pOrd->ordId() : 0;
+		rec.code = static_cast<std::uint8_t>(pEvent->eventType());
+
+		switch (pEvent->eventType()) {
+		case OrdEventType::NEW:
+			rec.px = static_cast<const NewOrdEvent*>(pEvent)->px().rawValue();
+			rec.qty = static_cast<const NewOrdEvent*>(pEvent)->qty();
+			break;
+		case OrdEventType::NEW_ACK:
+			rec.px = static_cast<const NewAckOrdEvent*>(pEvent)->px().rawValue();
+			rec.qty = static_cast<const NewAckOrdEvent*>(pEvent)->qtyOutstanding();
+			break;
+		case OrdEventType::NEW_REJECT:
+			rec.aux = static_cast<std::uint32_t>(static_cast<const NewRejOrdEvent*>(pEvent)->reason());
+			break;
+		case OrdEventType::CANCEL_REJECT:
+			rec.ordId = static_cast<const CanRejOrdEvent*>(pEvent)->canOrdId();
+			rec.aux = static_cast<std::uint32_t>(static_cast<const CanRejOrdEvent*>(pEvent)->reason());
+			break;
+		case OrdEventType::CANCEL_ACK:
+			rec.qty = static_cast<const CanAckOrdEvent*>(pEvent)->qtyCancelled();
+			break;
+		case OrdEventType::EXECUTION:
+			rec.px = static_cast<const Execution*>(pEvent)->pxExec().rawValue();
+			rec.qty = static_cast<const Execution*>(pEvent)->qtyExec();
+			rec.aux = static_cast<const Execution*>(pEvent)->execId();
+			break;
+		case OrdEventType::EXPIRY:
+			rec.qty = static_cast<const Expired*>(pEvent)->qtyCancelled();
+			break;
+		default:
+			break;
+		}
+		push(rec);
+	}
+
+	// Counter ticks per ns, measured over about 10ms
+	static double ticksPerNs()
+	{
+		auto start(std::chrono::steady_clock::now());
+		std::uint64_t tscStart(readTsc());
+		std::chrono::steady_clock::duration elapsed;
+
+		do {
+			elapsed = std::chrono::steady_clock::now() - start;
+		} while (elapsed < std::chrono::milliseconds(10));
+
+		return static_cast<double>(readTsc() - tscStart) /
+			std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+	}
+
+protected:
+	static std::size_t roundUpPow2(std::size_t n)
+	{
+		std::size_t pow2(1);
+
+		while (pow2 < n) {
+			pow2 <<= 1;
+		}
+		return pow2;
+	}
+
+	// Only commands read the counter, which costs more than the rest of the
+	// record, events are stamped with the reading of the command they came
+	// out of
+	inline FlightRecord start(FlightRecordKind kind, const TClientId& clientId)
+	{
+		FlightRecord rec = FlightRecord();
+
+		if (kind != FlightRecordKind::EVENT) {
+			m_tscLast = readTsc();
+		}
+		rec.tsc = m_tscLast;
+		rec.kind = static_cast<std::uint8_t>(kind);
+		rec.clientId = static_cast<std::uint16_t>(clientId);
+		return rec;
+	}
+
+	inline std::uint64_t record(FlightRecordKind kind)
+	{
+		FlightRecord rec(start(kind, 0));
+
+		push(rec);
+		return rec.tsc;
+	}
+
+	// The ring is only read back when dumped, so records are written around
+	// the cache where the CPU can, leaving it to the book. A dump may catch
+	// the latest records half written.
+	inline void push(const FlightRecord& refRec)
+	{
+		std::uint64_t recorded(m_recorded.load(std::memory_order_relaxed));
+		FlightRecord* pSlot(&m_pRecords[recorded & m_mask]);
+
+#if defined(__SSE2__) || defined(_M_X64)
+		const __m128i* pSrc(reinterpret_cast<const __m128i*>(&refRec));
+
+		_mm_stream_si128(reinterpret_cast<__m128i*>(pSlot), _mm_loadu_si128(pSrc));
+		_mm_stream_si128(reinterpret_cast<__m128i*>(pSlot) + 1, _mm_loadu_si128(pSrc + 1));
+#else
+		*pSlot = refRec;
+#endif
+		m_recorded.store(recorded + 1, std::memory_order_release);
+	}
+
+	// Only async signal safe calls from here on
+	void autoDump(FlightDumpCause cause, int signal)
+	{
+		char path[MaxPath];
+		char digits[12];
+		std::size_t len(std::strlen(m_dumpPath));
+		std::uint32_t n(m_dumps.fetch_add(1, std::memory_order_relaxed) + 1);
+		int count(0);
+
+		do {
+			digits[count++] = static_cast<char>('0' + n % 10);
+			n /= 10;
+		} while (n != 0);
+
+		std::memcpy(path, m_dumpPath, len);
+		path[len++] = '.';
+		while (count > 0) {
+			path[len++] = digits[--count];
+		}
+		path[len] = '\0';
+		writeDump(path, cause, signal);
+	}
+
+	bool writeDump(const char* path, FlightDumpCause cause, int signal) const
+	{
+#ifdef _WIN32
+		int fd(::_open(path, _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE));
+#else
+		int fd(::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644));
+#endif
+		if (fd < 0) return false;
+
+#if defined(__SSE2__) || defined(_M_X64)
+		// Drains this thread's pending streaming stores
+		_mm_sfence();
+#endif
+		std::uint64_t recorded(m_recorded.load(std::memory_order_acquire));
+		std::uint64_t count(std::min<std::uint64_t>(recorded, m_capacity));
+		std::size_t first(static_cast<std::size_t>((recorded - count) & m_mask));
+		std::size_t head(std::min<std::size_t>(static_cast<std::size_t>(count), m_capacity - first));
+		FlightDumpHeader hdr;
+
+		std::memset(&hdr, 0, sizeof(hdr));
+		std::memcpy(hdr.magic, FlightDumpMagic, sizeof(hdr.magic));
+		hdr.version = FlightDumpVersion;
+		hdr.recordSize = sizeof(FlightRecord);
+		hdr.cause = static_cast<std::uint16_t>(cause);
+		hdr.signal = static_cast<std::uint16_t>(signal);
+		hdr.recorded = recorded;
+		hdr.count = count;
+		hdr.tscStart = m_tscStart;
+		hdr.nsStart = m_nsStart;
+		hdr.tscDump = readTsc();
+		hdr.nsDump = wallClockNs();
+
+		bool isOk(writeAll(fd, &hdr, sizeof(hdr)) &&
+			writeAll(fd, m_pRecords.get() + first, head * sizeof(FlightRecord)) &&
+			writeAll(fd, m_pRecords.get(), (count - head) * sizeof(FlightRecord)));
+#ifdef _WIN32
+		::_close(fd);
+#else
+		::close(fd);
+#endif
+		return isOk;
+	}
+
+	static bool writeAll(int fd, const void* pData, std::size_t size)
+	{
+		const char* p(static_cast<const char*>(pData));
+
+		while (size > 0) {
+#ifdef _WIN32
+			int written(::_write(fd, p, static_cast<unsigned int>(std::min<std::size_t>(size, 1 << 30))));
+#else
+			ssize_t written(::write(fd, p, size));
+#endif
+			if (written <= 0) return false;
+			p += written;
+			size -= static_cast<std::size_t>(written);
+		}
+		return true;
+	}
+
+	// Initialised by installCrashHandlers() before any handler can run
+	static std::atomic<FlightRecorder*>& crashRecorder()
+	{
+		static std::atomic<FlightRecorder*> s_pRecorder(nullptr);
+		return s_pRecorder;
+	}
+
+	static void onFatalSignal(int sig)
+	{
+		// Taken so that a fault while dumping does not dump again
+		FlightRecorder* pRecorder(crashRecorder().exchange(nullptr));
+
+		if (pRecorder) {
+			pRecorder->autoDump(FlightDumpCause::SIGNAL, sig);
+		}
+		// The default action was restored when the handler was entered
+		std::raise(sig);
+	}
+
+	static void onDumpSignal(int sig)
+	{
+		FlightRecorder* pRecorder(crashRecorder().load(std::memory_order_acquire));
+
+		if (pRecorder) {
+			pRecorder->autoDump(FlightDumpCause::SIGNAL, sig);
+		}
+	}
+
+	const std::size_t				m_capacity;
+	const std::size_t				m_mask;
+	std::unique_ptr<FlightRecord[]>	m_pRecords;
+	std::atomic<std::uint64_t>		m_recorded;
+	std::uint64_t					m_tscStart;
+	std::uint64_t					m_tscLast;
+	std::uint64_t					m_nsStart;
+	std::uint64_t					m_thresholdTicks;
+	std::uint64_t					m_rearmAt;		// recorded count from which a breach dumps again
+	std::atomic<std::uint32_t>		m_dumps;
+	char							m_dumpPath[MaxPath];
+};
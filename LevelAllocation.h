@@ -0,0 +1,110 @@
+#pragma once
+
+#include "Defn.h"
+#include "OrdBook.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Policies splitting an incoming qty among the orders queued at one price.
+// allocate calls cross(entry, qty) for each maker filled, in queue order,
+// and leaves the level without filled entries. refScratch is reusable
+// space owned by the caller.
+
+// Strict price-time, the queue is consumed from the front
+struct FifoAllocation
+{
+	template <typename Cross>
+	inline static void allocate(PriceLevel& refLevel, TQty qty, std::vector<TQty>&, Cross&& cross)
+	{
+		while (qty > 0 && !refLevel.isEmpty()) {
+			PriceLevel::Entry& refEntry(refLevel.frontEntry());
+			TQty qtyExec(std::min(qty, refEntry.qty));
+
+			cross(refEntry, qtyExec);
+			qty -= qtyExec;
+			if (refEntry.qty == 0) {
+				refLevel.popFrontOrder();
+			}
+		}
+	}
+};
+
+// Every maker gets its share of qty in proportion to its size, rounded down.
+// The lots lost to rounding go one each to the makers in queue order.
+struct ProRataAllocation
+{
+	template <typename Cross>
+	inline static void allocate(PriceLevel& refLevel, TQty qty, std::vector<TQty>& refScratch, Cross&& cross)
+	{
+		if (qty >= refLevel.vol()) {
+			FifoAllocation::allocate(refLevel, qty, refScratch, cross);
+			return;
+		}
+		if (qty == 0) return;
+
+		PriceLevel::Entry* pEntries(refLevel.entriesBegin());
+		std::size_t count(static_cast<std::size_t>(refLevel.entriesEnd() - pEntries));
+
+		// qty / vol as a 32 bit fixed point fraction below 1, it never rounds
+		// a share up so the shares cannot add up to more than qty
+		std::uint64_t ratio((static_cast<std::uint64_t>(qty) << 32) / refLevel.vol());
+		std::uint64_t qtyAlloc(0);
+
+		refScratch.resize(count);
+
+		// Removed entries have 0 qty and get 0 without a branch
+		for (std::size_t i = 0; i < count; ++i) {
+			TQty share(static_cast<TQty>((static_cast<std::uint64_t>(pEntries[i].qty) * ratio) >> 32));
+
+			refScratch[i] = share;
+			qtyAlloc += share;
+		}
+
+		TQty qtyLeft(static_cast<TQty>(qty - qtyAlloc));
+
+		for (std::size_t i = 0; i < count && qtyLeft > 0; ++i) {
+			if (refScratch[i] < pEntries[i].qty) {
+				++refScratch[i];
+				--qtyLeft;
+			}
+		}
+		for (std::size_t i = 0; i < count && qtyLeft > 0; ++i) {
+			TQty qtyMore(std::min(qtyLeft, static_cast<TQty>(pEntries[i].qty - refScratch[i])));
+
+			refScratch[i] += qtyMore;
+			qtyLeft -= qtyMore;
+		}
+
+		for (std::size_t i = 0; i < count; ++i) {
+			if (refScratch[i] > 0) {
+				cross(pEntries[i], refScratch[i]);
+			}
+		}
+		refLevel.eraseFilled();
+	}
+};
+
+// The order at the front of the queue is filled first, the rest of qty is
+// shared pro-rata among the makers behind it
+struct FifoTopProRataAllocation
+{
+	template <typename Cross>
+	inline static void allocate(PriceLevel& refLevel, TQty qty, std::vector<TQty>& refScratch, Cross&& cross)
+	{
+		if (qty == 0 || refLevel.isEmpty()) return;
+
+		PriceLevel::Entry& refTop(refLevel.frontEntry());
+		TQty qtyTop(std::min(qty, refTop.qty));
+
+		cross(refTop, qtyTop);
+		if (refTop.qty == 0) {
+			refLevel.popFrontOrder();
+		}
+		if (!refLevel.isEmpty()) {
+			ProRataAllocation::allocate(refLevel, qty - qtyTop, refScratch, cross);
+		}
+	}
+};
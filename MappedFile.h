@@ -0,0 +1,290 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Whole file mapped into memory, created at a fixed size or opened for
+// writing, or opened read only. Does not allocate, so it is safe in a forked child.
+class MappedFile
+{
+public:
+	MappedFile() : m_pData(nullptr), m_size(0)
+#ifdef _WIN32
+		, m_hFile(INVALID_HANDLE_VALUE), m_hMapping(nullptr)
+#else
+		, m_fd(-1)
+#endif
+	{}
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	~MappedFile() { close(); }
+
+	inline bool isOpen() const { return m_pData != nullptr; }
+	inline char* data() { return m_pData; }
+	inline const char* data() const { return m_pData; }
+	inline std::size_t size() const { return m_size; }
+
+	void swap(MappedFile& other)
+	{
+		std::swap(m_pData, other.m_pData);
+		std::swap(m_size, other.m_size);
+#ifdef _WIN32
+		std::swap(m_hFile, other.m_hFile);
+		std::swap(m_hMapping, other.m_hMapping);
+#else
+		std::swap(m_fd, other.m_fd);
+#endif
+	}
+
+	// Creates or truncates path to size bytes, mapped read/write
+	bool create(const char* path, std::size_t size)
+	{
+		close();
+		if (size == 0) return false;
+
+#ifdef _WIN32
+		m_hFile = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (m_hFile == INVALID_HANDLE_VALUE) return false;
+
+		m_hMapping = CreateFileMappingA(m_hFile, nullptr, PAGE_READWRITE,
+			static_cast<DWORD>(static_cast<std::uint64_t>(size) >> 32), static_cast<DWORD>(size), nullptr);
+		if (!m_hMapping) {
+			close();
+			return false;
+		}
+		m_pData = static_cast<char*>(MapViewOfFile(m_hMapping, FILE_MAP_WRITE, 0, 0, size));
+#else
+		m_fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if (m_fd < 0) return false;
+
+		if (::ftruncate(m_fd, static_cast<off_t>(size)) != 0) {
+			close();
+			return false;
+		}
+
+		void* p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+
+		m_pData = p == MAP_FAILED ? nullptr : static_cast<char*>(p);
+#endif
+		if (!m_pData) {
+			close();
+			return false;
+		}
+		m_size = size;
+		return true;
+	}
+
+	// Opens path read/write without truncating, creating it if missing, and
+	// grows it to at least minSize bytes
+	bool open(const char* path, std::size_t minSize)
+	{
+		close();
+
+#ifdef _WIN32
+		m_hFile = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (m_hFile == INVALID_HANDLE_VALUE) return false;
+
+		LARGE_INTEGER size;
+
+		if (!GetFileSizeEx(m_hFile, &size)) {
+			close();
+			return false;
+		}
+		m_size = static_cast<std::size_t>(size.QuadPart);
+#else
+		m_fd = ::open(path, O_RDWR | O_CREAT, 0644);
+		if (m_fd < 0) return false;
+
+		struct stat st;
+
+		if (::fstat(m_fd, &st) != 0) {
+			close();
+			return false;
+		}
+		m_size = static_cast<std::size_t>(st.st_size);
+#endif
+		if (!resize(m_size > minSize ? m_size : minSize)) {
+			close();
+			return false;
+		}
+		return true;
+	}
+
+	// Grows or shrinks a file opened by open and maps it again, data() moves
+	bool resize(std::size_t size)
+	{
+		if (size == 0) return false;
+
+#ifdef _WIN32
+		if (m_pData) UnmapViewOfFile(m_pData);
+		if (m_hMapping) CloseHandle(m_hMapping);
+		m_pData = nullptr;
+
+		// The mapping extends the file to its size
+		m_hMapping = CreateFileMappingA(m_hFile, nullptr, PAGE_READWRITE,
+			static_cast<DWORD>(static_cast<std::uint64_t>(size) >> 32), static_cast<DWORD>(size), nullptr);
+		if (!m_hMapping) return false;
+		m_pData = static_cast<char*>(MapViewOfFile(m_hMapping, FILE_MAP_WRITE, 0, 0, size));
+#else
+		if (m_pData) ::munmap(m_pData, m_size);
+		m_pData = nullptr;
+
+		if (::ftruncate(m_fd, static_cast<off_t>(size)) != 0) return false;
+
+		void* p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+
+		m_pData = p == MAP_FAILED ? nullptr : static_cast<char*>(p);
+#endif
+		m_size = m_pData ? size : 0;
+		return m_pData != nullptr;
+	}
+
+	// Maps the whole of an existing path read/write, shared with the other
+	// mappings of the file
+	bool openShared(const char* path)
+	{
+		close();
+
+#ifdef _WIN32
+		m_hFile = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (m_hFile == INVALID_HANDLE_VALUE) return false;
+
+		LARGE_INTEGER size;
+
+		if (!GetFileSizeEx(m_hFile, &size) || size.QuadPart == 0) {
+			close();
+			return false;
+		}
+		m_hMapping = CreateFileMappingA(m_hFile, nullptr, PAGE_READWRITE, 0, 0, nullptr);
+		if (!m_hMapping) {
+			close();
+			return false;
+		}
+		m_pData = static_cast<char*>(MapViewOfFile(m_hMapping, FILE_MAP_WRITE, 0, 0, 0));
+		m_size = static_cast<std::size_t>(size.QuadPart);
+#else
+		m_fd = ::open(path, O_RDWR);
+		if (m_fd < 0) return false;
+
+		struct stat st;
+
+		if (::fstat(m_fd, &st) != 0 || st.st_size == 0) {
+			close();
+			return false;
+		}
+		m_size = static_cast<std::size_t>(st.st_size);
+
+		void* p = ::mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+
+		m_pData = p == MAP_FAILED ? nullptr : static_cast<char*>(p);
+#endif
+		if (!m_pData) {
+			close();
+			return false;
+		}
+		return true;
+	}
+
+	// Maps the whole of path read only. The mapping is shared, so it follows
+	// writes made to the file through other mappings.
+	bool openRead(const char* path)
+	{
+		close();
+
+#ifdef _WIN32
+		m_hFile = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (m_hFile == INVALID_HANDLE_VALUE) return false;
+
+		LARGE_INTEGER size;
+
+		if (!GetFileSizeEx(m_hFile, &size) || size.QuadPart == 0) {
+			close();
+			return false;
+		}
+		m_hMapping = CreateFileMappingA(m_hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (!m_hMapping) {
+			close();
+			return false;
+		}
+		m_pData = static_cast<char*>(MapViewOfFile(m_hMapping, FILE_MAP_READ, 0, 0, 0));
+		m_size = static_cast<std::size_t>(size.QuadPart);
+#else
+		m_fd = ::open(path, O_RDONLY);
+		if (m_fd < 0) return false;
+
+		struct stat st;
+
+		if (::fstat(m_fd, &st) != 0 || st.st_size == 0) {
+			close();
+			return false;
+		}
+		m_size = static_cast<std::size_t>(st.st_size);
+
+		void* p = ::mmap(nullptr, m_size, PROT_READ, MAP_SHARED, m_fd, 0);
+
+		m_pData = p == MAP_FAILED ? nullptr : static_cast<char*>(p);
+		if (m_pData) {
+			// Read front to back once
+			::madvise(p, m_size, MADV_SEQUENTIAL);
+		}
+#endif
+		if (!m_pData) {
+			close();
+			return false;
+		}
+		return true;
+	}
+
+	// Flushes the mapped pages to the file
+	bool sync()
+	{
+		if (!m_pData) return false;
+
+#ifdef _WIN32
+		return FlushViewOfFile(m_pData, 0) && FlushFileBuffers(m_hFile);
+#else
+		return ::msync(m_pData, m_size, MS_SYNC) == 0;
+#endif
+	}
+
+	void close()
+	{
+#ifdef _WIN32
+		if (m_pData) UnmapViewOfFile(m_pData);
+		if (m_hMapping) CloseHandle(m_hMapping);
+		if (m_hFile != INVALID_HANDLE_VALUE) CloseHandle(m_hFile);
+		m_hMapping = nullptr;
+		m_hFile = INVALID_HANDLE_VALUE;
+#else
+		if (m_pData) ::munmap(m_pData, m_size);
+		if (m_fd >= 0) ::close(m_fd);
+		m_fd = -1;
+#endif
+		m_pData = nullptr;
+		m_size = 0;
+	}
+
+protected:
+	char*		m_pData;
+	std::size_t	m_size;
+#ifdef _WIN32
+	HANDLE		m_hFile;
+	HANDLE		m_hMapping;
+#else
+	int			m_fd;
+#endif
+};
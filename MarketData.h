@@ -0,0 +1,210 @@
+#pragma once
+
+#include "Clock.h"
+#include "Defn.h"
+#include "OrdMatchingEngine.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+struct DepthLevel
+{
+	TPrice			px;
+	TQty			qty;
+	std::uint32_t	orders;
+};
+
+// Aggregated top of the limit book, best prices first
+struct DepthSnapshot
+{
+	static constexpr std::size_t MaxDepth = 32;
+
+	std::uint64_t	version;		// book version it was taken at
+	TTimestamp		ts;
+	TPrice			lastTradePx;
+	std::uint32_t	bidCount;
+	std::uint32_t	askCount;
+	DepthLevel		bids[MaxDepth];
+	DepthLevel		asks[MaxDepth];
+};
+
+// Conflating market data: each subscriber gets the latest top N of the
+// book, at most once per interval of its choosing and only when the book
+// changed since, updates in between being dropped. The engine thread calls
+// poll(), which does nothing for a book whose version has not moved and
+// otherwise writes each subscriber due into its own triple buffer, so a
+// slow or stalled reader never holds the engine up nor sees a torn update.
+// Subscribe and unsubscribe on the engine thread; each Subscription is read
+// by one consumer thread.
+class MarketDataPublisher
+{
+public:
+	class Subscription
+	{
+	public:
+		// Latest snapshot if one came since the last call, else nullptr. It
+		// stays valid until the next call.
+		const DepthSnapshot* read()
+		{
+			if (!(m_latest.load(std::memory_order_relaxed) & Fresh)) return nullptr;
+
+			m_front = m_latest.exchange(m_front, std::memory_order_acq_rel) & Index;
+			return &m_buffers[m_front];
+		}
+
+		inline std::size_t depth() const { return m_depth; }
+		inline const TTimestamp& interval() const { return m_intervalNs; }
+		// Snapshots written, whether read or dropped
+		inline std::uint64_t published() const { return m_published; }
+
+	protected:
+		friend class MarketDataPublisher;
+
+		static constexpr std::uint8_t Index = 3;
+		static constexpr std::uint8_t Fresh = 4;
+
+		Subscription(std::size_t depth, const TTimestamp& intervalNs) :
+			m_depth(depth < DepthSnapshot::MaxDepth ? depth : DepthSnapshot::MaxDepth), m_intervalNs(intervalNs),
+			m_version(0), m_lastTs(0), m_published(0), m_back(0), m_latest(1), m_front(2)
+		{}
+
+		// Writer side, the engine thread
+		inline DepthSnapshot& back() { return m_buffers[m_back]; }
+		inline void publish()
+		{
+			m_back = m_latest.exchange(static_cast<std::uint8_t>(m_back | Fresh), std::memory_order_acq_rel) & Index;
+			++m_published;
+		}
+
+		std::size_t					m_depth;
+		TTimestamp					m_intervalNs;
+		std::uint64_t				m_version;		// book version last written
+		TTimestamp					m_lastTs;
+		std::uint64_t				m_published;
+		std::uint8_t				m_back;
+		alignas(64) std::atomic<std::uint8_t>	m_latest;	// index of the buffer last written, Fresh until read
+		alignas(64) std::uint8_t	m_front;		// reader side
+		DepthSnapshot				m_buffers[3];
+	};
+
+	// pClock times the intervals, the system clock is used when none is given
+	MarketDataPublisher(const OrdME& me, Clock* pClock = nullptr) :
+		m_me(me), m_pClock(pClock ? pClock : &m_sysClock), m_version(0), m_depth(0)
+	{
+		m_scratch.version = 0;
+	}
+	MarketDataPublisher(const MarketDataPublisher&) = delete;
+	MarketDataPublisher& operator=(const MarketDataPublisher&) = delete;
+
+	// depth is capped at DepthSnapshot::MaxDepth, an intervalNs of 0 sends
+	// every change poll() sees. The first poll() sends the book as it is.
+	Subscription* subscribe(std::size_t depth, const TTimestamp& intervalNs)
+	{
+		m_subs.emplace_back(new Subscription(depth, intervalNs));
+		m_depth = std::max(m_depth, m_subs.back()->depth());
+		m_version = ~m_me.bookVersion();
+		return m_subs.back().get();
+	}
+
+	// The consumer must be done with pSub
+	bool unsubscribe(Subscription* pSub)
+	{
+		auto it(std::find_if(m_subs.begin(), m_subs.end(),
+			[pSub](const std::unique_ptr<Subscription>& upSub) { return upSub.get() == pSub; }));
+
+		if (it == m_subs.end()) return false;
+
+		m_subs.erase(it);
+		m_depth = 0;
+		for (auto& upSub : m_subs) {
+			m_depth = std::max(m_depth, upSub->depth());
+		}
+		return true;
+	}
+
+	inline std::size_t subscriberCount() const { return m_subs.size(); }
+
+	// Sends the book to every subscriber it changed for and whose interval
+	// has run out, returns how many. Run it on the engine thread between
+	// commands, e.g. alongside onTimer.
+	std::size_t poll()
+	{
+		std::uint64_t version(m_me.bookVersion());
+
+		if (version == m_version) return 0;
+
+		TTimestamp now(m_pClock->now());
+		std::size_t sent(0);
+		bool isBuilt(false);
+
+		// Not due subscribers keep the book dirty for the next poll
+		m_version = version;
+		for (auto& upSub : m_subs) {
+			Subscription& refSub(*upSub);
+
+			if (refSub.m_version == version && refSub.m_published != 0) continue;
+			if (refSub.m_published != 0 && now - refSub.m_lastTs < refSub.m_intervalNs) {
+				m_version = ~version;
+				continue;
+			}
+			if (!isBuilt) {
+				build(version, now);
+				isBuilt = true;
+			}
+			copy(refSub.back(), refSub.m_depth);
+			refSub.publish();
+			refSub.m_version = version;
+			refSub.m_lastTs = now;
+			++sent;
+		}
+		return sent;
+	}
+
+protected:
+	// Takes the top of the book once per poll at the deepest depth subscribed
+	void build(std::uint64_t version, const TTimestamp& now)
+	{
+		const OrdBook& refBook(m_me.ordBook());
+
+		m_scratch.version = version;
+		m_scratch.ts = now;
+		m_scratch.lastTradePx = refBook.lastTradePx();
+		m_scratch.bidCount = fill(m_scratch.bids, refBook.beginLimitBids(), refBook.endLimitBids());
+		m_scratch.askCount = fill(m_scratch.asks, refBook.beginLimitAsks(), refBook.endLimitAsks());
+	}
+
+	template <typename TIt>
+	std::uint32_t fill(DepthLevel* pLevels, TIt it, TIt itE) const
+	{
+		std::uint32_t count(0);
+
+		for (; it != itE && count < m_depth; ++it) {
+			if (it->second.isEmpty()) continue;
+
+			pLevels[count++] = DepthLevel{ it->first, it->second.vol(), static_cast<std::uint32_t>(it->second.count()) };
+		}
+		return count;
+	}
+
+	void copy(DepthSnapshot& refSnap, std::size_t depth) const
+	{
+		refSnap.version = m_scratch.version;
+		refSnap.ts = m_scratch.ts;
+		refSnap.lastTradePx = m_scratch.lastTradePx;
+		refSnap.bidCount = std::min<std::uint32_t>(m_scratch.bidCount, static_cast<std::uint32_t>(depth));
+		refSnap.askCount = std::min<std::uint32_t>(m_scratch.askCount, static_cast<std::uint32_t>(depth));
+		std::copy(m_scratch.bids, m_scratch.bids + refSnap.bidCount, refSnap.bids);
+		std::copy(m_scratch.asks, m_scratch.asks + refSnap.askCount, refSnap.asks);
+	}
+
+	const OrdME&								m_me;
+	SystemClock									m_sysClock;
+	Clock*										m_pClock;
+	std::uint64_t								m_version;		// book version every subscriber has, or not the book's
+	std::size_t									m_depth;		// deepest subscribed
+	std::vector<std::unique_ptr<Subscription>>	m_subs;
+	DepthSnapshot								m_scratch;
+};
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "Defn.h"
+
+#include <cstddef>
+#include <cstdint>
+
+static constexpr std::size_t MaxQuoteLevels = 32;
+
+// One price a market maker quotes, a 0 qty quotes nothing
+struct QuoteLevel
+{
+	TPrice	px;
+	TQty	qty;
+};
+
+struct QuoteStatus
+{
+	TOrdId			ordId;		// order quoting the level, 0 if none
+	OrdRejReason	reason;
+	bool			isKept;		// the order was already quoting the level and kept its priority
+};
+
+// Outcome of a mass quote, the levels in the sequence sent
+struct MassQuoteAck
+{
+	TClientId		clientId;
+	OrdRejReason	reason;		// NONE unless the mass quote as a whole was rejected
+	std::uint32_t	bidCount;
+	std::uint32_t	askCount;
+	std::uint32_t	kept;
+	std::uint32_t	added;
+	std::uint32_t	cancelled;	// quotes withdrawn as not quoted any more
+	std::uint32_t	rejected;
+	QuoteStatus		bids[MaxQuoteLevels];
+	QuoteStatus		asks[MaxQuoteLevels];
+};
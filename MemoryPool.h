@@ -0,0 +1,327 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <string>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+// What blocks are used for, for the memory accounting
+enum class MemCategory : std::uint8_t {
+	ORDER,
+	EVENT,
+	HISTORY,	// orders' event lists and fill id lists
+	LEVEL,		// price levels, their queues and the stop queues
+	INDEX,		// order id tables
+	OTHER
+};
+
+static constexpr std::size_t MemCategoryCount = 6;
+
+static const std::string MemCategoryStr[] = {
+	"ORDER",
+	"EVENT",
+	"HISTORY",
+	"LEVEL",
+	"INDEX",
+	"OTHER"
+};
+
+inline const std::string& toString(MemCategory category)
+{
+	return MemCategoryStr[static_cast<std::size_t>(category)];
+}
+
+struct MemUsage
+{
+	std::uint64_t	bytes;		// as asked for, live
+	std::uint64_t	objects;	// allocations live
+};
+
+// Size class pools carved out of one large mapping, backed by 2M hugepages
+// when the system has them to spare. Blocks freed go back on their class's
+// free list for reuse and are never handed back to the system. Until
+// reserve() is called, and for blocks larger than the biggest class or once
+// the mapping is used up, requests go to operator new. Allocation is thread
+// safe, orders are allocated by the clients and freed by the engine, but
+// reserve() must run before other threads start allocating. Every block is
+// accounted to a MemCategory, pooled or not, whether reserve() was called
+// or not, in counters of the thread allocating or freeing it.
+class MemoryPool
+{
+public:
+	static constexpr std::size_t Granularity = 16;
+	static constexpr std::size_t MaxPooled = 4096;
+	static constexpr std::size_t ClassCount = MaxPooled / Granularity;
+	static constexpr std::size_t HugePageSize = std::size_t(2) << 20;
+
+	static MemoryPool& instance()
+	{
+		static MemoryPool pool;
+		return pool;
+	}
+
+	MemoryPool(const MemoryPool&) = delete;
+	MemoryPool& operator=(const MemoryPool&) = delete;
+
+	// Maps bytes, rounded up to whole hugepages, for the pools. Falls back to
+	// regular pages if hugepages cannot be had. Returns false if the pool was
+	// already reserved or nothing could be mapped.
+	bool reserve(std::size_t bytes, bool hugePages = true)
+	{
+		if (m_pBase || bytes == 0) return false;
+
+		std::size_t size((bytes + HugePageSize - 1) / HugePageSize * HugePageSize);
+		char* pBase(nullptr);
+
+#ifdef _WIN32
+		SIZE_T largePage(GetLargePageMinimum());
+
+		if (hugePages && largePage != 0) {
+			size = (size + largePage - 1) / largePage * largePage;
+			pBase = static_cast<char*>(VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE));
+			m_isHugePageBacked = pBase != nullptr;
+		}
+		if (!pBase) {
+			pBase = static_cast<char*>(VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE));
+		}
+#else
+#ifdef MAP_HUGETLB
+		if (hugePages) {
+			void* p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+			if (p != MAP_FAILED) {
+				pBase = static_cast<char*>(p);
+				m_isHugePageBacked = true;
+			}
+		}
+#endif
+		if (!pBase) {
+			void* p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+			if (p == MAP_FAILED) return false;
+			pBase = static_cast<char*>(p);
+#ifdef MADV_HUGEPAGE
+			// Transparent hugepages, where enabled, are the next best thing
+			if (hugePages) {
+				::madvise(p, size, MADV_HUGEPAGE);
+			}
+#endif
+		}
+#endif
+		if (!pBase) return false;
+
+		m_size = size;
+		m_top.store(0, std::memory_order_relaxed);
+		m_pBase = pBase;
+		return true;
+	}
+
+	inline bool isReserved() const { return m_pBase != nullptr; }
+	inline bool isHugePageBacked() const { return m_isHugePageBacked; }
+	inline std::size_t size() const { return m_size; }
+	// Bytes carved into blocks so far, free or not
+	inline std::size_t carved() const { return m_top.load(std::memory_order_relaxed); }
+
+	// Writes to every page so that first use does not fault
+	void prefault()
+	{
+		std::size_t step(m_isHugePageBacked ? HugePageSize : 4096);
+
+		for (std::size_t offset = 0; offset < m_size; offset += step) {
+			reinterpret_cast<volatile char*>(m_pBase)[offset] = 0;
+		}
+	}
+
+	// Pins the pool's pages in memory
+	bool lock()
+	{
+		if (!m_pBase) return false;
+
+#ifdef _WIN32
+		return VirtualLock(m_pBase, m_size) != 0;
+#else
+		return ::mlock(m_pBase, m_size) == 0;
+#endif
+	}
+
+	// Live bytes and allocations of the category, process wide. The threads'
+	// counters are read one after another, not as of one instant.
+	inline MemUsage usage(MemCategory category) const
+	{
+		std::size_t i(static_cast<std::size_t>(category));
+		MemUsage usage{ 0, 0 };
+
+		for (const Account* pAccount = m_pAccounts.load(std::memory_order_acquire); pAccount; pAccount = pAccount->pNext) {
+			usage.bytes += pAccount->bytes[i].load(std::memory_order_relaxed);
+			usage.objects += pAccount->objects[i].load(std::memory_order_relaxed);
+		}
+		return usage;
+	}
+
+	inline void* allocate(std::size_t size, MemCategory category = MemCategory::OTHER)
+	{
+		Account& refAccount(threadAccount());
+		std::size_t i(static_cast<std::size_t>(category));
+
+		add(refAccount.bytes[i], size);
+		add(refAccount.objects[i], 1);
+
+		std::size_t cls(size == 0 ? 0 : (size - 1) / Granularity);
+
+		if (!m_pBase || cls >= ClassCount) return ::operator new(size);
+
+		SpinLock lock(m_locks[cls]);
+		FreeBlock* pBlock(m_freeLists[cls]);
+
+		if (pBlock) {
+			m_freeLists[cls] = pBlock->pNext;
+			return pBlock;
+		}
+
+		std::size_t blockSize((cls + 1) * Granularity);
+		std::size_t top(m_top.load(std::memory_order_relaxed));
+
+		do {
+			if (m_size - top < blockSize) return ::operator new(size);
+		} while (!m_top.compare_exchange_weak(top, top + blockSize, std::memory_order_relaxed));
+
+		return m_pBase + top;
+	}
+
+	inline void deallocate(void* p, std::size_t size, MemCategory category = MemCategory::OTHER)
+	{
+		char* pChar(static_cast<char*>(p));
+
+		if (!p) return;
+
+		Account& refAccount(threadAccount());
+		std::size_t i(static_cast<std::size_t>(category));
+
+		// Blocks freed by another thread than the one that allocated them
+		// wrap its counters below 0, the sum over the threads is still right
+		add(refAccount.bytes[i], 0 - static_cast<std::uint64_t>(size));
+		add(refAccount.objects[i], 0 - static_cast<std::uint64_t>(1));
+		if (pChar < m_pBase || pChar >= m_pBase + m_size) {
+			::operator delete(p);
+			return;
+		}
+
+		std::size_t cls(size == 0 ? 0 : (size - 1) / Granularity);
+		SpinLock lock(m_locks[cls]);
+		FreeBlock* pBlock(static_cast<FreeBlock*>(p));
+
+		pBlock->pNext = m_freeLists[cls];
+		m_freeLists[cls] = pBlock;
+	}
+
+protected:
+	struct FreeBlock
+	{
+		FreeBlock*	pNext;
+	};
+
+	// Counters of one thread, written by it alone so no update needs a
+	// locked instruction. Kept once the thread ends, blocks it counted may
+	// still be freed by others. Padded so that threads' counters do not
+	// share a cache line.
+	struct Account
+	{
+		char						padBefore[64];
+		std::atomic<std::uint64_t>	bytes[MemCategoryCount];
+		std::atomic<std::uint64_t>	objects[MemCategoryCount];
+		Account*					pNext;
+		char						padAfter[64];
+	};
+
+	inline static void add(std::atomic<std::uint64_t>& refCounter, std::uint64_t n)
+	{
+		refCounter.store(refCounter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+	}
+
+	inline Account& threadAccount()
+	{
+		static thread_local Account* t_pAccount(nullptr);
+
+		if (!t_pAccount) {
+			t_pAccount = addAccount();
+		}
+		return *t_pAccount;
+	}
+
+	Account* addAccount()
+	{
+		Account* pAccount(new Account);
+
+		for (std::size_t i = 0; i < MemCategoryCount; ++i) {
+			pAccount->bytes[i].store(0, std::memory_order_relaxed);
+			pAccount->objects[i].store(0, std::memory_order_relaxed);
+		}
+		pAccount->pNext = m_pAccounts.load(std::memory_order_relaxed);
+		while (!m_pAccounts.compare_exchange_weak(pAccount->pNext, pAccount, std::memory_order_release, std::memory_order_relaxed)) {}
+		return pAccount;
+	}
+
+	class SpinLock
+	{
+	public:
+		SpinLock(std::atomic_flag& refFlag) : m_refFlag(refFlag)
+		{
+			while (m_refFlag.test_and_set(std::memory_order_acquire)) {}
+		}
+		~SpinLock() { m_refFlag.clear(std::memory_order_release); }
+
+	protected:
+		std::atomic_flag&	m_refFlag;
+	};
+
+	MemoryPool() : m_pBase(nullptr), m_size(0), m_top(0), m_isHugePageBacked(false), m_freeLists(), m_pAccounts(nullptr)
+	{
+		for (std::atomic_flag& refLock : m_locks) {
+			refLock.clear();
+		}
+	}
+
+	char*						m_pBase;
+	std::size_t					m_size;
+	std::atomic<std::size_t>	m_top;
+	bool						m_isHugePageBacked;
+	FreeBlock*					m_freeLists[ClassCount];
+	std::atomic_flag			m_locks[ClassCount];
+	std::atomic<Account*>		m_pAccounts;	// one per thread that used the pool, newest first
+};
+
+// Standard allocator drawing from the MemoryPool, for the book's containers
+template <typename T, MemCategory Category = MemCategory::OTHER>
+struct PoolAllocator
+{
+	using value_type = T;
+
+	// Spelt out, allocator_traits cannot rebind past the category
+	template <typename U>
+	struct rebind
+	{
+		using other = PoolAllocator<U, Category>;
+	};
+
+	PoolAllocator() {}
+	template <typename U>
+	PoolAllocator(const PoolAllocator<U, Category>&) {}
+
+	inline T* allocate(std::size_t n) { return static_cast<T*>(MemoryPool::instance().allocate(n * sizeof(T), Category)); }
+	inline void deallocate(T* p, std::size_t n) { MemoryPool::instance().deallocate(p, n * sizeof(T), Category); }
+
+	template <typename U>
+	inline bool operator==(const PoolAllocator<U, Category>&) const { return true; }
+	template <typename U>
+	inline bool operator!=(const PoolAllocator<U, Category>&) const { return false; }
+};
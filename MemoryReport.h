@@ -0,0 +1,82 @@
+#pragma once
+
+#include "Defn.h"
+#include "MemoryPool.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <ostream>
+#include <vector>
+
+// Memory held on behalf of one client: its orders, never freed, their
+// event histories and the pages of its order id table. The bytes are
+// estimates, events are sized at the process wide average and counted
+// under EVENT with their history nodes.
+struct ClientMemory
+{
+	TClientId		clientId;
+	std::uint64_t	orders;
+	std::uint64_t	events;
+	std::uint64_t	indexPages;
+	std::uint64_t	bytes;
+	std::uint64_t	categoryBytes[MemCategoryCount];	// ORDER, EVENT and INDEX
+};
+
+// Memory held by one book, all of it LEVEL: its price levels with their
+// queues and the parked stops. The orders themselves are the clients'.
+struct BookMemory
+{
+	std::uint64_t	restingOrders;	// in the levels plus the parked stops
+	std::uint64_t	levels;			// limit levels, both sides
+	std::uint64_t	levelSlots;		// queue entries held, removed ones included until compacted
+	std::uint64_t	stops;
+	std::uint64_t	bytes;
+};
+
+// Footprint of an engine at ts. The categories are the MemoryPool's live
+// counts, process wide, the book and clients are this engine's own.
+struct MemoryReport
+{
+	TTimestamp		ts;
+	MemUsage		categories[MemCategoryCount];
+	std::size_t		poolSize;		// 0 unless the pool is reserved
+	std::size_t		poolCarved;
+	BookMemory		book;
+	std::vector<ClientMemory>	clients;	// registered ones, by session
+
+	MemoryReport() : ts(0), categories(), poolSize(0), poolCarved(0), book() {}
+
+	inline std::uint64_t totalBytes() const
+	{
+		std::uint64_t bytes(0);
+
+		for (const MemUsage& refUsage : categories) {
+			bytes += refUsage.bytes;
+		}
+		return bytes;
+	}
+
+	void dump(std::ostream& os) const
+	{
+		os << "MEMORY ts " << ts << ", total " << totalBytes() << " B";
+		if (poolSize != 0) {
+			os << ", pool " << poolCarved << " / " << poolSize << " B carved";
+		}
+		os << std::endl;
+		for (std::size_t i = 0; i < MemCategoryCount; ++i) {
+			os << "  " << toString(static_cast<MemCategory>(i)) << ": " << categories[i].bytes << " B, "
+				<< categories[i].objects << " objects" << std::endl;
+		}
+		os << "  BOOK " << toString(MemCategory::LEVEL) << ": " << book.bytes << " B, " << book.restingOrders << " resting, " << book.levels << " levels, "
+			<< book.levelSlots << " slots, " << book.stops << " stops" << std::endl;
+		for (const ClientMemory& refClient : clients) {
+			os << "  CLIENT " << refClient.clientId << ": " << refClient.bytes << " B,";
+			for (MemCategory category : { MemCategory::ORDER, MemCategory::EVENT, MemCategory::INDEX }) {
+				os << " " << toString(category) << " " << refClient.categoryBytes[static_cast<std::size_t>(category)] << " B,";
+			}
+			os << " " << refClient.orders << " orders, " << refClient.events << " events, " << refClient.indexPages << " pages"
+				<< std::endl;
+		}
+	}
+};
@@ -1,76 +1,188 @@
 #pragma once
 
+#include "Auction.h"
+#include "BookChecksum.h"
 #include "Defn.h"
+#include "MemoryPool.h"
 #include "OrdEvent.h"
 #include "Order.h"
 
 #include <list>
 #include <functional>
+#include <iterator>
 #include <map>
 #include <string>
+#include <vector>
 #include <cassert>
 #include <iostream>
 
+// Orders queued at one price. The fields matching reads for each maker are
+// kept in a contiguous FIFO of entries, the Order itself is only touched to
+// record fills. Removed entries are tombstoned and compacted away lazily.
 class PriceLevel
 {
 public:
-	using OrdList = std::list<Order*>;
+	struct Entry
+	{
+		Order*		pOrder;		// nullptr once removed
+		TOrdId		ordId;
+		TSessionId	sessionId;
+		TQty		qty;		// shown, the order's whole outstanding qty unless an iceberg
+	};
+
+	using EntryList = std::vector< Entry, PoolAllocator<Entry, MemCategory::LEVEL> >;
+
+	static constexpr std::size_t CompactMin = 32;
 
-	PriceLevel(const TPrice& px) : m_px(px) {}
+	PriceLevel(const TPrice& px) : m_px(px), m_head(0), m_count(0), m_vol(0), m_volHidden(0) {}
 
-	inline void insertOrder(Order* pOrd) {
+	// Queues the qty the order shows, all it has outstanding unless it is an iceberg
+	inline void insertOrder(Order* pOrd) { insertOrder(pOrd, pOrd->qtyToShow()); }
+
+	inline void insertOrder(Order* pOrd, const TQty& qtyShown) {
 		assert(m_px == pOrd->px());
+		assert(qtyShown <= pOrd->qtyOutstanding());
 
-		m_orders.emplace_back(pOrd);
+		pOrd->setLevelPos(static_cast<std::uint32_t>(m_entries.size()));
+		m_entries.emplace_back(Entry{ pOrd, pOrd->ordId(), pOrd->sessionId(), qtyShown });
+		m_vol += qtyShown;
+		m_volHidden += pOrd->qtyOutstanding() - qtyShown;
+		++m_count;
 	}
 
-	inline void removeOrder(OrdList::iterator itOrd) {
-		m_orders.erase(itOrd);
+	// Returns false if pOrd is not queued here
+	inline bool removeOrder(const Order* pOrd) {
+		std::size_t pos(pOrd->levelPos());
+
+		if (pos >= m_entries.size() || m_entries[pos].pOrder != pOrd) return false;
+
+		erase(m_entries[pos]);
+		return true;
 	}
 
-	inline bool isEmpty() const { return m_orders.empty(); }
+	// Qty pOrd shows here, 0 if it is not queued here
+	inline TQty queuedQty(const Order* pOrd) const {
+		std::size_t pos(pOrd->levelPos());
 
-	inline OrdList::const_iterator beginOrders() const { return m_orders.begin(); }
-	inline OrdList::iterator beginOrders() { return m_orders.begin(); }
-	inline OrdList::const_iterator endOrders() const { return m_orders.end(); }
-	inline const OrdList& orders() const { return m_orders; }
-	inline OrdList::iterator findOrder(const TOrdId& ordId)
-	{
-		OrdList::iterator it(m_orders.begin());
-		OrdList::const_iterator	itE(m_orders.end());
+		return pos < m_entries.size() && m_entries[pos].pOrder == pOrd ? m_entries[pos].qty : TQty(0);
+	}
+
+	inline bool isEmpty() const { return m_count == 0; }
+	inline std::size_t count() const { return m_count; }
+	// Queue entries held, removed ones included until compacted
+	inline std::size_t slots() const { return m_entries.capacity(); }
 
-		for (; it != itE; ++it) {
-			if ((*it)->ordId() == ordId) {
-				return it;
+	template <typename Fn>
+	inline void forEachOrder(Fn&& fn) const
+	{
+		for (std::size_t i = m_head; i < m_entries.size(); ++i) {
+			if (m_entries[i].pOrder) {
+				fn(m_entries[i].pOrder);
 			}
 		}
-		return it;
 	}
 
-	inline Order* frontOrder() { return m_orders.front(); }
-	inline void popFrontOrder() { m_orders.pop_front(); }
+	// Raw view of the queue from the first live entry, removed entries
+	// included with a nullptr order and 0 qty
+	inline Entry* entriesBegin() { return m_entries.data() + m_head; }
+	inline Entry* entriesEnd() { return m_entries.data() + m_entries.size(); }
+
+	inline Entry& frontEntry() { return m_entries[m_head]; }
+	inline Order* frontOrder() { return frontEntry().pOrder; }
+	inline void popFrontOrder() { erase(frontEntry()); }
+
+	inline void fill(Entry& refEntry, const TQty& qty)
+	{
+		assert(qty <= refEntry.qty);
+
+		refEntry.qty -= qty;
+		m_vol -= qty;
+	}
 
 	inline const TPrice& px() const { return m_px; }
-	inline const TQty vol() const
+	// Shown qty, what depth and continuous matching see
+	inline const TQty& vol() const { return m_vol; }
+	// Shown and hidden qty, what an uncross can trade
+	inline TQty totalVol() const { return m_vol + m_volHidden; }
+
+	// Removes every live entry filled down to 0 qty, wherever it is queued
+	inline void eraseFilled()
 	{
-		TQty	vol(0);
+		for (std::size_t i = m_head; i < m_entries.size(); ++i) {
+			Entry& refEntry(m_entries[i]);
 
-		for (auto p : m_orders) {
-			vol += p->qtyOutstanding();
+			if (refEntry.pOrder && refEntry.qty == 0) {
+				m_volHidden -= refEntry.pOrder->qtyOutstanding();
+				refEntry.pOrder = nullptr;
+				--m_count;
+			}
 		}
-		return vol;
+		trim();
 	}
 
 protected:
+	// The entry must still agree with its order on the qty filled
+	inline void erase(Entry& refEntry)
+	{
+		m_vol -= refEntry.qty;
+		m_volHidden -= refEntry.pOrder->qtyOutstanding() - refEntry.qty;
+		refEntry.pOrder = nullptr;
+		refEntry.qty = 0;
+		--m_count;
+		trim();
+	}
+
+	// Moves the head past removed entries and compacts once they dominate
+	inline void trim()
+	{
+		if (m_count == 0) {
+			m_entries.clear();
+			m_head = 0;
+			return;
+		}
+		while (!m_entries[m_head].pOrder) {
+			++m_head;
+		}
+
+		std::size_t dead(m_entries.size() - m_count);
+
+		if (dead >= CompactMin && dead * 2 >= m_entries.size()) {
+			compact();
+		}
+	}
+
+	inline void compact()
+	{
+		std::size_t out(0);
+
+		for (std::size_t i = m_head; i < m_entries.size(); ++i) {
+			if (m_entries[i].pOrder) {
+				m_entries[out] = m_entries[i];
+				m_entries[out].pOrder->setLevelPos(static_cast<std::uint32_t>(out));
+				++out;
+			}
+		}
+		m_entries.resize(out);
+		m_head = 0;
+	}
+
 	TPrice		m_px;
-	OrdList		m_orders;
+	std::size_t	m_head;		// first live entry
+	std::size_t	m_count;	// live entries
+	TQty		m_vol;
+	TQty		m_volHidden;	// icebergs' outstanding qty beyond their slice
+	EntryList	m_entries;
 };
 
 class OrdBook
 {
 public:
-	using TBids = std::map< TPrice, PriceLevel, std::greater<TPrice> >;
-	using TAsks = std::map<TPrice, PriceLevel>;
+	using TBids = std::map< TPrice, PriceLevel, std::greater<TPrice>, PoolAllocator< std::pair<const TPrice, PriceLevel>, MemCategory::LEVEL > >;
+	using TAsks = std::map< TPrice, PriceLevel, std::less<TPrice>, PoolAllocator< std::pair<const TPrice, PriceLevel>, MemCategory::LEVEL > >;
+	// Parked stops keyed by trigger price, the next to trigger first and
+	// arrival order kept among equal triggers
+	using TBuyStops = std::multimap< TPrice, Order*, std::less<TPrice>, PoolAllocator< std::pair<const TPrice, Order*>, MemCategory::LEVEL > >;
+	using TSellStops = std::multimap< TPrice, Order*, std::greater<TPrice>, PoolAllocator< std::pair<const TPrice, Order*>, MemCategory::LEVEL > >;
 
 	struct OrdEventsResponse
 	{
@@ -81,9 +193,191 @@ public:
 public:
 	OrdBook() : 
 		m_mktAsk(TPrice(0)),
-		m_mktBid(TPrice(0))
+		m_mktBid(TPrice(0)),
+		m_pxLastTrade(TPrice(0)),
+		m_pxHigh(TPrice(0)),
+		m_pxLow(TPrice(0)),
+		m_version(0)
 	{}
 
+	inline const TPrice& lastTradePx() const { return m_pxLastTrade; }
+	inline bool hasLastTrade() const { return m_pxLastTrade > TPrice(0); }
+	inline void setLastTradePx(const TPrice& px) { m_pxLastTrade = m_pxHigh = m_pxLow = px; }
+
+	// Highest and lowest trade price since beginTradeRange(), the last trade
+	// price before it included so that a stop left crossed still fires
+	inline const TPrice& highTradePx() const { return m_pxHigh; }
+	inline const TPrice& lowTradePx() const { return m_pxLow; }
+	inline void beginTradeRange() { m_pxHigh = m_pxLow = m_pxLastTrade; }
+
+	inline void onTrade(const TPrice& px)
+	{
+		if (!hasLastTrade()) {
+			m_pxHigh = m_pxLow = px;
+		}
+		else if (px > m_pxHigh) {
+			m_pxHigh = px;
+		}
+		else if (px < m_pxLow) {
+			m_pxLow = px;
+		}
+		m_pxLastTrade = px;
+	}
+
+	// Kept by the engine as orders open and are released
+	inline const BookChecksum& checksum() const { return m_checksum; }
+	inline BookChecksum& checksum() { return m_checksum; }
+
+	// Bumped by the engine after every command that may have changed the
+	// book, market data compares it to the version it last sent
+	inline std::uint64_t version() const { return m_version; }
+	inline void touch() { ++m_version; }
+
+	// Last trade, else BBO mid, else the one side quoted, else 0
+	inline TPrice referencePx() const
+	{
+		if (hasLastTrade()) return m_pxLastTrade;
+		if (hasLimitBid() && hasLimitAsk()) {
+			return TPrice(TPrice::RawValue{ (bestLimitBid().px().rawValue() + bestLimitAsk().px().rawValue()) / 2 });
+		}
+		if (hasLimitBid()) return bestLimitBid().px();
+		if (hasLimitAsk()) return bestLimitAsk().px();
+		return TPrice(0);
+	}
+
+	inline void insertStop(Order* pOrd)
+	{
+		if (pOrd->side() == OrdSide::BUY) {
+			m_buyStops.emplace(pOrd->pxStop(), pOrd);
+		}
+		else {
+			m_sellStops.emplace(pOrd->pxStop(), pOrd);
+		}
+	}
+
+	inline bool removeStop(Order* pOrd)
+	{
+		return pOrd->side() == OrdSide::BUY ? eraseStop(m_buyStops, pOrd) : eraseStop(m_sellStops, pOrd);
+	}
+
+	// Next parked stop crossed by a trade price of the range, buys against
+	// its high and sells against its low, buys before sells, nullptr once
+	// none is crossed. A sweep through several levels crosses the stops of
+	// every price it traded at, not only of the last.
+	inline Order* popTriggeredStop()
+	{
+		if (!hasLastTrade()) return nullptr;
+
+		if (!m_buyStops.empty() && m_buyStops.begin()->first <= m_pxHigh) {
+			Order* pOrd = m_buyStops.begin()->second;
+
+			m_buyStops.erase(m_buyStops.begin());
+			return pOrd;
+		}
+		if (!m_sellStops.empty() && m_sellStops.begin()->first >= m_pxLow) {
+			Order* pOrd = m_sellStops.begin()->second;
+
+			m_sellStops.erase(m_sellStops.begin());
+			return pOrd;
+		}
+		return nullptr;
+	}
+
+	// Parked stops, buys then sells, each in trigger order
+	template <typename Fn>
+	inline void forEachStop(Fn&& fn) const
+	{
+		for (auto& pr : m_buyStops) {
+			fn(pr.second);
+		}
+		for (auto& pr : m_sellStops) {
+			fn(pr.second);
+		}
+	}
+
+	// Orders resting in the levels plus the parked stops
+	inline std::size_t orderCount() const
+	{
+		std::size_t count(m_mktBid.count() + m_mktAsk.count() + m_buyStops.size() + m_sellStops.size());
+
+		for (auto& pr : m_bids) {
+			count += pr.second.count();
+		}
+		for (auto& pr : m_asks) {
+			count += pr.second.count();
+		}
+		return count;
+	}
+
+	inline std::size_t levelCount() const { return m_bids.size() + m_asks.size(); }
+	inline std::size_t stopCount() const { return m_buyStops.size() + m_sellStops.size(); }
+
+	// Queue entries held by all levels, the market levels included
+	inline std::size_t levelSlots() const
+	{
+		std::size_t slots(m_mktBid.slots() + m_mktAsk.slots());
+
+		for (auto& pr : m_bids) {
+			slots += pr.second.slots();
+		}
+		for (auto& pr : m_asks) {
+			slots += pr.second.slots();
+		}
+		return slots;
+	}
+
+	// Equilibrium of the resting orders were the book uncrossed now,
+	// refDepth is scratch space kept by the caller between auctions
+	inline AuctionResult auctionEquilibrium(AuctionDepth& refDepth) const
+	{
+		refDepth.clear();
+
+		// Only prices some ask and some bid can both trade at are candidates
+		bool hasAskFloor(m_mktAsk.isEmpty());
+		bool hasBidCap(m_mktBid.isEmpty());
+
+		if ((hasAskFloor && !hasLimitAsk()) || (hasBidCap && !hasLimitBid())) {
+			return AuctionResult();
+		}
+
+		auto itAsk(m_asks.begin());
+		auto itAskE(hasBidCap ? m_asks.upper_bound(bestLimitBid().px()) : m_asks.end());
+		// Bids walked from the lowest up, stopping below the lowest ask
+		auto itBid(std::make_reverse_iterator(hasAskFloor ? m_bids.upper_bound(bestLimitAsk().px()) : m_bids.end()));
+		auto itBidE(m_bids.rend());
+
+		while (itAsk != itAskE || itBid != itBidE) {
+			if (itBid == itBidE || (itAsk != itAskE && itAsk->first < itBid->first)) {
+				refDepth.add(itAsk->first, 0, itAsk->second.totalVol());
+				++itAsk;
+			}
+			else if (itAsk == itAskE || itBid->first < itAsk->first) {
+				refDepth.add(itBid->first, itBid->second.totalVol(), 0);
+				++itBid;
+			}
+			else {
+				refDepth.add(itAsk->first, itBid->second.totalVol(), itAsk->second.totalVol());
+				++itAsk;
+				++itBid;
+			}
+		}
+
+		return refDepth.equilibrium(m_mktBid.vol(), m_mktAsk.vol(), referencePx());
+	}
+
+	// Next level to allocate from when uncrossing at px, market orders
+	// first, nullptr once the side has nothing left that trades at px
+	inline PriceLevel* auctionBid(const TPrice& px)
+	{
+		if (!m_mktBid.isEmpty()) return &m_mktBid;
+		return hasLimitBid() && bestLimitBid().px() >= px ? &bestLimitBid() : nullptr;
+	}
+	inline PriceLevel* auctionAsk(const TPrice& px)
+	{
+		if (!m_mktAsk.isEmpty()) return &m_mktAsk;
+		return hasLimitAsk() && bestLimitAsk().px() <= px ? &bestLimitAsk() : nullptr;
+	}
+
 	inline PriceLevel& mktAsk() { return m_mktAsk; }
 	inline PriceLevel& mktBid() { return m_mktBid; }
 	inline const PriceLevel& mktAsk() const { return m_mktAsk; }
@@ -97,6 +391,13 @@ public:
 		auto pr = m_bids.emplace(std::make_pair(px, PriceLevel(px)));
 		return pr.first->second;
 	}
+	// Market level for px 0, limit level created on demand otherwise
+	inline PriceLevel& findOrCreateLevel(OrdSide side, const TPrice& px) {
+		if (px == TPrice(0)) {
+			return side == OrdSide::BUY ? m_mktBid : m_mktAsk;
+		}
+		return side == OrdSide::BUY ? findOrCreateLimitBid(px) : findOrCreateLimitAsk(px);
+	}
 	inline TAsks::iterator findLimitAsk(const TPrice& px) {
 		return m_asks.find(px);
 	}
@@ -126,11 +427,10 @@ public:
 
 	inline void dump()
 	{
-		std::cout << "ASK(0) | " << m_mktAsk.vol() << " | ";
+		auto dumpOrd = [](const Order* pOrd) { pOrd->dumpOrder(); };
 
-		for (auto* p : m_mktAsk.orders()) {
-			p->dumpOrder();
-		}
+		std::cout << "ASK(0) | " << m_mktAsk.vol() << " | ";
+		m_mktAsk.forEachOrder(dumpOrd);
 		std::cout << std::endl;
 
 		if (hasLimitAsk()) {
@@ -140,34 +440,59 @@ public:
 			do {
 				--itAsk;
 				std::cout << "ASK(" << itAsk->first << ") | ";
-
-				for (auto* pOrd : itAsk->second.orders()) {
-					pOrd->dumpOrder();
-				}
+				itAsk->second.forEachOrder(dumpOrd);
 				std::cout << std::endl;
 			} while (itAsk != itAskB);
 		}
 
 		std::cout << "BID(0) | " << m_mktBid.vol() << " | ";
-
-		for (auto* p : m_mktBid.orders()) {
-			p->dumpOrder();
-		}
+		m_mktBid.forEachOrder(dumpOrd);
 		std::cout << std::endl;
 
-		for (auto pr : m_bids) {
+		for (auto& pr : m_bids) {
 			std::cout << "BID(" << pr.first << ") | ";
+			pr.second.forEachOrder(dumpOrd);
+			std::cout << std::endl;
+		}
 
-			for (auto* pOrd : pr.second.orders()) {
-				pOrd->dumpOrder();
-			}
+		std::cout << "LAST | " << m_pxLastTrade << std::endl;
+
+		for (auto& pr : m_buyStops) {
+			std::cout << "BUY STOP(" << pr.first << ") | ";
+			pr.second->dumpOrder();
+			std::cout << std::endl;
+		}
+		for (auto& pr : m_sellStops) {
+			std::cout << "SELL STOP(" << pr.first << ") | ";
+			pr.second->dumpOrder();
 			std::cout << std::endl;
 		}
 	}
 
 protected:
+	template <typename TStops>
+	inline static bool eraseStop(TStops& stops, Order* pOrd)
+	{
+		auto pr = stops.equal_range(pOrd->pxStop());
+
+		for (auto it = pr.first; it != pr.second; ++it) {
+			if (it->second == pOrd) {
+				stops.erase(it);
+				return true;
+			}
+		}
+		return false;
+	}
+
 	PriceLevel		m_mktAsk;
 	PriceLevel		m_mktBid;
 	TAsks			m_asks;
 	TBids			m_bids;
+	TPrice			m_pxLastTrade;
+	TPrice			m_pxHigh;		// trade range of the command being run
+	TPrice			m_pxLow;
+	BookChecksum	m_checksum;
+	std::uint64_t	m_version;
+	TBuyStops		m_buyStops;
+	TSellStops		m_sellStops;
 };
\ No newline at end of file
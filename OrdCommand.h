@@ -0,0 +1,90 @@
+#pragma once
+
+#include "Defn.h"
+
+#include <iostream>
+
+class Order;
+
+enum class OrdCommandType {
+	NONE,
+	NEW,
+	CANCEL,
+	TIMER,
+	UNCROSS,
+	CALL_AUCTION,
+	BATCH_AUCTION,	// expireTime holds the interval
+	BULK_ORDER,		// one order of the BULK_LOAD that follows
+	BULK_LOAD,		// qty holds the order count
+	QUOTE_LEVEL,	// one side, px and qty of the MASS_QUOTE that follows
+	MASS_QUOTE		// clientId's quotes, replaced by the QUOTE_LEVELs before it
+};
+
+static const std::string OrdCommandTypeStr[] = {
+	"NONE",
+	"NEW",
+	"CANCEL",
+	"TIMER",
+	"UNCROSS",
+	"CALL_AUCTION",
+	"BATCH_AUCTION",
+	"BULK_ORDER",
+	"BULK_LOAD",
+	"QUOTE_LEVEL",
+	"MASS_QUOTE"
+};
+
+static const std::string& toString(OrdCommandType type)
+{
+	return OrdCommandTypeStr[static_cast<std::underlying_type<OrdCommandType>::type>(type)];
+}
+
+// Inbound request in decoded form, as carried between engine stages
+struct OrdCommand
+{
+	OrdCommandType	type;
+	TClientId		clientId;
+	TOrdId			ordId;			// CANCEL
+	OrdSide			side;			// NEW
+	TPrice			px;
+	TPrice			pxStop;
+	TQty			qty;
+	OrdTif			tif;
+	TTimestamp		expireTime;
+	bool			conflateExecs;
+	TQty			qtyDisplay;		// NEW, BULK_ORDER, 0 but for icebergs
+	Order*			pOrder;			// NEW, built from the fields above by the decode stage
+
+	OrdCommand() :
+		type(OrdCommandType::NONE), clientId(0), ordId(0), side(OrdSide::NONE), px(0), pxStop(0), qty(0),
+		tif(OrdTif::GTC), expireTime(0), conflateExecs(false), qtyDisplay(0), pOrder(nullptr)
+	{}
+
+	inline void dump(std::ostream& os) const
+	{
+		os << toString(type) << ", " << clientId;
+		switch (type) {
+		case OrdCommandType::NEW:
+		case OrdCommandType::BULK_ORDER:
+			os << ", " << toString(side) << ", " << px << ", " << qty << ", " << toString(tif) << ", " << expireTime << ", " << pxStop;
+			if (qtyDisplay != 0) {
+				os << ", " << qtyDisplay;
+			}
+			break;
+		case OrdCommandType::CANCEL:
+			os << ", " << ordId;
+			break;
+		case OrdCommandType::BATCH_AUCTION:
+			os << ", " << expireTime;
+			break;
+		case OrdCommandType::BULK_LOAD:
+			os << ", " << qty;
+			break;
+		case OrdCommandType::QUOTE_LEVEL:
+			os << ", " << toString(side) << ", " << px << ", " << qty;
+			break;
+		default:
+			break;
+		}
+	}
+};
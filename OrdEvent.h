@@ -1,9 +1,11 @@
 #pragma once
 
 #include "Defn.h"
+#include "MemoryPool.h"
 
 #include <numeric>
 #include <iostream>
+#include <vector>
 
 class OrdEvent
 {
@@ -11,6 +13,10 @@ public:
 	OrdEvent(OrdEventType evtType) : m_evtType(evtType) {}
 	virtual ~OrdEvent() {}
 
+	// Sized delete gets the size of the most derived event through the virtual destructor
+	static void* operator new(std::size_t size) { return MemoryPool::instance().allocate(size, MemCategory::EVENT); }
+	static void operator delete(void* p, std::size_t size) { MemoryPool::instance().deallocate(p, size, MemCategory::EVENT); }
+
 	inline OrdEventType eventType() const { return m_evtType; }
 
 	virtual void dump()
@@ -50,18 +56,22 @@ protected:
 class NewRejOrdEvent : public OrdEvent
 {
 public:
-	NewRejOrdEvent(const TOrdId& newOrdId) : OrdEvent(OrdEventType::NEW_REJECT), m_newOrdId(newOrdId) {}
+	NewRejOrdEvent(const TOrdId& newOrdId, OrdRejReason reason = OrdRejReason::NONE) :
+		OrdEvent(OrdEventType::NEW_REJECT), m_newOrdId(newOrdId), m_reason(reason)
+	{}
 
 	inline const TOrdId& newOrdId() const { return m_newOrdId; }
+	inline OrdRejReason reason() const { return m_reason; }
 
 	virtual void dump()
 	{
 		OrdEvent::dump();
-		std::cout << ", " << m_newOrdId;
+		std::cout << ", " << m_newOrdId << ", " << toString(m_reason);
 	}
 	
 protected:
-	TOrdId	m_newOrdId;
+	TOrdId			m_newOrdId;
+	OrdRejReason	m_reason;
 };
 
 class NewAckOrdEvent : public OrdEvent
@@ -94,7 +104,7 @@ class CanOrdEvent : public OrdEvent
 {
 public:
 	CanOrdEvent(const TQty& qtyCancel) : 
-		OrdEvent(OrdEventType::CANCEL) 
+		OrdEvent(OrdEventType::CANCEL), m_qtyCancel(qtyCancel)
 	{}
 
 	inline const TQty& qtyCancel() const { return m_qtyCancel; }
@@ -112,9 +122,22 @@ protected:
 class CanRejOrdEvent : public OrdEvent
 {
 public:
-	CanRejOrdEvent() : OrdEvent(OrdEventType::CANCEL_REJECT) {}
+	CanRejOrdEvent(const TOrdId& canOrdId, OrdRejReason reason) :
+		OrdEvent(OrdEventType::CANCEL_REJECT), m_canOrdId(canOrdId), m_reason(reason)
+	{}
+
+	inline const TOrdId& canOrdId() const { return m_canOrdId; }
+	inline OrdRejReason reason() const { return m_reason; }
+
+	virtual void dump()
+	{
+		OrdEvent::dump();
+		std::cout << ", " << m_canOrdId << ", " << toString(m_reason);
+	}
 
 protected:
+	TOrdId			m_canOrdId;
+	OrdRejReason	m_reason;
 };
 
 class CanAckOrdEvent : public OrdEvent
@@ -159,6 +182,35 @@ protected:
 	TQty		m_qtyExec;
 };
 
+// Taker fills against several makers at one price reported as one event:
+// execId() is the first fill's, qtyExec() the total
+class ConflatedExecution : public Execution
+{
+public:
+	using ExecIdList = std::vector< TExecId, PoolAllocator<TExecId, MemCategory::HISTORY> >;
+
+	ConflatedExecution(const TExecId& execId, const TPrice& pxExec, const TQty& qtyExec) :
+		Execution(execId, pxExec, qtyExec), m_execIds(1, execId)
+	{}
+
+	inline const ExecIdList& execIds() const { return m_execIds; }
+
+	inline void addFill(const TExecId& execId, const TQty& qtyExec)
+	{
+		m_execIds.push_back(execId);
+		m_qtyExec += qtyExec;
+	}
+
+	virtual void dump()
+	{
+		Execution::dump();
+		std::cout << ", fills " << m_execIds.size();
+	}
+
+protected:
+	ExecIdList	m_execIds;
+};
+
 class Expired : public OrdEvent
 {
 public:
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "Defn.h"
+#include "MemoryPool.h"
+#include "Order.h"
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+// Owning order table direct-indexed by a client's sequential order ids.
+// Ids map to fixed-size pages that are never moved, so growing the table
+// allocates one page at a time instead of rehashing, and a lookup is a
+// page pointer load plus the slot itself.
+class OrdIdTable
+{
+public:
+	static constexpr unsigned PageBits = 12;
+	static constexpr std::size_t PageSize = std::size_t(1) << PageBits;
+	static constexpr std::size_t PageMask = PageSize - 1;
+	static constexpr std::size_t InitialPages = 64;
+
+	OrdIdTable() : m_count(0)
+	{
+		m_pages.reserve(InitialPages);
+	}
+
+	inline std::size_t size() const { return m_count; }
+	inline std::size_t pages() const { return m_pages.size(); }
+	static std::size_t pageBytes() { return sizeof(Page); }
+
+	inline Order* find(const TOrdId& ordId) const
+	{
+		std::size_t page(ordId >> PageBits);
+
+		if (page >= m_pages.size()) return nullptr;
+		return m_pages[page]->slots[ordId & PageMask].get();
+	}
+
+	// Leaves upOrd untouched and returns false if ordId is taken
+	inline bool insert(const TOrdId& ordId, std::unique_ptr<Order>& upOrd)
+	{
+		std::size_t page(ordId >> PageBits);
+
+		while (page >= m_pages.size()) {
+			m_pages.emplace_back(std::make_unique<Page>());
+		}
+
+		std::unique_ptr<Order>& slot(m_pages[page]->slots[ordId & PageMask]);
+
+		if (slot) return false;
+
+		slot = std::move(upOrd);
+		++m_count;
+		return true;
+	}
+
+protected:
+	struct Page
+	{
+		std::unique_ptr<Order>	slots[PageSize];
+
+		static void* operator new(std::size_t size) { return MemoryPool::instance().allocate(size, MemCategory::INDEX); }
+		static void operator delete(void* p, std::size_t size) { MemoryPool::instance().deallocate(p, size, MemCategory::INDEX); }
+	};
+
+	using PageList = std::vector< std::unique_ptr<Page>, PoolAllocator< std::unique_ptr<Page>, MemCategory::INDEX > >;
+
+	PageList		m_pages;
+	std::size_t		m_count;
+};
@@ -0,0 +1,254 @@
+﻿// OrdMEApp.cpp : Defines the entry point for the application.
+//
+
+#include "OrdMatchingEngine.h"
+
+#include <iostream>
+#include <vector>
+
+class Client : public OrdME::Callback
+{
+public:
+	Client(const TClientId& clientId) : m_clientId(clientId) {}
+
+	inline const TClientId& clientId() const { return m_clientId; }
+
+	void onNew(Order* order, NewOrdEvent* event) override
+	{
+		std::cout << "onNew clientId " << clientId() << " ordId " << order->ordId() << " " << toString(order->state()) << " " << toString(order->side());
+		std::cout << " px " << order->px() << " qty " << order->qty() << std::endl;
+	}
+
+	void onNewRej(Order* order, NewRejOrdEvent* event) override 
+	{
+		std::cout << "onNewRej clientId " << clientId() << " ordId " << order->ordId() << " px " << order->px() << " qty " << order->qty();
+		std::cout << " reason " << toString(event->reason()) << std::endl;
+	}
+
+	void onNewAck(Order* order, NewAckOrdEvent* event) override 
+	{
+		std::cout << "onNewAck clientId " << clientId() << " ordId " << order->ordId() << " " << toString(order->state()) << " " << toString(order->side());
+		std::cout << " px " << order->px() << " qty " << order->qty();
+		std::cout << " cumOut " << order->qtyOutstanding() << " cumExe " << order->qtyExec() << " cumCan " << order->qtyCancelled() << std::endl;
+	}
+
+	void onCan(Order* order, CanOrdEvent* event) override
+	{
+		std::cout << "onCan clientId " << clientId() << " ordId " << order->ordId() << " " << toString(order->state()) << " " << toString(order->side()) << std::endl;
+	}
+
+	void onCanRej(Order* order, CanRejOrdEvent* event) override
+	{
+		std::cout << "onCanRej clientId " << clientId() << " ordId " << event->canOrdId();
+		if (order) {
+			std::cout << " " << toString(order->state()) << " " << toString(order->side());
+		}
+		std::cout << " reason " << toString(event->reason()) << std::endl;
+	}
+
+	void onCanAck(Order* order, CanAckOrdEvent* event) override
+	{
+		std::cout << "onCanAck clientId " << clientId() << " ordId " << order->ordId() << " " << toString(order->state()) << " " << toString(order->side());
+		std::cout << " px " << order->px() << " qty " << order->qty() << " canQty " << event->qtyCancelled();
+		std::cout << " cumOut " << order->qtyOutstanding() << " cumExe " << order->qtyExec() << " cumCan " << order->qtyCancelled() << std::endl;
+	}
+
+	void onExec(Order* order, Execution* event) override 
+	{
+		std::cout << "onExec clientId " << clientId() << " ordId " << order->ordId() << " " << toString(order->state()) << " " << toString(order->side());
+		std::cout << " execId " << event->execId() << " exePx " << event->pxExec() << " exeQty " << event->qtyExec();
+		if (const ConflatedExecution* pConflated = dynamic_cast<const ConflatedExecution*>(event)) {
+			std::cout << " fills " << pConflated->execIds().size();
+		}
+		std::cout << " cumOut " << order->qtyOutstanding() << " cumExe " << order->qtyExec() << " cumCan " << order->qtyCancelled() << std::endl;
+	}
+
+	void onExpiry(Order* order, Expired* event) override
+	{
+		std::cout << "onExpiry clientId " << clientId() << " ordId " << order->ordId() << " " << toString(order->state()) << " " << toString(order->side());
+		std::cout << " cancelled " << event->qtyCancelled() << std::endl;
+		std::cout << " cumOut " << order->qtyOutstanding() << " cumExe " << order->qtyExec() << " cumCan " << order->qtyCancelled() << std::endl;
+	}
+
+protected:
+	TClientId	m_clientId;
+};
+
+int main()
+{
+	OrdME		me;
+	std::vector<Client>		clients({Client(0), Client(1), Client(2)});
+
+	for (Client& cl : clients) {
+		me.registerClient(cl.clientId(), &cl);
+	}
+	me.flightRecorder().setDumpPath("OrdMatchingEngine.flight");
+	me.flightRecorder().installCrashHandlers();
+
+	bool	isQuit(false);
+	int	currClientId(0);
+	int	command(0);
+
+	while (!isQuit) {
+		std::cout << "1. Select client (" << currClientId << ")" << std::endl;
+		std::cout << "2. Dump order book" << std::endl;
+		std::cout << "3. Create order" << std::endl;
+		std::cout << "4. Cancel order" << std::endl;
+		std::cout << "5. Quit" << std::endl;
+		std::cout << "6. Start call auction (" << toString(me.tradingPhase()) << ")" << std::endl;
+		std::cout << "7. Uncross call auction" << std::endl;
+		std::cout << "8. Trading statistics" << std::endl;
+		std::cout << "9. Dump flight recorder" << std::endl;
+		std::cout << "Select command: ";
+
+		std::cin >> command;
+
+		switch (command) {
+		case 1:
+		{
+			int newClientId(0);
+			std::cout << "Select client (0.." << clients.size()-1 << "): ";
+			std::cin >> newClientId;
+
+			if (newClientId < 0 || newClientId > clients.size()-1) {
+				std::cout << "Unknown clientId " << newClientId << std::endl;
+			}
+			else {
+				std::cout << "ClientId set to " << newClientId << std::endl;
+				currClientId = newClientId;
+			}
+			break;
+		}
+		case 2:
+			std::cout << "Dump order book" << std::endl;
+			me.dumpOrdBook();
+			std::cout << std::endl;
+			break;
+		case 3:
+		{
+			char	chSide(0);
+			float	price(0.0);
+			float	stopPrice(0.0);
+			TQty qty(0);
+			OrdSide	ordSide(OrdSide::NONE);
+
+			std::cout << "Create order" << std::endl;
+			std::cout << "Side(B/S): ";
+			std::cin >> chSide;
+			chSide = std::toupper(chSide);
+			switch(chSide) {
+			case 'B':
+				ordSide = OrdSide::BUY;
+				break;
+			case 'S':
+				ordSide = OrdSide::SELL;
+				break;
+			default:
+				std::cout << "Unknown side " << chSide << std::endl;
+				continue;
+			}
+
+			std::cout << "Price up to 2 decimal precision(0 for market order) : ";
+			std::cin >> price;
+
+			TPrice	px(price);
+
+			if (px < TPrice(0)) {
+				std::cout << "Price must not be negative" << std::endl;
+				continue;
+			}
+
+			std::cout << "Stop price up to 2 decimal precision(0 for none) : ";
+			std::cin >> stopPrice;
+
+			TPrice	pxStop(stopPrice);
+
+			if (pxStop < TPrice(0)) {
+				std::cout << "Stop price must not be negative" << std::endl;
+				continue;
+			}
+
+			std::cout << "Qty: ";
+			std::cin >> qty;
+
+			if (qty <= 0) {
+				std::cout << "Qty must be greater than 0" << std::endl;
+				continue;
+			}
+					
+			std::unique_ptr<Order> p(std::make_unique<Order>(currClientId, ordSide, px, qty, OrdTif::GTC, 0, pxStop));
+			OrdRejReason reason(me.submitNewOrder(std::move(p)));
+
+			if (reason == OrdRejReason::NONE) {
+				std::cout << "Submit new order" << std::endl;
+			}
+			else {
+				std::cerr << "Failed to submit new order " << toString(reason) << std::endl;
+			}
+			break;
+		}
+		case 4:
+		{
+			TOrdId	canOrdId;
+
+			std::cout << "Cancel order" << std::endl;
+			std::cout << "Enter orderId: ";
+			std::cin >> canOrdId;
+
+			OrdRejReason reason(me.submitCanOrder(currClientId, canOrdId));
+
+			if (reason == OrdRejReason::NONE) {
+				std::cout << "Submit can order " << canOrdId << std::endl;
+			}
+			else {
+				std::cerr << "Failed to submit can order " << toString(reason) << std::endl;
+			}
+			break;
+		}
+		case 5:
+			std::cout << "Quit..." << std::endl;			
+			isQuit = true;
+			break;
+		case 6:
+			std::cout << "Start call auction" << std::endl;
+			me.beginCallAuction();
+			break;
+		case 7:
+		{
+			std::cout << "Uncross call auction" << std::endl;
+
+			AuctionResult result(me.uncross());
+
+			std::cout << "Uncrossed px " << result.px << " qty " << result.qtyExec << " surplus " << result.surplus << std::endl;
+			break;
+		}
+		case 8:
+		{
+			const TradingStats& refStats(me.stats());
+
+			std::cout << "Trading statistics" << std::endl;
+			std::cout << "open " << refStats.open << " high " << refStats.high << " low " << refStats.low << " last " << refStats.last;
+			std::cout << " vwap " << refStats.vwap() << " volume " << refStats.volume << std::endl;
+			std::cout << "trades " << refStats.trades << " orders " << refStats.orders << " cancels " << refStats.cancels << std::endl;
+			break;
+		}
+		case 9:
+		{
+			std::string path(std::string(me.flightRecorder().dumpPath()) + ".last");
+
+			if (me.flightRecorder().dump(path)) {
+				std::cout << "Flight recorder dumped to " << path << ", read it with FlightDecode" << std::endl;
+			}
+			else {
+				std::cerr << "Failed to write " << path << std::endl;
+			}
+			break;
+		}
+		default:
+			std::cout << "Unknown command " << command << std::endl;
+			break;
+		}
+	}
+
+	return 0;
+}
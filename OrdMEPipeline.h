@@ -0,0 +1,384 @@
+#pragma once
+
+#include "OrdCommand.h"
+#include "OrdMatchingEngine.h"
+#include "Placement.h"
+#include "RingBuffer.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <thread>
+#include <vector>
+
+// Optional pipelined front end for an OrdME. Commands are written into a
+// pre-allocated ring and picked up by one thread per stage, each stage
+// publishing its progress as a Sequence the next one waits on:
+//   decode  - resolves the client and builds the Order, off the matcher core
+//   journal - writes every decoded command to a stream, alongside matching
+//   match   - runs the command on the engine, which only mutates the book
+//             and pushes the resulting events into a second ring
+//   publish - delivers those events to the client callbacks
+// Clients must be registered before start() and the engine must not be used
+// directly until stop(). Callbacks run on the publish thread while the
+// matcher carries on. The matcher copies each event and the order it is for
+// into the event ring, so callbacks are handed those copies, which show the
+// order as it was when the command that caused the event ended.
+class OrdMEPipeline : protected OrdME::EventPublisher
+{
+public:
+	static constexpr std::size_t DefaultCapacity = std::size_t(1) << 16;
+
+	OrdMEPipeline(OrdME& me, std::size_t capacity = DefaultCapacity, std::ostream* pJournal = nullptr) :
+		m_me(me),
+		m_pJournal(pJournal),
+		m_commands(capacity),
+		m_events(capacity),
+		m_started(false),
+		m_running(false),
+		m_decodeDone(false),
+		m_matchDone(false),
+		m_dropped(0)
+	{
+		std::vector<const Sequence*> gating({ &m_matchSeq });
+
+		if (m_pJournal) {
+			gating.push_back(&m_journalSeq);
+		}
+		m_commands.setGating(gating);
+		m_events.setGating({ &m_publishSeq });
+	}
+	OrdMEPipeline(const OrdMEPipeline&) = delete;
+	OrdMEPipeline& operator=(const OrdMEPipeline&) = delete;
+
+	~OrdMEPipeline() { stop(); }
+
+	// Pins the match stage and sets up memory as per config when started
+	inline void setPlacement(const PlacementConfig& config) { m_placement = config; }
+	// What start() managed to apply, read it after stop()
+	inline const PlacementResult& placement() const { return m_placementResult; }
+
+	// A pipeline runs once, start() after stop() does nothing
+	void start()
+	{
+		if (m_started) return;
+
+		// The pool is reserved before any stage can allocate from it, the
+		// match thread pins itself
+		PlacementConfig config(m_placement);
+
+		config.cpu = -1;
+		m_placementResult = applyPlacement(config);
+
+		m_started = true;
+		m_running.store(true, std::memory_order_release);
+		m_me.setEventPublisher(this);
+
+		m_threads.emplace_back([this]() { runDecode(); });
+		if (m_pJournal) {
+			m_threads.emplace_back([this]() { runJournal(); });
+		}
+		m_threads.emplace_back([this]() { runMatch(); });
+		m_threads.emplace_back([this]() { runPublish(); });
+	}
+
+	// Drains every command submitted so far, then joins the stages
+	void stop()
+	{
+		if (m_threads.empty()) return;
+
+		m_running.store(false, std::memory_order_release);
+		for (auto& th : m_threads) {
+			th.join();
+		}
+		m_threads.clear();
+		m_me.setEventPublisher(nullptr);
+	}
+
+	// Producer side, to be called from a single thread
+	void submitNewOrder(const TClientId& clientId, OrdSide side, const TPrice& px, const TQty& qty,
+		OrdTif tif = OrdTif::GTC, const TTimestamp& expireTime = 0, const TPrice& pxStop = TPrice(0), const TQty& qtyDisplay = 0)
+	{
+		std::int64_t seq(m_commands.claim());
+		OrdCommand& cmd(m_commands[seq]);
+
+		cmd.type = OrdCommandType::NEW;
+		cmd.clientId = clientId;
+		cmd.side = side;
+		cmd.px = px;
+		cmd.qty = qty;
+		cmd.tif = tif;
+		cmd.expireTime = expireTime;
+		cmd.pxStop = pxStop;
+		cmd.qtyDisplay = qtyDisplay;
+		cmd.pOrder = nullptr;
+		m_commands.publish(seq);
+	}
+
+	void submitCanOrder(const TClientId& clientId, const TOrdId& orderId)
+	{
+		std::int64_t seq(m_commands.claim());
+		OrdCommand& cmd(m_commands[seq]);
+
+		cmd.type = OrdCommandType::CANCEL;
+		cmd.clientId = clientId;
+		cmd.ordId = orderId;
+		cmd.pOrder = nullptr;
+		m_commands.publish(seq);
+	}
+
+	// Commands dropped by the decode stage for an unknown client
+	inline std::uint64_t dropped() const { return m_dropped.load(std::memory_order_relaxed); }
+
+protected:
+	enum class SlotType {
+		EVENT,
+		BULK_LOAD_ACK,
+		MASS_QUOTE_ACK
+	};
+
+	// Copies of an event and of its order, or of an ack, nothing in a slot
+	// is shared with the matcher. event points at the copy of the event's
+	// own type.
+	struct EventSlot
+	{
+		SlotType			type;
+		TSessionId			sessionId;
+		bool				hasOrder;	// cancel rejects of unknown orders have none
+		Order				order;
+		OrdEvent*			event;
+		NewOrdEvent			newOrd;
+		NewRejOrdEvent		newRej;
+		NewAckOrdEvent		newAck;
+		CanOrdEvent			can;
+		CanRejOrdEvent		canRej;
+		CanAckOrdEvent		canAck;
+		Execution			exec;
+		ConflatedExecution	conflatedExec;
+		Expired				expired;
+		TOrdId				firstOrdId;		// BULK_LOAD_ACK
+		TOrdId				lastOrdId;
+		OrdRejReason		reason;
+		std::unique_ptr<MassQuoteAck>	upQuoteAck;	// MASS_QUOTE_ACK, allocated by the first one to use the slot
+
+		EventSlot() :
+			type(SlotType::EVENT), sessionId(InvalidSessionId), hasOrder(false), order(0, OrdSide::NONE, TPrice(0), 0), event(nullptr),
+			newOrd(0, OrdSide::NONE, TPrice(0), 0), newRej(0), newAck(0, TPrice(0), 0), can(0),
+			canRej(0, OrdRejReason::NONE), canAck(0), exec(0, TPrice(0), 0), conflatedExec(0, TPrice(0), 0), expired(0),
+			firstOrdId(0), lastOrdId(0), reason(OrdRejReason::NONE)
+		{}
+
+		template <typename T>
+		inline void copyEvent(T& refCopy, const OrdEvent* pEvent)
+		{
+			refCopy = *static_cast<const T*>(pEvent);
+			event = &refCopy;
+		}
+	};
+
+	// Matcher thread
+	void publish(const TSessionId& sessionId, Order* order, OrdEvent* event) override
+	{
+		std::int64_t seq(m_events.claim());
+		EventSlot& slot(m_events[seq]);
+
+		slot.type = SlotType::EVENT;
+		slot.sessionId = sessionId;
+		slot.hasOrder = order != nullptr;
+		if (order) {
+			slot.order.copyState(*order);
+		}
+		switch (event->eventType()) {
+		case OrdEventType::NEW:
+			slot.copyEvent(slot.newOrd, event);
+			break;
+		case OrdEventType::NEW_REJECT:
+			slot.copyEvent(slot.newRej, event);
+			break;
+		case OrdEventType::NEW_ACK:
+			slot.copyEvent(slot.newAck, event);
+			break;
+		case OrdEventType::CANCEL:
+			slot.copyEvent(slot.can, event);
+			break;
+		case OrdEventType::CANCEL_REJECT:
+			slot.copyEvent(slot.canRej, event);
+			break;
+		case OrdEventType::CANCEL_ACK:
+			slot.copyEvent(slot.canAck, event);
+			break;
+		case OrdEventType::EXECUTION:
+			if (dynamic_cast<const ConflatedExecution*>(event)) {
+				slot.copyEvent(slot.conflatedExec, event);
+			}
+			else {
+				slot.copyEvent(slot.exec, event);
+			}
+			break;
+		case OrdEventType::EXPIRY:
+			slot.copyEvent(slot.expired, event);
+			break;
+		default:
+			slot.event = nullptr;
+			break;
+		}
+		m_events.publish(seq);
+	}
+
+	void publishBulkLoadAck(const TSessionId& sessionId, const TOrdId& firstOrdId, const TOrdId& lastOrdId, OrdRejReason reason) override
+	{
+		std::int64_t seq(m_events.claim());
+		EventSlot& slot(m_events[seq]);
+
+		slot.type = SlotType::BULK_LOAD_ACK;
+		slot.sessionId = sessionId;
+		slot.firstOrdId = firstOrdId;
+		slot.lastOrdId = lastOrdId;
+		slot.reason = reason;
+		m_events.publish(seq);
+	}
+
+	void publishMassQuoteAck(const TSessionId& sessionId, const MassQuoteAck& ack) override
+	{
+		std::int64_t seq(m_events.claim());
+		EventSlot& slot(m_events[seq]);
+
+		slot.type = SlotType::MASS_QUOTE_ACK;
+		slot.sessionId = sessionId;
+		if (!slot.upQuoteAck) {
+			slot.upQuoteAck.reset(new MassQuoteAck(ack));
+		}
+		else {
+			*slot.upQuoteAck = ack;
+		}
+		m_events.publish(seq);
+	}
+
+	inline static void idle(unsigned& spins)
+	{
+		if (++spins > 1000) {
+			std::this_thread::yield();
+		}
+	}
+
+	// Runs fn on every slot upstream makes available until done() is set and
+	// all of it has been consumed, publishing progress through refSeq
+	template <typename T, typename Done, typename Fn, typename Idle>
+	void consume(RingBuffer<T>& ring, const SequenceBarrier& upstream, Sequence& refSeq, Done&& done, Fn&& fn, Idle&& onIdle)
+	{
+		std::int64_t next(0);
+		unsigned spins(0);
+
+		for (;;) {
+			bool isDone(done());
+			std::int64_t avail(upstream.available());
+
+			if (avail < next) {
+				if (isDone) break;
+				onIdle();
+				idle(spins);
+				continue;
+			}
+			spins = 0;
+			for (; next <= avail; ++next) {
+				fn(ring[next]);
+			}
+			refSeq.set(avail);
+		}
+	}
+
+	void runDecode()
+	{
+		consume(m_commands, SequenceBarrier({ &m_commands.cursor() }), m_decodeSeq,
+			[this]() { return !m_running.load(std::memory_order_acquire); },
+			[this](OrdCommand& cmd) {
+				if (m_me.sessionOf(cmd.clientId) == InvalidSessionId) {
+					cmd.type = OrdCommandType::NONE;
+					m_dropped.fetch_add(1, std::memory_order_relaxed);
+					return;
+				}
+				if (cmd.type == OrdCommandType::NEW) {
+					cmd.pOrder = new Order(cmd.clientId, cmd.side, cmd.px, cmd.qty, cmd.tif, cmd.expireTime, cmd.pxStop);
+					cmd.pOrder->setDisplayQty(cmd.qtyDisplay);
+				}
+			},
+			[]() {});
+		m_decodeDone.store(true, std::memory_order_release);
+	}
+
+	void runJournal()
+	{
+		consume(m_commands, SequenceBarrier({ &m_decodeSeq }), m_journalSeq,
+			[this]() { return m_decodeDone.load(std::memory_order_acquire); },
+			[this](OrdCommand& cmd) {
+				if (cmd.type != OrdCommandType::NONE) {
+					cmd.dump(*m_pJournal);
+					*m_pJournal << '\n';
+				}
+			},
+			[this]() { m_pJournal->flush(); });
+		m_pJournal->flush();
+	}
+
+	void runMatch()
+	{
+		m_placementResult.pinned = pinThread(m_placement.cpu);
+
+		consume(m_commands, SequenceBarrier({ &m_decodeSeq }), m_matchSeq,
+			[this]() { return m_decodeDone.load(std::memory_order_acquire); },
+			[this](OrdCommand& cmd) {
+				switch (cmd.type) {
+				case OrdCommandType::NEW:
+					m_me.submitNewOrder(std::unique_ptr<Order>(cmd.pOrder));
+					break;
+				case OrdCommandType::CANCEL:
+					m_me.submitCanOrder(cmd.clientId, cmd.ordId);
+					break;
+				default:
+					break;
+				}
+			},
+			[this]() { m_me.onTimer(); });
+		m_matchDone.store(true, std::memory_order_release);
+	}
+
+	void runPublish()
+	{
+		consume(m_events, SequenceBarrier({ &m_events.cursor() }), m_publishSeq,
+			[this]() { return m_matchDone.load(std::memory_order_acquire); },
+			[this](EventSlot& slot) {
+				switch (slot.type) {
+				case SlotType::EVENT:
+					if (slot.event) {
+						m_me.dispatchEvent(slot.sessionId, slot.hasOrder ? &slot.order : nullptr, slot.event);
+					}
+					break;
+				case SlotType::BULK_LOAD_ACK:
+					m_me.dispatchBulkLoadAck(slot.sessionId, slot.firstOrdId, slot.lastOrdId, slot.reason);
+					break;
+				case SlotType::MASS_QUOTE_ACK:
+					m_me.dispatchMassQuoteAck(slot.sessionId, *slot.upQuoteAck);
+					break;
+				}
+			},
+			[]() {});
+	}
+
+	OrdME&						m_me;
+	std::ostream*				m_pJournal;
+	PlacementConfig				m_placement;
+	PlacementResult				m_placementResult;
+	RingBuffer<OrdCommand>		m_commands;
+	RingBuffer<EventSlot>		m_events;
+	Sequence					m_decodeSeq;
+	Sequence					m_journalSeq;
+	Sequence					m_matchSeq;
+	Sequence					m_publishSeq;
+	bool						m_started;
+	std::atomic<bool>			m_running;
+	std::atomic<bool>			m_decodeDone;
+	std::atomic<bool>			m_matchDone;
+	std::atomic<std::uint64_t>	m_dropped;
+	std::vector<std::thread>	m_threads;
+};
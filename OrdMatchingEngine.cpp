@@ -1,228 +1,1385 @@
-﻿// OrdMatchingEngine.cpp : Defines the entry point for the application.
+﻿// OrdMatchingEngine.cpp : The matching engine, OrdMEApp.cpp holds the
+// interactive application.
 //
 
 #include "OrdMatchingEngine.h"
 
+#include <algorithm>
+#include <cstring>
+#include <limits>
 #include <vector>
 
 TExecId OrdME::globalExecId(0);
+constexpr TTimestamp OrdME::DefaultTimerTickNs;
+constexpr std::size_t OrdME::DefaultMaxStopCascade;
+constexpr std::size_t OrdME::DefaultWarmUpOrders;
+constexpr TClientId OrdME::MaxClientId;
 
-void OrdME::submitNewOrder(std::unique_ptr<Order> upOrder) 
+OrdRejReason OrdME::submitNewOrder(std::unique_ptr<Order> upOrder)
 {
-	auto it = m_clientInfos.find(upOrder->clientId());
-	if (it == m_clientInfos.end()) {
-		throw std::runtime_error("placeNewOrder unknown clientId " + upOrder->clientId());
+	// Timers due before the command are recorded ahead of it
+	processTimer();
+
+	TClientId clientId(upOrder->clientId());
+	std::uint64_t tscStart(m_recorder.recordNew(*upOrder));
+	OrdCommand cmd;
+
+	if (m_pSink) {
+		cmd = orderCommand(OrdCommandType::NEW, *upOrder);
+	}
+	++m_seq;
+	OrdRejReason reason(newOrder(std::move(upOrder)));
+
+	m_recorder.recordDone(clientId, tscStart, reason);
+	passOn(cmd);
+	return reason;
+}
+
+OrdRejReason OrdME::submitCanOrder(const TClientId& clientId, const TOrdId& orderId)
+{
+	processTimer();
+
+	std::uint64_t tscStart(m_recorder.recordCancel(clientId, orderId));
+
+	++m_seq;
+	OrdRejReason reason(cancelOrder(clientId, orderId));
+
+	m_recorder.recordDone(clientId, tscStart, reason);
+
+	OrdCommand cmd;
+
+	cmd.type = OrdCommandType::CANCEL;
+	cmd.clientId = clientId;
+	cmd.ordId = orderId;
+	passOn(cmd);
+	return reason;
+}
+
+OrdRejReason OrdME::submitMassQuote(const TClientId& clientId, const QuoteLevel* pBids, std::size_t bidCount,
+	const QuoteLevel* pAsks, std::size_t askCount)
+{
+	processTimer();
+
+	std::uint64_t tscStart(m_recorder.recordMassQuote(clientId, bidCount, askCount));
+
+	++m_seq;
+	OrdRejReason reason(massQuote(clientId, pBids, bidCount, pAsks, askCount));
+
+	m_recorder.recordDone(clientId, tscStart, reason);
+
+	OrdCommand cmd;
+
+	if (m_pSink) {
+		cmd.type = OrdCommandType::QUOTE_LEVEL;
+		for (std::size_t i = 0; i < bidCount + askCount; ++i) {
+			const QuoteLevel& refLevel(i < bidCount ? pBids[i] : pAsks[i - bidCount]);
+
+			cmd.side = i < bidCount ? OrdSide::BUY : OrdSide::SELL;
+			cmd.px = refLevel.px;
+			cmd.qty = refLevel.qty;
+			m_pSink->onCommand(cmd, 0, 0);
+		}
+		cmd = OrdCommand();
+	}
+	cmd.type = OrdCommandType::MASS_QUOTE;
+	cmd.clientId = clientId;
+	cmd.qty = static_cast<TQty>(bidCount);
+	passOn(cmd);
+	return reason;
+}
+
+OrdCommand OrdME::orderCommand(OrdCommandType type, const Order& refOrd)
+{
+	OrdCommand cmd;
+
+	cmd.type = type;
+	cmd.clientId = refOrd.clientId();
+	cmd.side = refOrd.side();
+	cmd.px = refOrd.px();
+	cmd.pxStop = refOrd.pxStop();
+	cmd.qty = refOrd.qty();
+	cmd.tif = refOrd.tif();
+	cmd.expireTime = refOrd.expireTime();
+	cmd.conflateExecs = refOrd.conflateExecs();
+	cmd.qtyDisplay = refOrd.qtyDisplay();
+	return cmd;
+}
+
+OrdRejReason OrdME::newOrder(std::unique_ptr<Order> upOrder)
+{
+	TSessionId sessionId(sessionOf(upOrder->clientId()));
+	if (sessionId == InvalidSessionId) {
+		return OrdRejReason::UNKNOWN_CLIENT;
+	}
+
+	ClientInfo& refCI(m_clients[sessionId]);
+	// Throttled before any book work, and without an id or events
+	OrdRejReason reason(refCI.throttle.onMessage(m_now, true));
+
+	if (reason != OrdRejReason::NONE) return reason;
+
+	return enterOrder(refCI, std::move(upOrder));
+}
+
+OrdRejReason OrdME::enterOrder(ClientInfo& refCI, std::unique_ptr<Order> upOrder)
+{
+	Order* pOrder = upOrder.get();
+
+	std::list<OrdEventResponse> responses;
+
+	NewOrdEvent* pNew = pOrder->addNew(refCI.sessionId, ++refCI.nextOrdId);
+	
+	responses.push_back(OrdEventResponse{ pOrder, pNew });
+
+	if (!refCI.orders.insert(pOrder->ordId(), upOrder)) {
+		// Not stored, the callback only sees the order for its duration. Its
+		// events change no exposure and are not counted as kept.
+		NewRejOrdEvent* pNewRej = pOrder->addNewRej(OrdRejReason::DUPLICATE_ORDER_ID);
+
+		responses.push_back(OrdEventResponse{ pOrder, pNewRej });
+		for (const OrdEventResponse& refResp : responses) {
+			processEvent(refCI, refResp.order, refResp.ordEvent);
+		}
+		return OrdRejReason::DUPLICATE_ORDER_ID;
+	}
+
+	OrdRejReason reason(OrdRejReason::NONE);
+
+	if (pOrder->side() != OrdSide::BUY && pOrder->side() != OrdSide::SELL) {
+		reason = OrdRejReason::UNKNOWN_SIDE;
+	}
+	else if (pOrder->qty() == 0) {
+		reason = OrdRejReason::INVALID_QTY;
+	}
+	else if (pOrder->isIceberg() && pOrder->px() == TPrice(0)) {
+		reason = OrdRejReason::INVALID_PRICE;
+	}
+	else {
+		reason = checkNewOrder(refCI.riskLimits, refCI.exposure, pOrder, m_ordBook.referencePx());
+	}
+	if (reason != OrdRejReason::NONE) {
+		NewRejOrdEvent* pNewRej = pOrder->addNewRej(reason);
+
+		responses.push_back(OrdEventResponse{ pOrder, pNewRej });
+		handleEvents(responses);
+		return reason;
+	}
+	
+	NewAckOrdEvent* pNewAck = pOrder->addNewAck(pOrder->px(), pOrder->qty());
+
+	responses.push_back(OrdEventResponse{ pOrder, pNewAck });
+	m_stats.onOrder(m_now);
+
+	if (pOrder->isStop()) {
+		parkStop(pOrder, responses);
+	}
+	else {
+		matchOrder(pOrder, responses);
+	}
+	triggerStops(responses);
+
+	handleEvents(responses);
+	return OrdRejReason::NONE;
+}
+
+OrdRejReason OrdME::cancelOrder(const TClientId& clientId, const TOrdId& orderId)
+{
+	ClientInfo* pCI = findClient(clientId);
+	if (!pCI) {
+		return OrdRejReason::UNKNOWN_CLIENT;
+	}
+
+	ClientInfo& refCI(*pCI);
+
+	Order* pOrd = refCI.orders.find(orderId);
+	if (!pOrd) {
+		// Ids handed out before a snapshot restore belong to orders that had completed
+		bool isDone(orderId != 0 && orderId <= refCI.nextOrdId);
+
+		return rejectCancel(refCI, nullptr, orderId, isDone ? OrdRejReason::TOO_LATE_TO_CANCEL : OrdRejReason::UNKNOWN_ORDER);
+	}
+
+	if (pOrd->qtyOutstanding() == 0) {
+		return rejectCancel(refCI, pOrd, orderId, OrdRejReason::TOO_LATE_TO_CANCEL);
+	}
+	if (!removeFromBook(pOrd)) {
+		return rejectCancel(refCI, pOrd, orderId, OrdRejReason::NOT_IN_BOOK);
+	}
+
+	std::list<OrdEventResponse> responses;
+
+	CanOrdEvent* pCan = pOrd->addCan();
+
+	responses.emplace_back(OrdEventResponse{ pOrd, pCan });
+
+	CanAckOrdEvent* pCanAck = pOrd->addCanAck(pOrd->qtyOutstanding());
+
+	responses.emplace_back(OrdEventResponse{ pOrd, pCanAck });
+	m_stats.onCancel(m_now);
+
+	handleEvents(responses);
+	return OrdRejReason::NONE;
+}
+
+OrdRejReason OrdME::massQuote(const TClientId& clientId, const QuoteLevel* pBids, std::size_t bidCount,
+	const QuoteLevel* pAsks, std::size_t askCount)
+{
+	ClientInfo* pCI = findClient(clientId);
+	if (!pCI) {
+		return OrdRejReason::UNKNOWN_CLIENT;
+	}
+
+	ClientInfo& refCI(*pCI);
+	MassQuoteAck ack;
+
+	ack.clientId = clientId;
+	ack.reason = OrdRejReason::NONE;
+	ack.bidCount = static_cast<std::uint32_t>(std::min(bidCount, MaxQuoteLevels));
+	ack.askCount = static_cast<std::uint32_t>(std::min(askCount, MaxQuoteLevels));
+	ack.kept = ack.added = ack.cancelled = ack.rejected = 0;
+
+	// A mass quote is one message, its new quotes are held to the open
+	// order limit one by one
+	if (bidCount > MaxQuoteLevels || askCount > MaxQuoteLevels) {
+		ack.reason = OrdRejReason::TOO_MANY_QUOTES;
+	}
+	else {
+		ack.reason = refCI.throttle.onMessage(m_now, false);
+	}
+	if (ack.reason != OrdRejReason::NONE) {
+		ack.bidCount = ack.askCount = 0;
+		ackMassQuote(refCI, ack);
+		return ack.reason;
+	}
+	for (std::size_t i = 0; i < bidCount; ++i) {
+		ack.bids[i] = QuoteStatus{ 0, OrdRejReason::NONE, false };
+	}
+	for (std::size_t i = 0; i < askCount; ++i) {
+		ack.asks[i] = QuoteStatus{ 0, OrdRejReason::NONE, false };
+	}
+
+	// The quotes going away leave the book before any new one can trade
+	// against them, and their exposure is released before the new ones are
+	// checked
+	std::list<OrdEventResponse> responses;
+
+	m_isQuoting = true;
+	withdrawQuotes(refCI, OrdSide::BUY, pBids, bidCount, ack.bids, ack, responses);
+	withdrawQuotes(refCI, OrdSide::SELL, pAsks, askCount, ack.asks, ack, responses);
+	handleEvents(responses);
+	enterQuotes(refCI, OrdSide::BUY, pBids, bidCount, ack.bids, ack);
+	enterQuotes(refCI, OrdSide::SELL, pAsks, askCount, ack.asks, ack);
+	m_isQuoting = false;
+
+	ackMassQuote(refCI, ack);
+	return OrdRejReason::NONE;
+}
+
+void OrdME::withdrawQuotes(ClientInfo& refCI, OrdSide side, const QuoteLevel* pLevels, std::size_t count,
+	QuoteStatus* pStatus, MassQuoteAck& refAck, std::list<OrdEventResponse>& responses)
+{
+	auto itOut(refCI.quotes.begin());
+
+	for (Order* pOrd : refCI.quotes) {
+		if (pOrd->side() != side) {
+			*itOut++ = pOrd;
+			continue;
+		}
+		if (pOrd->qtyOutstanding() == 0) continue;
+
+		std::size_t i(0);
+
+		while (i < count && (pStatus[i].isKept || pLevels[i].px != pOrd->px() || pLevels[i].qty != pOrd->qtyOutstanding())) {
+			++i;
+		}
+		if (i < count) {
+			pStatus[i] = QuoteStatus{ pOrd->ordId(), OrdRejReason::NONE, true };
+			++refAck.kept;
+			*itOut++ = pOrd;
+			continue;
+		}
+		if (!removeFromBook(pOrd)) continue;
+
+		CanOrdEvent* pCan = pOrd->addCan();
+
+		responses.emplace_back(OrdEventResponse{ pOrd, pCan });
+
+		CanAckOrdEvent* pCanAck = pOrd->addCanAck(pOrd->qtyOutstanding());
+
+		responses.emplace_back(OrdEventResponse{ pOrd, pCanAck });
+		m_stats.onCancel(m_now);
+		++refAck.cancelled;
+	}
+	refCI.quotes.erase(itOut, refCI.quotes.end());
+}
+
+void OrdME::enterQuotes(ClientInfo& refCI, OrdSide side, const QuoteLevel* pLevels, std::size_t count,
+	QuoteStatus* pStatus, MassQuoteAck& refAck)
+{
+	for (std::size_t i = 0; i < count; ++i) {
+		if (pStatus[i].isKept || pLevels[i].qty == 0) continue;
+
+		std::unique_ptr<Order> upOrd(std::make_unique<Order>(refCI.clientId, side, pLevels[i].px, pLevels[i].qty));
+		Order* pOrd(upOrd.get());
+
+		upOrd->setQuote(true);
+
+		OrdRejReason reason(OrdRejReason::NONE);
+
+		if (pLevels[i].px <= TPrice(0)) {
+			reason = OrdRejReason::INVALID_PRICE;
+		}
+		else if (!refCI.throttle.canOpen()) {
+			reason = OrdRejReason::MAX_OPEN_ORDERS;
+		}
+		else {
+			reason = enterOrder(refCI, std::move(upOrd));
+		}
+		// Orders entered are stored under their id unless rejected for a
+		// duplicate one, those are gone
+		bool isStored(!upOrd && reason != OrdRejReason::DUPLICATE_ORDER_ID);
+
+		pStatus[i] = QuoteStatus{ isStored ? pOrd->ordId() : 0, reason, false };
+		if (reason != OrdRejReason::NONE) {
+			++refAck.rejected;
+			continue;
+		}
+		refCI.quotes.push_back(pOrd);
+		++refAck.added;
+	}
+}
+
+OrdRejReason OrdME::rejectCancel(ClientInfo& refCI, Order* pOrd, const TOrdId& orderId, OrdRejReason reason)
+{
+	// Cancel rejects leave the order untouched, the event is not kept in its history
+	CanRejOrdEvent	canRej(orderId, reason);
+
+	processEvent(refCI, pOrd, &canRej);
+	return reason;
+}
+
+void OrdME::onTimer()
+{
+	// A timer that changed nothing leaves nothing for a replica to miss
+	if (processTimer()) {
+		OrdCommand cmd;
+
+		cmd.type = OrdCommandType::TIMER;
+		passOn(cmd);
+	}
+	if (m_pMemoryListener && m_now >= m_nextMemoryReport) {
+		m_nextMemoryReport += ((m_now - m_nextMemoryReport) / m_memoryIntervalNs + 1) * m_memoryIntervalNs;
+		memoryReport(m_memoryReport);
+		m_pMemoryListener->onMemoryReport(m_memoryReport);
+	}
+}
+
+void OrdME::memoryReport(MemoryReport& refReport) const
+{
+	const MemoryPool& refPool(MemoryPool::instance());
+
+	refReport.ts = m_now;
+	for (std::size_t i = 0; i < MemCategoryCount; ++i) {
+		refReport.categories[i] = refPool.usage(static_cast<MemCategory>(i));
+	}
+	refReport.poolSize = refPool.size();
+	refReport.poolCarved = refPool.carved();
+
+	// Payload only, the container nodes' own links are not counted
+	BookMemory& refBook(refReport.book);
+
+	refBook.restingOrders = m_ordBook.orderCount();
+	refBook.levels = m_ordBook.levelCount();
+	refBook.levelSlots = m_ordBook.levelSlots();
+	refBook.stops = m_ordBook.stopCount();
+	refBook.bytes = refBook.levels * sizeof(OrdBook::TBids::value_type) + refBook.levelSlots * sizeof(PriceLevel::Entry)
+		+ refBook.stops * sizeof(OrdBook::TBuyStops::value_type);
+
+	// Events and their list nodes are sized at the process wide average
+	const MemUsage& refEvents(refReport.categories[static_cast<std::size_t>(MemCategory::EVENT)]);
+	const MemUsage& refHistory(refReport.categories[static_cast<std::size_t>(MemCategory::HISTORY)]);
+	std::uint64_t eventBytes(refEvents.objects == 0 ? 0 : (refEvents.bytes + refHistory.bytes) / refEvents.objects);
+
+	refReport.clients.clear();
+	for (const ClientInfo& refCI : m_clients) {
+		ClientMemory client{ refCI.clientId, refCI.orders.size(), refCI.events, refCI.orders.pages(), 0, {} };
+
+		client.categoryBytes[static_cast<std::size_t>(MemCategory::ORDER)] = client.orders * sizeof(Order);
+		client.categoryBytes[static_cast<std::size_t>(MemCategory::EVENT)] = client.events * eventBytes;
+		client.categoryBytes[static_cast<std::size_t>(MemCategory::INDEX)] = client.indexPages * OrdIdTable::pageBytes();
+		for (std::uint64_t bytes : client.categoryBytes) {
+			client.bytes += bytes;
+		}
+		refReport.clients.push_back(client);
+	}
+}
+
+bool OrdME::processTimer()
+{
+	// Runs first in every command, which triggers stops on its own trades
+	m_ordBook.beginTradeRange();
+	m_now = m_pClock->now();
+
+	std::list<OrdEventResponse> responses;
+	bool isChanged(false);
+
+	expireOrders(m_now, responses);
+	if (m_phase == TradingPhase::BATCH && m_now >= m_nextBatch) {
+		// Boundaries passed while idle collapse into the one batch
+		m_nextBatch += ((m_now - m_nextBatch) / m_batchIntervalNs + 1) * m_batchIntervalNs;
+		isChanged = true;
+		if (!m_batch.empty()) {
+			releaseBatch(responses);
+			uncrossBook(responses);
+		}
+	}
+	if (triggerStops(responses) != 0) {
+		isChanged = true;
 	}
+	if (!responses.empty()) {
+		std::uint64_t tscStart(m_recorder.recordTimer());
+
+		handleEvents(responses);
+		m_recorder.recordDone(0, tscStart, OrdRejReason::NONE);
+		isChanged = true;
+	}
+	return isChanged;
+}
+
+void OrdME::matchOrder(Order* pOrder, std::list<OrdEventResponse>& responses)
+{
+	if (m_phase == TradingPhase::CALL) {
+		restOrder(pOrder, responses);
+		return;
+	}
+	if (m_phase == TradingPhase::BATCH) {
+		queueBatch(pOrder);
+		return;
+	}
+
+	switch (m_allocation) {
+	case LevelAllocation::PRO_RATA:
+		trade<ProRataAllocation>(pOrder, responses);
+		break;
+
+	case LevelAllocation::FIFO_TOP_PRO_RATA:
+		trade<FifoTopProRataAllocation>(pOrder, responses);
+		break;
+
+	default:
+		trade<FifoAllocation>(pOrder, responses);
+		break;
+	}
+
+	if (pOrder->qtyOutstanding() > 0) {
+		restOrder(pOrder, responses);
+	}
+}
+
+template <typename TAlloc>
+void OrdME::trade(Order* pOrder, std::list<OrdEventResponse>& responses)
+{
+	switch (pOrder->side()) {
+	case OrdSide::BUY:
+		tradeAgainstAsks<TAlloc>(pOrder, responses);
+		break;
+
+	case OrdSide::SELL:
+		tradeAgainstBids<TAlloc>(pOrder, responses);
+		break;
+
+	default:
+		throw std::runtime_error("matchOrder unknown side");
+		break;
+	}
+}
+
+static TTimestamp orderDeadline(const Order* pOrder, const TTimestamp& endOfDay)
+{
+	switch (pOrder->tif()) {
+	case OrdTif::DAY:
+		return endOfDay;
+	case OrdTif::GTD:
+		return pOrder->expireTime();
+	default:
+		return 0;
+	}
+}
+
+void OrdME::restOrder(Order* pOrder, std::list<OrdEventResponse>& responses, PriceLevel** ppLevel)
+{
+	TTimestamp	expiry(orderDeadline(pOrder, m_endOfDay));
+
+	// Expire order if it is market order in continuous trading or its deadline has already passed
+	if ((pOrder->px() == TPrice(0) && m_phase == TradingPhase::CONTINUOUS) || (expiry != 0 && expiry <= m_now)) {
+		Expired* expired = pOrder->addExpired(pOrder->qtyOutstanding());
+
+		responses.push_back(OrdEventResponse{ pOrder, expired });
+		return;
+	}
+
+	PriceLevel* pLevel(ppLevel ? *ppLevel : nullptr);
+
+	if (!pLevel) {
+		pLevel = &m_ordBook.findOrCreateLevel(pOrder->side(), pOrder->px());
+		if (ppLevel) {
+			*ppLevel = pLevel;
+		}
+	}
+	pLevel->insertOrder(pOrder);
+	bookUpdate(BookUpdateType::ADD, pOrder, pOrder->qtyToShow());
+
+	if (expiry != 0) {
+		m_expiryTimers.arm(pOrder->expiryTimer(), expiry);
+	}
+}
+
+void OrdME::requeueSlice(PriceLevel& refLevel, Order* pOrder)
+{
+	refLevel.insertOrder(pOrder);
+	bookUpdate(BookUpdateType::ADD, pOrder, pOrder->qtyToShow());
+}
+
+void OrdME::parkStop(Order* pOrder, std::list<OrdEventResponse>& responses)
+{
+	TTimestamp	expiry(orderDeadline(pOrder, m_endOfDay));
+
+	if (expiry != 0 && expiry <= m_now) {
+		Expired* expired = pOrder->addExpired(pOrder->qtyOutstanding());
+
+		responses.push_back(OrdEventResponse{ pOrder, expired });
+		return;
+	}
+
+	pOrder->parkStop();
+	m_ordBook.insertStop(pOrder);
+	if (expiry != 0) {
+		m_expiryTimers.arm(pOrder->expiryTimer(), expiry);
+	}
+}
+
+std::size_t OrdME::triggerStops(std::list<OrdEventResponse>& responses)
+{
+	std::size_t triggered(0);
+
+	// Each injected order can move the last trade price and trigger more
+	// stops, they are run one after another rather than recursively
+	for (; triggered < m_maxStopCascade; ++triggered) {
+		Order* pStop = m_ordBook.popTriggeredStop();
+
+		if (!pStop) break;
+
+		pStop->unparkStop();
+		matchOrder(pStop, responses);
+	}
+	return triggered;
+}
+
+void OrdME::beginCallAuction()
+{
+	m_phase = TradingPhase::CALL;
+
+	OrdCommand cmd;
+
+	cmd.type = OrdCommandType::CALL_AUCTION;
+	passOn(cmd);
+}
+
+bool OrdME::beginBatchAuction(const TTimestamp& intervalNs)
+{
+	if (intervalNs == 0) return false;
+
+	processTimer();
+
+	m_phase = TradingPhase::BATCH;
+	m_batchIntervalNs = intervalNs;
+	m_nextBatch = m_now + intervalNs;
+
+	OrdCommand cmd;
+
+	cmd.type = OrdCommandType::BATCH_AUCTION;
+	cmd.expireTime = intervalNs;
+	passOn(cmd);
+	return true;
+}
+
+AuctionResult OrdME::uncross()
+{
+	processTimer();
+
+	std::uint64_t tscStart(m_recorder.recordUncross());
+	AuctionResult result;
+
+	++m_seq;
+	if (m_phase != TradingPhase::CONTINUOUS) {
+		std::list<OrdEventResponse> responses;
+
+		releaseBatch(responses);
+		result = uncrossBook(responses);
+
+		m_phase = TradingPhase::CONTINUOUS;
+		triggerStops(responses);
+
+		handleEvents(responses);
+	}
+	m_recorder.recordDone(0, tscStart, OrdRejReason::NONE);
+
+	OrdCommand cmd;
+
+	cmd.type = OrdCommandType::UNCROSS;
+	passOn(cmd);
+	return result;
+}
+
+void OrdME::queueBatch(Order* pOrder)
+{
+	pOrder->queueBatch(static_cast<std::uint32_t>(m_batch.size()));
+	m_batch.emplace_back(BatchEntry{ pOrder->side(), pOrder->px(), pOrder });
+}
+
+void OrdME::releaseBatch(std::list<OrdEventResponse>& responses)
+{
+	auto itEnd = std::remove_if(m_batch.begin(), m_batch.end(), [](const BatchEntry& ref) { return !ref.pOrder; });
+
+	for (auto it = m_batch.begin(); it != itEnd; ++it) {
+		it->pOrder->unqueueBatch();
+	}
+	restByLevel(m_batch.begin(), itEnd, responses);
+	m_batch.clear();
+}
+
+void OrdME::restByLevel(std::vector<BatchEntry>::iterator itBegin, std::vector<BatchEntry>::iterator itEnd,
+	std::list<OrdEventResponse>& responses)
+{
+	// Sorted once by side and price so the book is filled a level at a time,
+	// stable to keep arrival order within a level. The keys are copied into
+	// the entries so sorting does not touch the orders.
+	std::stable_sort(itBegin, itEnd, [](const BatchEntry& refLhs, const BatchEntry& refRhs) {
+		return refLhs.side < refRhs.side || (refLhs.side == refRhs.side && refLhs.px < refRhs.px);
+	});
+
+	PriceLevel* pLevel(nullptr);
+
+	for (auto it = itBegin; it != itEnd; ++it) {
+		if (it != itBegin && (it->side != (it - 1)->side || it->px != (it - 1)->px)) {
+			pLevel = nullptr;
+		}
+		restOrder(it->pOrder, responses, &pLevel);
+	}
+}
+
+AuctionResult OrdME::uncrossBook(std::list<OrdEventResponse>& responses)
+{
+	AuctionResult result(m_ordBook.auctionEquilibrium(m_auctionDepth));
+
+	for (TAuctionQty qtyLeft(result.qtyExec); qtyLeft > 0; ) {
+		PriceLevel* pBidLevel = m_ordBook.auctionBid(result.px);
+		PriceLevel* pAskLevel = m_ordBook.auctionAsk(result.px);
+
+		if (!pBidLevel || !pAskLevel) {
+			throw std::runtime_error("uncrossBook ran out of orders at the equilibrium price");
+		}
+
+		PriceLevel::Entry& refBid(pBidLevel->frontEntry());
+		PriceLevel::Entry& refAsk(pAskLevel->frontEntry());
+
+		qtyLeft -= std::min(refBid.qty, refAsk.qty);
+		crossAuction(*pBidLevel, refBid, *pAskLevel, refAsk, result.px, responses);
+
+		// An iceberg's next slice goes behind its level, still in the uncross
+		if (refBid.qty == 0) {
+			Order* pBid(refBid.pOrder);
+
+			pBidLevel->popFrontOrder();
+			if (pBid->qtyOutstanding() > 0) {
+				requeueSlice(*pBidLevel, pBid);
+			}
+			else if (pBidLevel->isEmpty() && pBidLevel != &m_ordBook.mktBid()) {
+				m_ordBook.popBestLimitBid();
+			}
+		}
+		if (refAsk.qty == 0) {
+			Order* pAsk(refAsk.pOrder);
+
+			pAskLevel->popFrontOrder();
+			if (pAsk->qtyOutstanding() > 0) {
+				requeueSlice(*pAskLevel, pAsk);
+			}
+			else if (pAskLevel->isEmpty() && pAskLevel != &m_ordBook.mktAsk()) {
+				m_ordBook.popBestLimitAsk();
+			}
+		}
+	}
+
+	expireLevel(m_ordBook.mktBid(), responses);
+	expireLevel(m_ordBook.mktAsk(), responses);
+	return result;
+}
+
+void OrdME::crossAuction(PriceLevel& refBidLevel, PriceLevel::Entry& refBid, PriceLevel& refAskLevel, PriceLevel::Entry& refAsk,
+	const TPrice& px, std::list<OrdEventResponse>& responses)
+{
+	TQty qtyExec(std::min(refBid.qty, refAsk.qty));
 
-	ClientInfo& refCI(it->second);
+	TExecId	execId(newExecId());
 
-	Order* pOrder = upOrder.get();
-	if (pOrder->side() != OrdSide::BUY && pOrder->side() != OrdSide::SELL) {
-		throw std::runtime_error("placeNewOrder unknown side");
+	refBidLevel.fill(refBid, qtyExec);
+	refAskLevel.fill(refAsk, qtyExec);
+	bookTrade(px, qtyExec, execId, OrdSide::NONE);
+	bookUpdate(BookUpdateType::EXECUTE, refBid.pOrder, qtyExec, execId);
+	bookUpdate(BookUpdateType::EXECUTE, refAsk.pOrder, qtyExec, execId);
+
+	Execution* pBidExec = refBid.pOrder->addExecution(execId, px, qtyExec);
+	Execution* pAskExec = refAsk.pOrder->addExecution(execId, px, qtyExec);
+
+	responses.emplace_back(OrdEventResponse{ refBid.pOrder, pBidExec });
+	responses.emplace_back(OrdEventResponse{ refAsk.pOrder, pAskExec });
+
+	if (m_tradeStore.isOpen()) {
+		m_tradeStore.append(TradeRecord{ execId, m_now, px, qtyExec, OrdSide::NONE,
+			refAsk.pOrder->clientId(), refAsk.pOrder->ordId(), refBid.pOrder->clientId(), refBid.pOrder->ordId() });
 	}
+	m_stats.onTrade(m_now, px, qtyExec);
 
-	std::list<OrdEventResponse> responses;
+	m_ordBook.onTrade(px);
+}
 
-	NewOrdEvent* pNew = pOrder->addNew(++refCI.nextOrdId);
-	
-	responses.push_back(OrdEventResponse{ pOrder, pNew });
+void OrdME::expireLevel(PriceLevel& refLevel, std::list<OrdEventResponse>& responses)
+{
+	while (!refLevel.isEmpty()) {
+		Order* pOrder = refLevel.frontOrder();
+
+		bookUpdate(BookUpdateType::DELETE, pOrder, refLevel.frontEntry().qty);
+		refLevel.popFrontOrder();
 
-	auto pr = refCI.orders.emplace(std::make_pair(pOrder->getNewOrd()->newOrdId(), std::move(upOrder)));
-	if (!pr.second) {
-		throw std::runtime_error("placeNewOrder cannot insert ordId " + pOrder->getNewOrd()->newOrdId());
+		Expired* expired = pOrder->addExpired(pOrder->qtyOutstanding());
+
+		responses.push_back(OrdEventResponse{ pOrder, expired });
 	}
-	
-	NewAckOrdEvent* pNewAck = pOrder->addNewAck(pOrder->px(), pOrder->qty());
+}
 
-	responses.push_back(OrdEventResponse{ pOrder, pNewAck });
+bool OrdME::removeFromBook(Order* pOrder)
+{
+	if (pOrder->isBatchQueued()) {
+		m_batch[pOrder->levelPos()].pOrder = nullptr;
+		pOrder->unqueueBatch();
+		return true;
+	}
+
+	if (pOrder->isStopParked()) {
+		if (!m_ordBook.removeStop(pOrder)) {
+			return false;
+		}
+		pOrder->unparkStop();
+		return true;
+	}
+
+	if (pOrder->px() == TPrice(0)) {
+		PriceLevel& refPL(pOrder->side() == OrdSide::BUY ? m_ordBook.mktBid() : m_ordBook.mktAsk());
+		TQty qtyShown(refPL.queuedQty(pOrder));
+
+		if (!refPL.removeOrder(pOrder)) {
+			return false;
+		}
+		bookUpdate(BookUpdateType::DELETE, pOrder, qtyShown);
+		return true;
+	}
 
 	switch (pOrder->side()) {
 	case OrdSide::BUY:
 	{
-		tradeAgainstAsks(pOrder, responses);
-		if (pOrder->qtyOutstanding() > 0) {
-			if (pOrder->px() == TPrice(0)) {
-				// Expire order if it is market order
-				Expired* expired = pOrder->addExpired(pOrder->qtyOutstanding());
+		auto itPL = m_ordBook.findLimitBid(pOrder->px());
+		if (itPL == m_ordBook.endLimitBids()) {
+			return false;
+		}
 
-				responses.push_back(OrdEventResponse{ pOrder, expired });
-			}
-			else {
-				PriceLevel& refBid(m_ordBook.findOrCreateLimitBid(pOrder->px()));
+		TQty qtyShown(itPL->second.queuedQty(pOrder));
 
-				refBid.insertOrder(pOrder);
-			}
+		if (!itPL->second.removeOrder(pOrder)) {
+			return false;
 		}
-		break;
+		if (itPL->second.isEmpty()) {
+			m_ordBook.removeLimitBid(itPL);
+		}
+		bookUpdate(BookUpdateType::DELETE, pOrder, qtyShown);
+		return true;
 	}
 
 	case OrdSide::SELL:
 	{
-		tradeAgainstBids(pOrder, responses);
-		if (pOrder->qtyOutstanding() > 0) {
-			if (pOrder->px() == TPrice(0)) {
-				// Expire order if it is market order
-				Expired* expired = pOrder->addExpired(pOrder->qtyOutstanding());
+		auto itPL = m_ordBook.findLimitAsk(pOrder->px());
+		if (itPL == m_ordBook.endLimitAsks()) {
+			return false;
+		}
 
-				responses.push_back(OrdEventResponse{ pOrder, expired });
-			}
-			else {
-				PriceLevel& refAsk(m_ordBook.findOrCreateLimitAsk(pOrder->px()));
+		TQty qtyShown(itPL->second.queuedQty(pOrder));
 
-				refAsk.insertOrder(pOrder);
-			}
+		if (!itPL->second.removeOrder(pOrder)) {
+			return false;
 		}
-		break;
+		if (itPL->second.isEmpty()) {
+			m_ordBook.removeLimitAsk(itPL);
+		}
+		bookUpdate(BookUpdateType::DELETE, pOrder, qtyShown);
+		return true;
 	}
 
 	default:
-		throw std::runtime_error("placeNewOrder unknown side");
-		break;
+		return false;
 	}
+}
 
-	handleEvents(responses);
+void OrdME::expireOrders(const TTimestamp& now, std::list<OrdEventResponse>& responses)
+{
+	m_expiryTimers.advance(now, [this, &responses](TimerNode* pNode) {
+		Order* pOrder = static_cast<Order*>(pNode->owner());
+
+		if (!removeFromBook(pOrder)) {
+			throw std::runtime_error("expireOrders cannot find in ordBook");
+		}
+
+		Expired* expired = pOrder->addExpired(pOrder->qtyOutstanding());
+
+		responses.push_back(OrdEventResponse{ pOrder, expired });
+	});
 }
 
-void OrdME::submitCanOrder(const TClientId& clientId, const TOrdId& orderId)
+std::size_t OrdME::snapshotOrderCount() const
 {
-	auto it = m_clientInfos.find(clientId);
-	if (it == m_clientInfos.end()) {
-		throw std::runtime_error("placeCanOrder cannot find clientId " + clientId);
+	std::size_t count(m_ordBook.orderCount());
+
+	for (const BatchEntry& refEntry : m_batch) {
+		if (refEntry.pOrder) {
+			++count;
+		}
 	}
+	return count;
+}
+
+bool OrdME::startSnapshot(const std::string& path)
+{
+	std::size_t orderCount(snapshotOrderCount());
+
+	return m_snapshotJob.start(path, snapshotSize(m_clients.size(), orderCount),
+		[this, orderCount](char* pData) { return writeSnapshot(pData, orderCount); });
+}
+
+bool OrdME::saveSnapshot(const std::string& path)
+{
+	std::size_t orderCount(snapshotOrderCount());
+
+	return m_snapshotJob.run(path, snapshotSize(m_clients.size(), orderCount),
+		[this, orderCount](char* pData) { return writeSnapshot(pData, orderCount); });
+}
 
-	ClientInfo& refCI(it->second);
+bool OrdME::writeSnapshot(char* pData, std::size_t orderCount) const
+{
+	// Runs in the forked child as well, it must not allocate
+	SnapshotOut out(pData);
+	SnapshotHeader& refHdr(out.next<SnapshotHeader>());
+
+	std::memcpy(refHdr.magic, SnapshotMagic, sizeof(refHdr.magic));
+	refHdr.version = SnapshotVersion;
+	refHdr.phase = static_cast<std::uint32_t>(m_phase);
+	refHdr.execId = globalExecId;
+	refHdr.pxLastTrade = m_ordBook.lastTradePx().rawValue();
+	refHdr.batchIntervalNs = m_batchIntervalNs;
+	refHdr.nextBatch = m_nextBatch;
+	refHdr.clientCount = m_clients.size();
+	refHdr.orderCount = orderCount;
+	refHdr.seq = m_seq;
+	refHdr.checksum = m_ordBook.checksum().value();
+	refHdr.updateSeq = m_updateSeq;
+
+	for (const ClientInfo& refCI : m_clients) {
+		SnapshotClient& refClient(out.next<SnapshotClient>());
+
+		refClient.clientId = refCI.clientId;
+		refClient.nextOrdId = refCI.nextOrdId;
+	}
 
-	auto itOrd = refCI.orders.find(orderId);
-	if (itOrd == refCI.orders.end()) {
-		throw std::runtime_error("placeCanOrder");
+	std::size_t written(0);
+
+	auto writeOrder = [&out, &written, orderCount](const Order* pOrd, SnapshotOrdPlace place, const TQty& qtyShown) {
+		if (written++ >= orderCount) return;
+
+		SnapshotOrder& refOrd(out.next<SnapshotOrder>());
+
+		refOrd.px = pOrd->px().rawValue();
+		refOrd.pxStop = pOrd->pxStop().rawValue();
+		refOrd.expireTime = pOrd->expireTime();
+		refOrd.clientId = pOrd->clientId();
+		refOrd.ordId = pOrd->ordId();
+		refOrd.qty = pOrd->qty();
+		refOrd.qtyOutstanding = pOrd->qtyOutstanding();
+		refOrd.qtyExec = pOrd->qtyExec();
+		refOrd.qtyCancelled = pOrd->qtyCancelled();
+		refOrd.qtyDisplay = pOrd->qtyDisplay();
+		refOrd.qtyShown = qtyShown;
+		refOrd.side = static_cast<std::uint8_t>(pOrd->side());
+		refOrd.state = static_cast<std::uint8_t>(pOrd->state());
+		refOrd.tif = static_cast<std::uint8_t>(pOrd->tif());
+		refOrd.place = static_cast<std::uint8_t>(place);
+		refOrd.flags = static_cast<std::uint8_t>((pOrd->conflateExecs() ? SnapshotOrdFlagConflateExecs : 0) |
+			(pOrd->isQuote() ? SnapshotOrdFlagQuote : 0));
+	};
+	auto writeLevel = [&writeOrder](const PriceLevel& refLevel) {
+		refLevel.forEachOrder([&writeOrder, &refLevel](const Order* pOrd) { writeOrder(pOrd, SnapshotOrdPlace::LEVEL, refLevel.queuedQty(pOrd)); });
+	};
+
+	writeLevel(m_ordBook.mktBid());
+	for (auto it = m_ordBook.beginLimitBids(); it != m_ordBook.endLimitBids(); ++it) {
+		writeLevel(it->second);
+	}
+	writeLevel(m_ordBook.mktAsk());
+	for (auto it = m_ordBook.beginLimitAsks(); it != m_ordBook.endLimitAsks(); ++it) {
+		writeLevel(it->second);
 	}
-	if (itOrd->second->qtyOutstanding() == 0) {
-		throw std::runtime_error("placeCanOrder clientId " + clientId);
+	m_ordBook.forEachStop([&writeOrder](const Order* pOrd) { writeOrder(pOrd, SnapshotOrdPlace::STOP, pOrd->qtyToShow()); });
+	for (const BatchEntry& refEntry : m_batch) {
+		if (refEntry.pOrder) {
+			writeOrder(refEntry.pOrder, SnapshotOrdPlace::BATCH, refEntry.pOrder->qtyToShow());
+		}
 	}
 
-	std::list<OrdEventResponse> responses;
+	return written == orderCount;
+}
 
-	Order* pOrd(itOrd->second.get());
+bool OrdME::validateSnapshot(const char* pData, std::size_t size) const
+{
+	SnapshotIn in(pData, size);
+	const SnapshotHeader* pHdr = in.next<SnapshotHeader>();
 
-	switch (pOrd->side()) {
-	case OrdSide::BUY:
-	{
-		if (pOrd->px() == TPrice(0)) {
-			PriceLevel* pPL = &(m_ordBook.mktBid());
-			PriceLevel::OrdList::iterator itOrd(pPL->findOrder(pOrd->ordId()));
+	if (!pHdr || std::memcmp(pHdr->magic, SnapshotMagic, sizeof(pHdr->magic)) != 0 || pHdr->version != SnapshotVersion) {
+		return false;
+	}
+	if (size != snapshotSize(pHdr->clientCount, pHdr->orderCount) || pHdr->phase > static_cast<std::uint32_t>(TradingPhase::BATCH)) {
+		return false;
+	}
 
-			if (itOrd == pPL->endOrders()) {
-				throw std::runtime_error("placeCanOrder cannot find in ordBook");
-			}
+	// Each client once, order ids are checked against the last one it handed out
+	std::vector<bool> hasClient(m_clients.size(), false);
+	std::vector<TOrdId> lastOrdIds(m_clients.size(), 0);
 
-			CanOrdEvent* pCan = pOrd->addCan();
+	for (std::uint64_t i = 0; i < pHdr->clientCount; ++i) {
+		const SnapshotClient* pClient = in.next<SnapshotClient>();
+		TSessionId sessionId(sessionOf(pClient->clientId));
 
-			responses.emplace_back(OrdEventResponse{ pOrd, pCan });
+		if (sessionId == InvalidSessionId || hasClient[sessionId]) return false;
+		hasClient[sessionId] = true;
+		lastOrdIds[sessionId] = pClient->nextOrdId;
+	}
+	// The orders must add up to the checksum of the book they came from
+	std::uint64_t checksum(0);
+	std::vector< std::pair<TSessionId, TOrdId> > ordIds;
+
+	ordIds.reserve(pHdr->orderCount);
+	for (std::uint64_t i = 0; i < pHdr->orderCount; ++i) {
+		const SnapshotOrder* pOrd = in.next<SnapshotOrder>();
+		TSessionId sessionId(sessionOf(pOrd->clientId));
+
+		if (sessionId == InvalidSessionId || pOrd->ordId == 0 || pOrd->ordId > lastOrdIds[sessionId] ||
+			(pOrd->side != static_cast<std::uint8_t>(OrdSide::BUY) && pOrd->side != static_cast<std::uint8_t>(OrdSide::SELL)) ||
+			pOrd->tif > static_cast<std::uint8_t>(OrdTif::GTD) ||
+			pOrd->state > static_cast<std::uint8_t>(OrdStateType::EXPIRED) ||
+			pOrd->place > static_cast<std::uint8_t>(SnapshotOrdPlace::BATCH) ||
+			pOrd->qtyOutstanding == 0 || pOrd->qtyShown == 0 || pOrd->qtyShown > pOrd->qtyOutstanding ||
+			(pOrd->qtyDisplay != 0 && pOrd->qtyShown > pOrd->qtyDisplay)) {
+			return false;
+		}
+		checksum += BookChecksum::key(pOrd->clientId, pOrd->ordId, static_cast<OrdSide>(pOrd->side), TPrice(TPrice::RawValue{ pOrd->px })) *
+			pOrd->qtyOutstanding;
+		ordIds.emplace_back(sessionId, pOrd->ordId);
+	}
+	std::sort(ordIds.begin(), ordIds.end());
+	if (std::adjacent_find(ordIds.begin(), ordIds.end()) != ordIds.end()) return false;
 
-			CanAckOrdEvent* pCanAck = pOrd->addCanAck(pOrd->qtyOutstanding());
+	return checksum == pHdr->checksum;
+}
 
-			responses.emplace_back(OrdEventResponse{ pOrd, pCanAck });
-			pPL->removeOrder(itOrd);
-		}
-		else {
-			auto itPL = m_ordBook.findLimitBid(pOrd->px());
-			if (itPL == m_ordBook.endLimitBids()) {
-				throw std::runtime_error("placeCanOrder cannot find in Limit Bids");
-			}
+bool OrdME::restoreSnapshot(const std::string& path)
+{
+	if (snapshotOrderCount() != 0) return false;
+	for (const ClientInfo& refCI : m_clients) {
+		if (refCI.nextOrdId != 0) return false;
+	}
 
-			PriceLevel* pPL = &(itPL->second);
-			PriceLevel::OrdList::iterator itOrd(pPL->findOrder(pOrd->ordId()));
+	MappedFile file;
 
-			if (itOrd == pPL->endOrders()) {
-				throw std::runtime_error("placeCanOrder cannot find in ordBook");
-			}
+	if (!file.openRead(path.c_str()) || !validateSnapshot(file.data(), file.size())) return false;
+
+	m_now = m_pClock->now();
 
-			CanOrdEvent* pCan = pOrd->addCan();
+	SnapshotIn in(file.data(), file.size());
+	const SnapshotHeader& refHdr(*in.next<SnapshotHeader>());
 
-			responses.emplace_back(OrdEventResponse{ pOrd, pCan });
+	for (std::uint64_t i = 0; i < refHdr.clientCount; ++i) {
+		const SnapshotClient& refClient(*in.next<SnapshotClient>());
 
-			CanAckOrdEvent* pCanAck = pOrd->addCanAck(pOrd->qtyOutstanding());
+		m_clients[sessionOf(refClient.clientId)].nextOrdId = refClient.nextOrdId;
+	}
 
-			responses.emplace_back(OrdEventResponse{ pOrd, pCanAck });
-			pPL->removeOrder(itOrd);
-			if (pPL->isEmpty()) {
-				m_ordBook.removeLimitBid(itPL);
+	// Records of one level are contiguous, the level is looked up once
+	PriceLevel* pLevel(nullptr);
+	OrdSide levelSide(OrdSide::NONE);
+
+	for (std::uint64_t i = 0; i < refHdr.orderCount; ++i) {
+		const SnapshotOrder& refRec(*in.next<SnapshotOrder>());
+		ClientInfo& refCI(m_clients[sessionOf(refRec.clientId)]);
+		OrdSide side(static_cast<OrdSide>(refRec.side));
+		TPrice px(TPrice::RawValue{ refRec.px });
+
+		std::unique_ptr<Order> upOrd(std::make_unique<Order>(refRec.clientId, side, px, refRec.qty,
+			static_cast<OrdTif>(refRec.tif), refRec.expireTime, TPrice(TPrice::RawValue{ refRec.pxStop })));
+		Order* pOrd = upOrd.get();
+
+		pOrd->restore(refCI.sessionId, refRec.ordId, static_cast<OrdStateType>(refRec.state),
+			refRec.qtyOutstanding, refRec.qtyExec, refRec.qtyCancelled);
+		pOrd->setConflateExecs((refRec.flags & SnapshotOrdFlagConflateExecs) != 0);
+		pOrd->setQuote((refRec.flags & SnapshotOrdFlagQuote) != 0);
+		pOrd->setDisplayQty(refRec.qtyDisplay);
+		// validateSnapshot has ruled out duplicate ids
+		refCI.orders.insert(refRec.ordId, upOrd);
+		if (pOrd->isQuote()) {
+			refCI.quotes.push_back(pOrd);
+		}
+		refCI.exposure.onOpen(pOrd, pOrd->qtyOutstanding());
+		m_ordBook.checksum().onOpen(pOrd, pOrd->qtyOutstanding());
+		countOpen(refCI, pOrd);
+		++refCI.events;	// the NEW it was restored with
+
+		switch (static_cast<SnapshotOrdPlace>(refRec.place)) {
+		case SnapshotOrdPlace::LEVEL:
+			if (!pLevel || pLevel->px() != px || levelSide != side) {
+				pLevel = &m_ordBook.findOrCreateLevel(side, px);
+				levelSide = side;
 			}
+			pLevel->insertOrder(pOrd, refRec.qtyShown);
+			break;
+		case SnapshotOrdPlace::STOP:
+			pOrd->parkStop();
+			m_ordBook.insertStop(pOrd);
+			break;
+		case SnapshotOrdPlace::BATCH:
+			queueBatch(pOrd);
+			break;
 		}
-		break;
-	}
 
-	case OrdSide::SELL:
-	{
-		if (pOrd->px() == TPrice(0)) {
-			PriceLevel* pPL = &(m_ordBook.mktAsk());
-			PriceLevel::OrdList::iterator itOrd(pPL->findOrder(pOrd->ordId()));
+		if (pOrd->isBatchQueued()) continue;
 
-			if (itOrd == pPL->endOrders()) {
-				throw std::runtime_error("placeCanOrder cannot find in ordBook");
-			}
+		TTimestamp expiry(orderDeadline(pOrd, m_endOfDay));
 
-			CanOrdEvent* pCan = pOrd->addCan();
+		if (expiry != 0) {
+			m_expiryTimers.arm(pOrd->expiryTimer(), expiry);
+		}
+	}
+
+	globalExecId = std::max<TExecId>(globalExecId, static_cast<TExecId>(refHdr.execId));
+	m_ordBook.setLastTradePx(TPrice(TPrice::RawValue{ refHdr.pxLastTrade }));
+	m_phase = static_cast<TradingPhase>(refHdr.phase);
+	m_batchIntervalNs = refHdr.batchIntervalNs;
+	m_nextBatch = refHdr.nextBatch;
+	m_seq = refHdr.seq;
+	m_updateSeq = refHdr.updateSeq;
+	m_ordBook.touch();
+	return true;
+}
 
-			responses.emplace_back(OrdEventResponse{ pOrd, pCan });
+OrdRejReason OrdME::bulkLoad(std::vector<std::unique_ptr<Order>>& orders)
+{
+	processTimer();
 
-			CanAckOrdEvent* pCanAck = pOrd->addCanAck(pOrd->qtyOutstanding());
+	OrdCommand cmd;
+	std::uint64_t tscStart(m_recorder.recordBulkLoad(orders.size()));
 
-			responses.emplace_back(OrdEventResponse{ pOrd, pCanAck });
-			pPL->removeOrder(itOrd);
+	++m_seq;
+	if (m_pSink) {
+		for (const std::unique_ptr<Order>& upOrd : orders) {
+			m_pSink->onCommand(orderCommand(OrdCommandType::BULK_ORDER, *upOrd), 0, 0);
 		}
-		else {
-			auto itPL = m_ordBook.findLimitAsk(pOrd->px());
-			if (itPL == m_ordBook.endLimitAsks()) {
-				throw std::runtime_error("placeCanOrder cannot find in Limit Asks");
-			}
+		cmd.type = OrdCommandType::BULK_LOAD;
+		cmd.qty = static_cast<TQty>(orders.size());
+	}
 
-			PriceLevel* pPL = &(itPL->second);
-			PriceLevel::OrdList::iterator itOrd(pPL->findOrder(pOrd->ordId()));
-			
-			if (itOrd == pPL->endOrders()) {
-				throw std::runtime_error("placeCanOrder cannot find in ordBook");
+	OrdRejReason reason(loadOrders(orders));
+
+	m_recorder.recordDone(0, tscStart, reason);
+	passOn(cmd);
+	return reason;
+}
+
+OrdRejReason OrdME::validateBulkLoad(const std::vector<std::unique_ptr<Order>>& orders) const
+{
+	std::vector<std::size_t> counts(m_clients.size(), 0);
+	bool hasBid(m_ordBook.hasLimitBid());
+	bool hasAsk(m_ordBook.hasLimitAsk());
+	TPrice pxBid(hasBid ? m_ordBook.bestLimitBid().px() : TPrice(0));
+	TPrice pxAsk(hasAsk ? m_ordBook.bestLimitAsk().px() : TPrice(0));
+
+	for (const std::unique_ptr<Order>& upOrd : orders) {
+		TSessionId sessionId(sessionOf(upOrd->clientId()));
+
+		if (sessionId == InvalidSessionId) return OrdRejReason::UNKNOWN_CLIENT;
+		++counts[sessionId];
+		if (upOrd->qty() == 0) return OrdRejReason::INVALID_QTY;
+		if (upOrd->px() <= TPrice(0) || upOrd->isStop()) return OrdRejReason::INVALID_PRICE;
+
+		switch (upOrd->side()) {
+		case OrdSide::BUY:
+			if (!hasBid || upOrd->px() > pxBid) {
+				pxBid = upOrd->px();
+				hasBid = true;
 			}
+			break;
+		case OrdSide::SELL:
+			if (!hasAsk || upOrd->px() < pxAsk) {
+				pxAsk = upOrd->px();
+				hasAsk = true;
+			}
+			break;
+		default:
+			return OrdRejReason::UNKNOWN_SIDE;
+		}
+	}
+	// The call phase rests crossing orders anyway, they meet in the uncross
+	if (m_phase != TradingPhase::CALL && hasBid && hasAsk && pxBid >= pxAsk) return OrdRejReason::CROSSED_BOOK;
+
+	// The ids each client's orders are going to take must be free
+	for (const ClientInfo& refCI : m_clients) {
+		std::size_t count(counts[refCI.sessionId]);
+
+		if (count > std::numeric_limits<TOrdId>::max() - refCI.nextOrdId) return OrdRejReason::DUPLICATE_ORDER_ID;
+		for (std::size_t i = 1; i <= count; ++i) {
+			if (refCI.orders.find(refCI.nextOrdId + static_cast<TOrdId>(i))) return OrdRejReason::DUPLICATE_ORDER_ID;
+		}
+	}
+	return OrdRejReason::NONE;
+}
 
-			CanOrdEvent* pCan = pOrd->addCan();
+OrdRejReason OrdME::loadOrders(std::vector<std::unique_ptr<Order>>& orders)
+{
+	// Everything is checked before anything is loaded
+	OrdRejReason reason(validateBulkLoad(orders));
 
-			responses.emplace_back(OrdEventResponse{ pOrd, pCan });
+	if (reason != OrdRejReason::NONE) {
+		std::vector<bool> isAcked(m_clients.size(), false);
 
-			CanAckOrdEvent* pCanAck = pOrd->addCanAck(pOrd->qtyOutstanding());
+		for (const std::unique_ptr<Order>& upOrd : orders) {
+			TSessionId sessionId(sessionOf(upOrd->clientId()));
 
-			responses.emplace_back(OrdEventResponse{ pOrd, pCanAck });
-			pPL->removeOrder(itOrd);
-			if (pPL->isEmpty()) {
-				m_ordBook.removeLimitAsk(itPL);
+			if (sessionId != InvalidSessionId && !isAcked[sessionId]) {
+				isAcked[sessionId] = true;
+				ackBulkLoad(m_clients[sessionId], 0, 0, reason);
 			}
 		}
-		break;
+		return reason;
 	}
 
-	default:
-		throw std::runtime_error("placeNewOrder unknown side");
-		break;
+	std::vector<TOrdId> firstOrdIds(m_clients.size());
+	std::vector<BatchEntry> entries;
+
+	for (std::size_t i = 0; i < m_clients.size(); ++i) {
+		firstOrdIds[i] = m_clients[i].nextOrdId + 1;
 	}
+	entries.reserve(orders.size());
+
+	for (std::unique_ptr<Order>& upOrd : orders) {
+		ClientInfo& refCI(m_clients[sessionOf(upOrd->clientId())]);
+		Order* pOrd = upOrd.get();
+
+		pOrd->restore(refCI.sessionId, ++refCI.nextOrdId, OrdStateType::ACTIVE, pOrd->qty(), 0, 0);
+		// validateBulkLoad has made sure the id is free
+		refCI.orders.insert(pOrd->ordId(), upOrd);
+		refCI.exposure.onOpen(pOrd, pOrd->qtyOutstanding());
+		m_ordBook.checksum().onOpen(pOrd, pOrd->qtyOutstanding());
+		countOpen(refCI, pOrd);
+		++refCI.events;	// the NEW it was restored with
+		m_stats.onOrder(m_now);
+		entries.emplace_back(BatchEntry{ pOrd->side(), pOrd->px(), pOrd });
+	}
+	orders.clear();
+
+	std::list<OrdEventResponse> responses;
+
+	// Orders whose deadline has passed are expired on the way in
+	restByLevel(entries.begin(), entries.end(), responses);
 
+	for (ClientInfo& refCI : m_clients) {
+		TOrdId firstOrdId(firstOrdIds[refCI.sessionId]);
+
+		if (refCI.nextOrdId >= firstOrdId) {
+			ackBulkLoad(refCI, firstOrdId, refCI.nextOrdId, OrdRejReason::NONE);
+		}
+	}
 	handleEvents(responses);
+	return OrdRejReason::NONE;
+}
+
+void OrdME::warmUp(std::size_t orders)
+{
+	const std::int64_t pxMid(TPrice(100).rawValue());
+	const TTimestamp tickNs(m_expiryTimers.tickNs());
+	ManualClock clock(m_now);
+	OrdME scratch(&clock, tickNs);
+	TExecId execId(globalExecId);
+
+	scratch.setLevelAllocation(m_allocation);
+	scratch.registerClient(0, nullptr);
+	scratch.registerClient(1, nullptr);
+
+	// Resting orders spread over 16 levels a side, every 4th one crossing,
+	// every 8th one GTD and every 3rd one cancelled a little later
+	for (std::size_t i = 0; i < orders; ++i) {
+		TClientId clientId(static_cast<TClientId>(i & 1));
+		OrdSide side((i >> 1) & 1 ? OrdSide::SELL : OrdSide::BUY);
+		std::int64_t offset(static_cast<std::int64_t>(1 + i % 16));
+		std::int64_t px(side == OrdSide::BUY ? pxMid - offset : pxMid + offset);
+		OrdTif tif(OrdTif::GTC);
+		TTimestamp expireTime(0);
+
+		if (i % 4 == 3) {
+			px = side == OrdSide::BUY ? pxMid + offset : pxMid - offset;
+		}
+		else if (i % 8 == 2) {
+			tif = OrdTif::GTD;
+			expireTime = clock.now() + 2 * tickNs;
+		}
+		scratch.submitNewOrder(std::unique_ptr<Order>(new Order(clientId, side, TPrice(TPrice::RawValue{ px }), TQty(1 + i % 7), tif, expireTime)));
+
+		if (i % 3 == 0 && i >= 6) {
+			scratch.submitCanOrder(clientId, static_cast<TOrdId>(i / 2 - 2));
+		}
+		if (i % 64 == 63) {
+			clock.advance(tickNs);
+			scratch.onTimer();
+		}
+	}
+	globalExecId = execId;
 }
 
 void OrdME::handleEvents(std::list<OrdEventResponse>& responses)
 {
 	for (auto resp : responses) {
-		processEvent(resp.order, resp.ordEvent);
+		ClientInfo& refCI(m_clients[resp.order->sessionId()]);
+
+		updateExposure(refCI, resp.order, resp.ordEvent);
+		processEvent(refCI, resp.order, resp.ordEvent);
+		++refCI.events;
+	}
+}
+
+void OrdME::updateExposure(ClientInfo& refCI, Order* order, OrdEvent* ordEvent)
+{
+	BookChecksum& refChecksum(m_ordBook.checksum());
+
+	switch (ordEvent->eventType()) {
+	case OrdEventType::NEW_ACK:
+		refCI.exposure.onOpen(order, static_cast<NewAckOrdEvent*>(ordEvent)->qtyOutstanding());
+		refChecksum.onOpen(order, static_cast<NewAckOrdEvent*>(ordEvent)->qtyOutstanding());
+		break;
+	case OrdEventType::EXECUTION:
+		refCI.exposure.onRelease(order, static_cast<Execution*>(ordEvent)->qtyExec());
+		refChecksum.onRelease(order, static_cast<Execution*>(ordEvent)->qtyExec());
+		break;
+	case OrdEventType::CANCEL_ACK:
+		refCI.exposure.onRelease(order, static_cast<CanAckOrdEvent*>(ordEvent)->qtyCancelled());
+		refChecksum.onRelease(order, static_cast<CanAckOrdEvent*>(ordEvent)->qtyCancelled());
+		break;
+	case OrdEventType::EXPIRY:
+		refCI.exposure.onRelease(order, static_cast<Expired*>(ordEvent)->qtyCancelled());
+		refChecksum.onRelease(order, static_cast<Expired*>(ordEvent)->qtyCancelled());
+		break;
+	default:
+		break;
+	}
+
+	// The events of one command come after all its matching, an order can
+	// be done by the time its ack is seen
+	if (order->isOpenCounted()) {
+		if (order->qtyOutstanding() == 0) {
+			order->setOpenCounted(false);
+			refCI.throttle.onClose();
+		}
+	}
+	else if (ordEvent->eventType() == OrdEventType::NEW_ACK) {
+		countOpen(refCI, order);
+	}
+}
+
+void OrdME::countOpen(ClientInfo& refCI, Order* order)
+{
+	if (order->qtyOutstanding() == 0) return;
+
+	order->setOpenCounted(true);
+	refCI.throttle.onOpen();
+}
+
+void OrdME::dispatchEvent(const TSessionId& sessionId, Order* order, OrdEvent* ordEvent)
+{
+	notifyClient(m_clients[sessionId], order, ordEvent);
+}
+
+void OrdME::dispatchBulkLoadAck(const TSessionId& sessionId, const TOrdId& firstOrdId, const TOrdId& lastOrdId, OrdRejReason reason)
+{
+	ClientInfo& refCI(m_clients[sessionId]);
+
+	if (refCI.pCallback) {
+		refCI.pCallback->onBulkLoadAck(firstOrdId, lastOrdId, reason);
+	}
+}
+
+void OrdME::dispatchMassQuoteAck(const TSessionId& sessionId, const MassQuoteAck& ack)
+{
+	ClientInfo& refCI(m_clients[sessionId]);
+
+	if (refCI.pCallback) {
+		refCI.pCallback->onMassQuoteAck(ack);
+	}
+}
+
+void OrdME::ackBulkLoad(ClientInfo& refCI, const TOrdId& firstOrdId, const TOrdId& lastOrdId, OrdRejReason reason)
+{
+	if (m_pPublisher) {
+		m_pPublisher->publishBulkLoadAck(refCI.sessionId, firstOrdId, lastOrdId, reason);
+		return;
 	}
+	dispatchBulkLoadAck(refCI.sessionId, firstOrdId, lastOrdId, reason);
 }
 
-void OrdME::processEvent(Order* order, OrdEvent* ordEvent)
+void OrdME::ackMassQuote(ClientInfo& refCI, const MassQuoteAck& ack)
 {
-	auto it = m_clientInfos.find(order->clientId());
-	if (it == m_clientInfos.end()) {
-		throw std::runtime_error("placeCanOrder cannot find clientId " + order->clientId());
+	if (m_pPublisher) {
+		m_pPublisher->publishMassQuoteAck(refCI.sessionId, ack);
+		return;
 	}
+	dispatchMassQuoteAck(refCI.sessionId, ack);
+}
 
-	ClientInfo& refCI(it->second);
+void OrdME::processEvent(ClientInfo& refCI, Order* order, OrdEvent* ordEvent)
+{
+	m_recorder.recordEvent(refCI.clientId, order, ordEvent);
+	// A mass quote reports its quotes' own events in its ack
+	if (m_isQuoting && order && order->isQuote()) {
+		switch (ordEvent->eventType()) {
+		case OrdEventType::NEW:
+		case OrdEventType::NEW_ACK:
+		case OrdEventType::NEW_REJECT:
+		case OrdEventType::CANCEL:
+		case OrdEventType::CANCEL_ACK:
+			return;
+		default:
+			break;
+		}
+	}
+	if (m_pPublisher) {
+		m_pPublisher->publish(refCI.sessionId, order, ordEvent);
+		return;
+	}
+	notifyClient(refCI, order, ordEvent);
+}
 
+void OrdME::notifyClient(ClientInfo& refCI, Order* order, OrdEvent* ordEvent)
+{
 	if (!refCI.pCallback) return; // no callback registered
 
 	switch (ordEvent->eventType()) {
@@ -252,44 +1409,27 @@ void OrdME::processEvent(Order* order, OrdEvent* ordEvent)
 		break;
 	case OrdEventType::NONE:
 	default:
-		throw std::runtime_error("processEvent unknown event type");
+		throw std::runtime_error("notifyClient unknown event type");
 		break;
 	}
 }
 
+template <typename TAlloc>
 void OrdME::tradeAgainstBids(Order* pOrder, std::list<OrdEventResponse>& responses)
 {
 	assert(pOrder->side() == OrdSide::SELL);
 
 	if (!m_ordBook.mktBid().isEmpty()) {
-		PriceLevel& refBid(m_ordBook.mktBid());
-
-		while (!refBid.isEmpty()) {
-			Order* pBidOrd = refBid.frontOrder();
-
-			cross(pOrder, pBidOrd, responses);
-			if (pBidOrd->qtyOutstanding() == 0) {
-				refBid.popFrontOrder();
-			}
-			if (pOrder->qtyOutstanding() == 0) break;
-		}
+		sweepLevel<TAlloc>(pOrder, m_ordBook.mktBid(), responses);
 		if (pOrder->qtyOutstanding() == 0) return;
 	}
 
 	while (m_ordBook.hasLimitBid()) {
 		PriceLevel& refBid(m_ordBook.bestLimitBid());
 
-		while (!refBid.isEmpty()) {
-			Order* pBidOrd = refBid.frontOrder();
-
-			if (pOrder->px() > pBidOrd->px()) return; // cannot trade anymore
+		if (pOrder->px() > refBid.px()) return; // cannot trade anymore
 
-			cross(pOrder, pBidOrd, responses);
-			if (pBidOrd->qtyOutstanding() == 0) {
-				refBid.popFrontOrder();
-			}
-			if (pOrder->qtyOutstanding() == 0) break;
-		}
+		sweepLevel<TAlloc>(pOrder, refBid, responses);
 		if (refBid.isEmpty()) {
 			m_ordBook.popBestLimitBid();
 		}
@@ -297,39 +1437,22 @@ void OrdME::tradeAgainstBids(Order* pOrder, std::list<OrdEventResponse>& respons
 	}
 }
 
+template <typename TAlloc>
 void OrdME::tradeAgainstAsks(Order* pOrder, std::list<OrdEventResponse>& responses)
 {
 	assert(pOrder->side() == OrdSide::BUY);
 
 	if (!m_ordBook.mktAsk().isEmpty()) {
-		PriceLevel& refAsk(m_ordBook.mktAsk());
-		
-		while (!refAsk.isEmpty()) {
-			Order* pAskOrd = refAsk.frontOrder();
-
-			cross(pOrder, pAskOrd, responses);
-			if (pAskOrd->qtyOutstanding() == 0) {
-				refAsk.popFrontOrder();
-			}
-			if (pOrder->qtyOutstanding() == 0) break;
-		}
+		sweepLevel<TAlloc>(pOrder, m_ordBook.mktAsk(), responses);
 		if (pOrder->qtyOutstanding() == 0) return;
 	}
 
 	while (m_ordBook.hasLimitAsk()) {
 		PriceLevel& refAsk(m_ordBook.bestLimitAsk());
 
-		while (!refAsk.isEmpty()) {
-			Order* pAskOrd = refAsk.frontOrder();
+		if (pOrder->px() != TPrice(0) && pOrder->px() < refAsk.px()) return; // cannot trade anymore
 
-			if (pOrder->px() < pAskOrd->px()) return; // cannot trade anymore
-
-			cross(pOrder, pAskOrd, responses);
-			if (pAskOrd->qtyOutstanding() == 0) {
-				refAsk.popFrontOrder();
-			}
-			if (pOrder->qtyOutstanding() == 0) break;
-		}
+		sweepLevel<TAlloc>(pOrder, refAsk, responses);
 		if (refAsk.isEmpty()) {
 			m_ordBook.popBestLimitAsk();
 		}
@@ -337,200 +1460,68 @@ void OrdME::tradeAgainstAsks(Order* pOrder, std::list<OrdEventResponse>& respons
 	}
 }
 
-void OrdME::cross(Order* pTakerOrd, Order* pMakerOrd, std::list<OrdEventResponse>& responses)
+template <typename TAlloc>
+void OrdME::sweepLevel(Order* pTakerOrd, PriceLevel& refLevel, std::list<OrdEventResponse>& responses)
 {
-	TQty qtyExec(std::min(pTakerOrd->qtyOutstanding(), pMakerOrd->qtyOutstanding()));
-
-	TExecId	execId(newExecId());
-
-	Execution* pMakerExec = pMakerOrd->addExecution(execId, pMakerOrd->px(), qtyExec);
-	Execution* pTakerExec = pTakerOrd->addExecution(execId, pMakerOrd->px(), qtyExec);
-
-	responses.emplace_back(OrdEventResponse{ pMakerOrd, pMakerExec });
-	responses.emplace_back(OrdEventResponse{ pTakerOrd, pTakerExec });
+	// The taker's execution follows the makers' once it has all the fills
+	ConflatedExecution* pTakerExec(nullptr);
+	ConflatedExecution** ppTakerExec(pTakerOrd->conflateExecs() || m_clients[pTakerOrd->sessionId()].conflateExecs ? &pTakerExec : nullptr);
+
+	// Icebergs whose slice was filled are queued again behind the level,
+	// where the taker can go on trading with them before the next price
+	for (;;) {
+		TAlloc::allocate(refLevel, pTakerOrd->qtyOutstanding(), m_allocScratch,
+			[this, pTakerOrd, &refLevel, &responses, ppTakerExec](PriceLevel::Entry& refMaker, const TQty& qtyExec) {
+				cross(pTakerOrd, refLevel, refMaker, qtyExec, responses, ppTakerExec);
+			});
+		if (m_slicesFilled.empty()) break;
+
+		for (Order* pOrder : m_slicesFilled) {
+			requeueSlice(refLevel, pOrder);
+		}
+		m_slicesFilled.clear();
+		if (pTakerOrd->qtyOutstanding() == 0) break;
+	}
+	if (pTakerExec) {
+		responses.emplace_back(OrdEventResponse{ pTakerOrd, pTakerExec });
+	}
 }
 
-class Client : public OrdME::Callback
+void OrdME::cross(Order* pTakerOrd, PriceLevel& refLevel, PriceLevel::Entry& refMaker, const TQty& qtyExec, std::list<OrdEventResponse>& responses,
+	ConflatedExecution** ppTakerExec)
 {
-public:
-	Client(const TClientId& clientId) : m_clientId(clientId) {}
-
-	inline const TClientId& clientId() const { return m_clientId; }
-
-	void onNew(Order* order, NewOrdEvent* event) override
-	{
-		std::cout << "onNew clientId " << clientId() << " ordId " << order->ordId() << " " << toString(order->state()) << " " << toString(order->side());
-		std::cout << " px " << order->px() << " qty " << order->qty() << std::endl;
-	}
+	TExecId	execId(newExecId());
 
-	void onNewRej(Order* order, NewRejOrdEvent* event) override 
-	{
-		std::cout << "onNewRej clientId " << clientId() << " ordId " << order->ordId() << " px " << order->px() << " qty " << order->qty() << std::endl;
-	}
+	refLevel.fill(refMaker, qtyExec);
 
-	void onNewAck(Order* order, NewAckOrdEvent* event) override 
-	{
-		std::cout << "onNewAck clientId " << clientId() << " ordId " << order->ordId() << " " << toString(order->state()) << " " << toString(order->side());
-		std::cout << " px " << order->px() << " qty " << order->qty();
-		std::cout << " cumOut " << order->qtyOutstanding() << " cumExe " << order->qtyExec() << " cumCan " << order->qtyCancelled() << std::endl;
-	}
+	Order* pMakerOrd = refMaker.pOrder;
 
-	void onCan(Order* order, CanOrdEvent* event) override
-	{
-		std::cout << "onCan clientId " << clientId() << " ordId " << order->ordId() << " " << toString(order->state()) << " " << toString(order->side()) << std::endl;
-	}
+	bookTrade(refLevel.px(), qtyExec, execId, pTakerOrd->side());
+	bookUpdate(BookUpdateType::EXECUTE, pMakerOrd, qtyExec, execId);
+	Execution* pMakerExec = pMakerOrd->addExecution(execId, refLevel.px(), qtyExec);
 
-	void onCanRej(Order* order, CanRejOrdEvent* event) override
-	{
-		std::cout << "onCanRej clientId " << clientId() << " ordId " << order->ordId() << " " << toString(order->state()) << " " << toString(order->side()) << std::endl;
+	responses.emplace_back(OrdEventResponse{ pMakerOrd, pMakerExec });
+	if (refMaker.qty == 0 && pMakerOrd->qtyOutstanding() > 0) {
+		m_slicesFilled.push_back(pMakerOrd);
 	}
 
-	void onCanAck(Order* order, CanAckOrdEvent* event) override
-	{
-		std::cout << "onCanAck clientId " << clientId() << " ordId " << order->ordId() << " " << toString(order->state()) << " " << toString(order->side());
-		std::cout << " px " << order->px() << " qty " << order->qty() << " canQty " << event->qtyCancelled();
-		std::cout << " cumOut " << order->qtyOutstanding() << " cumExe " << order->qtyExec() << " cumCan " << order->qtyCancelled() << std::endl;
-	}
+	if (!ppTakerExec) {
+		Execution* pTakerExec = pTakerOrd->addExecution(execId, refLevel.px(), qtyExec);
 
-	void onExec(Order* order, Execution* event) override 
-	{
-		std::cout << "onExec clientId " << clientId() << " ordId " << order->ordId() << " " << toString(order->state()) << " " << toString(order->side());
-		std::cout << " execId " << event->execId() << " exePx " << event->pxExec() << " exeQty " << event->qtyExec();
-		std::cout << " cumOut " << order->qtyOutstanding() << " cumExe " << order->qtyExec() << " cumCan " << order->qtyCancelled() << std::endl;
+		responses.emplace_back(OrdEventResponse{ pTakerOrd, pTakerExec });
 	}
-
-	void onExpiry(Order* order, Expired* event) override
-	{
-		std::cout << "onExpiry clientId " << clientId() << " ordId " << order->ordId() << " " << toString(order->state()) << " " << toString(order->side());
-		std::cout << " cancelled " << event->qtyCancelled() << std::endl;
-		std::cout << " cumOut " << order->qtyOutstanding() << " cumExe " << order->qtyExec() << " cumCan " << order->qtyCancelled() << std::endl;
+	else if (!*ppTakerExec) {
+		*ppTakerExec = pTakerOrd->addConflatedExecution(execId, refLevel.px(), qtyExec);
 	}
-
-protected:
-	TClientId	m_clientId;
-};
-
-int main()
-{
-	OrdME		me;
-	std::vector<Client>		clients({Client(0), Client(1), Client(2)});
-
-	for (Client& cl : clients) {
-		me.registerClient(cl.clientId(), &cl);
+	else {
+		pTakerOrd->addConflatedFill(*ppTakerExec, execId, qtyExec);
 	}
 
-	bool	isQuit(false);
-	int	currClientId(0);
-	int	command(0);
-
-	while (!isQuit) {
-		std::cout << "1. Select client (" << currClientId << ")" << std::endl;
-		std::cout << "2. Dump order book" << std::endl;
-		std::cout << "3. Create order" << std::endl;
-		std::cout << "4. Cancel order" << std::endl;
-		std::cout << "5. Quit" << std::endl;
-		std::cout << "Select command: ";
-
-		std::cin >> command;
-
-		switch (command) {
-		case 1:
-		{
-			int newClientId(0);
-			std::cout << "Select client (0.." << clients.size()-1 << "): ";
-			std::cin >> newClientId;
-
-			if (newClientId < 0 || newClientId > clients.size()-1) {
-				std::cout << "Unknown clientId " << newClientId << std::endl;
-			}
-			else {
-				std::cout << "ClientId set to " << newClientId << std::endl;
-				currClientId = newClientId;
-			}
-			break;
-		}
-		case 2:
-			std::cout << "Dump order book" << std::endl;
-			me.dumpOrdBook();
-			std::cout << std::endl;
-			break;
-		case 3:
-		{
-			char	chSide(0);
-			float	price(0.0);
-			TQty qty(0);
-			OrdSide	ordSide(OrdSide::NONE);
-
-			std::cout << "Create order" << std::endl;
-			std::cout << "Side(B/S): ";
-			std::cin >> chSide;
-			chSide = std::toupper(chSide);
-			switch(chSide) {
-			case 'B':
-				ordSide = OrdSide::BUY;
-				break;
-			case 'S':
-				ordSide = OrdSide::SELL;
-				break;
-			default:
-				std::cout << "Unknown side " << chSide << std::endl;
-				continue;
-			}
-
-			std::cout << "Price up to 2 decimal precision(0 for market order) : ";
-			std::cin >> price;
-
-			TPrice	px(price);
-
-			if (px < TPrice(0)) {
-				std::cout << "Price must not be negative" << std::endl;
-				continue;
-			}
-
-			std::cout << "Qty: ";
-			std::cin >> qty;
-
-			if (qty <= 0) {
-				std::cout << "Qty must be greater than 0" << std::endl;
-				continue;
-			}
-					
-			std::unique_ptr<Order> p(std::make_unique<Order>(currClientId, ordSide, px, qty));
-			try {
-				me.submitNewOrder(std::move(p));
-				std::cout << "Submit new order" << std::endl;
-			}
-			catch (const std::runtime_error& re) {
-				std::cerr << "Failed to submit new order" << std::endl;
-			}
-			break;
-		}
-		case 4:
-		{
-			TOrdId	canOrdId;
-
-			std::cout << "Cancel order" << std::endl;
-			std::cout << "Enter orderId: ";
-			std::cin >> canOrdId;
-
-			try {
-				me.submitCanOrder(currClientId, canOrdId);
-				std::cout << "Submit can order " << canOrdId << std::endl;
-			}
-			catch (const std::runtime_error& re) {
-				std::cerr << "Failed to submit can order" << std::endl;
-			}
-			break;
-		}
-		case 5:
-			std::cout << "Quit..." << std::endl;			
-			isQuit = true;
-			break;
-		default:
-			std::cout << "Unknown command " << command << std::endl;
-			break;
-		}
+	if (m_tradeStore.isOpen()) {
+		m_tradeStore.append(TradeRecord{ execId, m_now, refLevel.px(), qtyExec, pTakerOrd->side(),
+			pMakerOrd->clientId(), pMakerOrd->ordId(), pTakerOrd->clientId(), pTakerOrd->ordId() });
 	}
+	m_stats.onTrade(m_now, refLevel.px(), qtyExec);
 
-	return 0;
+	m_ordBook.onTrade(refLevel.px());
 }
@@ -7,17 +7,33 @@
 
 // TODO: Reference additional headers your program requires here.
 #include "Defn.h"
+#include "BookUpdate.h"
+#include "Clock.h"
+#include "OrdCommand.h"
+#include "FlightRecorder.h"
 #include "Order.h"
 #include "OrdBook.h"
+#include "OrdIdTable.h"
+#include "LevelAllocation.h"
+#include "MassQuote.h"
+#include "MemoryReport.h"
+#include "RiskCheck.h"
+#include "Snapshot.h"
+#include "Throttle.h"
+#include "TimingWheel.h"
+#include "TradeStore.h"
+#include "TradingStats.h"
 
+#include <deque>
 #include <memory>
 #include <numeric>
-#include <unordered_map>
+#include <vector>
 #include <queue>
 
 class OrdME
 {
 public:
+	// Called in the middle of a command, a callback must not register clients
 	class Callback
 	{
 	public:
@@ -29,20 +45,338 @@ public:
 		virtual void onCanAck(Order* order, CanAckOrdEvent* event) = 0;
 		virtual void onExec(Order* order, Execution* event) = 0;
 		virtual void onExpiry(Order* order, Expired* event) = 0;
+
+		// Orders firstOrdId to lastOrdId were taken by bulkLoad and rest in the
+		// book, they get no NEW/NEW_ACK. A rejected load takes none, the ids
+		// are then 0 and the reason says why.
+		virtual void onBulkLoadAck(const TOrdId&, const TOrdId&, OrdRejReason) {}
+
+		// Ends a mass quote of the client, which gets no NEW, NEW_ACK, CANCEL
+		// or CANCEL_ACK for the quotes it entered or withdrew, nor a
+		// NEW_REJECT. Their executions come as usual.
+		virtual void onMassQuoteAck(const MassQuoteAck&) {}
+	};
+
+	// Takes over event delivery from the client callbacks, e.g. to hand the
+	// events to another thread which then calls dispatchEvent. Events without
+	// a history (CANCEL_REJECT) only live for the duration of publish.
+	class EventPublisher
+	{
+	public:
+		virtual ~EventPublisher() {}
+
+		virtual void publish(const TSessionId& sessionId, Order* order, OrdEvent* event) = 0;
+		// Handed on to dispatchBulkLoadAck
+		virtual void publishBulkLoadAck(const TSessionId& sessionId, const TOrdId& firstOrdId, const TOrdId& lastOrdId,
+			OrdRejReason reason) = 0;
+		// Handed on to dispatchMassQuoteAck, ack only lives for the call
+		virtual void publishMassQuoteAck(const TSessionId& sessionId, const MassQuoteAck& ack) = 0;
+	};
+
+	// Told of every command once the engine has run it, with the clock
+	// reading it ran at and the book checksum after it, e.g. to feed a
+	// standby. Replaying them in sequence on an engine set up alike, its
+	// clock showing each ts, rebuilds the same state. Timers are only
+	// passed on when they changed something. The orders of a bulk load come
+	// as BULK_ORDER commands before the BULK_LOAD, and the levels of a mass
+	// quote as QUOTE_LEVEL commands before the MASS_QUOTE, with no ts.
+	class CommandSink
+	{
+	public:
+		virtual ~CommandSink() {}
+
+		virtual void onCommand(const OrdCommand& cmd, const TTimestamp& ts, std::uint64_t checksum) = 0;
+	};
+
+	// Told of every change to the orders resting in the levels as it is
+	// made, market by order, e.g. to keep a BookBuilder mirror in step.
+	// Parked stops and batch queued orders only show once they rest.
+	class BookListener
+	{
+	public:
+		virtual ~BookListener() {}
+
+		virtual void onBookUpdate(const BookUpdate& update) = 0;
+	};
+
+	// Handed the engine's MemoryReport from onTimer every interval of the
+	// engine clock, the report is only valid for the duration of the call
+	class MemoryListener
+	{
+	public:
+		virtual ~MemoryListener() {}
+
+		virtual void onMemoryReport(const MemoryReport& report) = 0;
 	};
 
+	static constexpr TTimestamp DefaultTimerTickNs = 1000000;	// 1ms
+	static constexpr std::size_t DefaultMaxStopCascade = 64;
+	static constexpr std::size_t DefaultWarmUpOrders = 100000;
+	static constexpr TClientId MaxClientId = 1 << 16;
+
 public:
-	OrdME() {}
+	// pClock drives DAY/GTD expiry, the system clock is used when none is given
+	OrdME(Clock* pClock = nullptr, const TTimestamp& timerTickNs = DefaultTimerTickNs) :
+		m_pClock(pClock ? pClock : &m_sysClock),
+		m_expiryTimers(timerTickNs, m_pClock->now()),
+		m_now(m_pClock->now()),
+		m_endOfDay(0),
+		m_maxStopCascade(DefaultMaxStopCascade),
+		m_phase(TradingPhase::CONTINUOUS),
+		m_allocation(LevelAllocation::FIFO),
+		m_batchIntervalNs(0),
+		m_nextBatch(0),
+		m_pPublisher(nullptr),
+		m_pSink(nullptr),
+		m_pBookListener(nullptr),
+		m_pMemoryListener(nullptr),
+		m_memoryIntervalNs(0),
+		m_nextMemoryReport(0),
+		m_isQuoting(false),
+		m_seq(0),
+		m_updateSeq(0),
+		m_stats(m_now)
+	{}
 	virtual ~OrdME() {}
 
+	// Client ids must be in [0, MaxClientId). Returns false if out of range
+	// or already registered, sessionOf() gives the session index the client
+	// is routed by. Not to be called from a callback.
 	bool registerClient(const TClientId& clientId, Callback* callback)
 	{
-		auto tup = m_clientInfos.emplace(std::make_pair(clientId, ClientInfo(callback)));
-		return tup.second;
+		if (clientId < 0 || clientId >= MaxClientId) return false;
+
+		std::size_t idx(static_cast<std::size_t>(clientId));
+
+		if (idx >= m_sessionByClient.size()) {
+			m_sessionByClient.resize(idx + 1, InvalidSessionId);
+		}
+		if (m_sessionByClient[idx] != InvalidSessionId) return false;
+
+		TSessionId sessionId(static_cast<TSessionId>(m_clients.size()));
+
+		m_clients.emplace_back(sessionId, clientId, callback);
+		m_sessionByClient[idx] = sessionId;
+		return true;
+	}
+
+	inline TSessionId sessionOf(const TClientId& clientId) const
+	{
+		std::size_t idx(static_cast<std::size_t>(clientId));
+
+		return clientId >= 0 && idx < m_sessionByClient.size() ? m_sessionByClient[idx] : InvalidSessionId;
+	}
+
+	bool setRiskLimits(const TClientId& clientId, const RiskLimits& limits)
+	{
+		ClientInfo* pCI = findClient(clientId);
+		if (!pCI) return false;
+
+		pCI->riskLimits = limits;
+		return true;
+	}
+
+	// Every order of the client taking liquidity gets one ConflatedExecution
+	// per price it trades at instead of one Execution per maker, as when set
+	// on the order. Makers are still told of each fill.
+	bool setExecConflation(const TClientId& clientId, bool conflate)
+	{
+		ClientInfo* pCI = findClient(clientId);
+		if (!pCI) return false;
+
+		pCI->conflateExecs = conflate;
+		return true;
+	}
+
+	// Replaces the client's callback, e.g. once a standby takes over
+	bool setClientCallback(const TClientId& clientId, Callback* callback)
+	{
+		ClientInfo* pCI = findClient(clientId);
+		if (!pCI) return false;
+
+		pCI->pCallback = callback;
+		return true;
+	}
+
+	inline const RiskExposure* exposure(const TClientId& clientId) const
+	{
+		TSessionId sessionId(sessionOf(clientId));
+		return sessionId == InvalidSessionId ? nullptr : &m_clients[sessionId].exposure;
+	}
+
+	// New orders and mass quotes over the client's limits are turned away
+	// before reaching the book, cancels never are. A standby must be set the
+	// same to stay in step.
+	bool setThrottle(const TClientId& clientId, const ThrottleLimits& limits)
+	{
+		ClientInfo* pCI = findClient(clientId);
+		if (!pCI) return false;
+
+		pCI->throttle.setLimits(limits);
+		return true;
+	}
+
+	inline const ThrottleStats* throttleStats(const TClientId& clientId) const
+	{
+		TSessionId sessionId(sessionOf(clientId));
+		return sessionId == InvalidSessionId ? nullptr : &m_clients[sessionId].throttle.stats();
 	}
 
-	void submitNewOrder(std::unique_ptr<Order> upOrder);
-	void submitCanOrder(const TClientId& clientId, const TOrdId& orderId);
+	// Both return OrdRejReason::NONE once accepted. Any other reason has also
+	// been reported through the client callback, except UNKNOWN_CLIENT and,
+	// left cheap for a flooding client, THROTTLED and MAX_OPEN_ORDERS.
+	// An iceberg, given a display qty, rests showing one slice at a time in
+	// the book, its BookUpdates and market data; it must have a limit price.
+	OrdRejReason submitNewOrder(std::unique_ptr<Order> upOrder);
+	OrdRejReason submitCanOrder(const TClientId& clientId, const TOrdId& orderId);
+
+	// Replaces the client's quotes, GTC limit orders, with up to
+	// MaxQuoteLevels bids and asks in one call. A quote still resting with
+	// the price and qty outstanding asked for is kept with its priority, the
+	// others are withdrawn before the new levels are entered like
+	// submitNewOrder would, risk checks and matching included. No level
+	// withdraws all the client's quotes. The outcome comes in one
+	// onMassQuoteAck. Quotes can also be cancelled one at a time.
+	OrdRejReason submitMassQuote(const TClientId& clientId, const QuoteLevel* pBids, std::size_t bidCount,
+		const QuoteLevel* pAsks, std::size_t askCount);
+
+	// nullptr restores direct delivery to the client callbacks
+	inline void setEventPublisher(EventPublisher* pPublisher) { m_pPublisher = pPublisher; }
+
+	// nullptr stops passing commands on
+	inline void setCommandSink(CommandSink* pSink) { m_pSink = pSink; }
+
+	// nullptr stops the book updates, which are still counted
+	inline void setBookListener(BookListener* pListener) { m_pBookListener = pListener; }
+	// Seq of the last book update, a snapshot carries it over
+	inline std::uint64_t bookUpdateSeq() const { return m_updateSeq; }
+
+	// Live bytes and objects by category, for the book and for every client
+	void memoryReport(MemoryReport& refReport) const;
+
+	// Reports to pListener from onTimer once every intervalNs of the engine
+	// clock, nullptr or a 0 interval stops the reports
+	inline void setMemoryListener(MemoryListener* pListener, const TTimestamp& intervalNs)
+	{
+		m_pMemoryListener = intervalNs == 0 ? nullptr : pListener;
+		m_memoryIntervalNs = intervalNs;
+		m_nextMemoryReport = m_pMemoryListener ? m_now + intervalNs : 0;
+	}
+
+	// Calls the session's callback for an event handed to an EventPublisher
+	void dispatchEvent(const TSessionId& sessionId, Order* order, OrdEvent* ordEvent);
+	void dispatchBulkLoadAck(const TSessionId& sessionId, const TOrdId& firstOrdId, const TOrdId& lastOrdId, OrdRejReason reason);
+	void dispatchMassQuoteAck(const TSessionId& sessionId, const MassQuoteAck& ack);
+
+	// Expires every resting order whose deadline has passed on the engine clock
+	void onTimer();
+
+	// Deadline applied to DAY orders, 0 leaves them resting until cancelled
+	inline void setEndOfDay(const TTimestamp& ts) { m_endOfDay = ts; }
+	inline const TTimestamp& endOfDay() const { return m_endOfDay; }
+
+	// Stops triggered beyond this count within one command stay parked and
+	// are injected at the start of the next command
+	inline void setMaxStopCascade(std::size_t maxStops) { m_maxStopCascade = maxStops; }
+	inline std::size_t maxStopCascade() const { return m_maxStopCascade; }
+
+	// How an incoming order is shared among the makers at each price it
+	// trades at in continuous matching, auctions always allocate in FIFO
+	inline void setLevelAllocation(LevelAllocation alloc) { m_allocation = alloc; }
+	inline LevelAllocation levelAllocation() const { return m_allocation; }
+
+	// Orders accepted during the call phase rest without matching, market
+	// orders included, until uncross() runs the auction
+	void beginCallAuction();
+	inline TradingPhase tradingPhase() const { return m_phase; }
+
+	// Price and volume the call auction would uncross at now
+	inline AuctionResult indicativeUncross() { return m_ordBook.auctionEquilibrium(m_auctionDepth); }
+
+	// Orders accepted from now on are held back and released into the book
+	// every intervalNs of the engine clock, each batch then uncrossing like
+	// a call auction at a single price. Returns false for a 0 interval.
+	bool beginBatchAuction(const TTimestamp& intervalNs);
+	inline const TTimestamp& batchInterval() const { return m_batchIntervalNs; }
+	inline std::size_t batchPending() const { return m_batch.size(); }
+
+	// Executes the call auction, or the pending batch, at its equilibrium
+	// price in price-time order, expires the market orders left over and
+	// resumes continuous trading
+	AuctionResult uncross();
+
+	// Image of the open orders, their queue positions and the id counters.
+	// startSnapshot forks and returns as soon as the child has been created,
+	// the copy-on-write child then writes path while matching carries on;
+	// poll snapshotStatus() to learn when it is done. saveSnapshot writes in
+	// line. Both refuse to start while a forked snapshot is still running.
+	bool startSnapshot(const std::string& path);
+	bool saveSnapshot(const std::string& path);
+	inline SnapshotJob::Status snapshotStatus() { return m_snapshotJob.poll(); }
+	inline SnapshotJob::Status waitSnapshot() { return m_snapshotJob.wait(); }
+
+	// Rebuilds the book from a snapshot in one pass over the file. Every
+	// client in the image must already be registered and the engine must
+	// not have taken any order yet. Set the end of day first for DAY orders
+	// to be armed. Returns false, with nothing restored, if the image is
+	// unusable.
+	bool restoreSnapshot(const std::string& path);
+
+	// Checksum of the open orders as of the last command (see BookChecksum)
+	// and the count of commands taken: new orders, cancels, bulk loads and
+	// uncrosses, rejected ones included. Engines fed the same commands on
+	// the same clock agree on both after every command, a snapshot carries
+	// them over.
+	inline std::uint64_t bookChecksum() const { return m_ordBook.checksum().value(); }
+	inline std::uint64_t commandSeq() const { return m_seq; }
+
+	// Read on the engine thread, e.g. by a MarketDataPublisher. The version
+	// changes whenever a command may have changed the book.
+	inline const OrdBook& ordBook() const { return m_ordBook; }
+	inline std::uint64_t bookVersion() const { return m_ordBook.version(); }
+
+	// OHLC, VWAP, volume and trade, order and cancel counts since the engine
+	// started, kept up to date as orders are processed. Read them on the
+	// engine thread.
+	inline const TradingStats& stats() const { return m_stats.total(); }
+
+	// Also keeps the stats of each intervalNs of the engine clock, the last
+	// count intervals with activity are kept. 0 for either turns them off.
+	inline void setStatsInterval(const TTimestamp& intervalNs, std::size_t count) { m_stats.setInterval(intervalNs, count); }
+	inline std::size_t statsIntervalCount() const { return m_stats.intervalCount(); }
+	// ago 0 is the latest interval
+	inline const TradingStats& intervalStats(std::size_t ago) const { return m_stats.intervalStats(ago); }
+
+	// Appends every trade to the column store in dir, which is created if
+	// missing and carried on otherwise. Analytics read it while the engine
+	// runs through a TradeStoreReader. Trades are stamped with the engine
+	// clock reading of the command that matched them.
+	inline bool openTradeStore(const std::string& dir) { return m_tradeStore.open(dir); }
+	inline void closeTradeStore() { m_tradeStore.close(); }
+	// False as well once the store failed to grow and was closed
+	inline bool isTradeStoreOpen() const { return m_tradeStore.isOpen(); }
+
+	// Rests limit orders in the book in one pass without matching them, e.g.
+	// the GTC orders carried over from the last session. A client's orders
+	// get consecutive ids in the sequence given, which is also their time
+	// priority within a level. Risk limits are not checked. If any order is
+	// not a resting limit order, the orders would cross each other or the
+	// book, or the ids they would take are not free, nothing is loaded and
+	// the reason is returned. Otherwise orders is left empty. Either way each
+	// client with orders in the load is told once through onBulkLoadAck.
+	OrdRejReason bulkLoad(std::vector<std::unique_ptr<Order>>& orders);
+
+	// Runs orders synthetic orders, crossing, resting, expiring and being
+	// cancelled, through submitNewOrder/submitCanOrder on a scratch book so
+	// that the code paths are hot and the MemoryPool free lists are filled
+	// before the open. This engine's book and clients are left untouched and
+	// the exec ids used are given back. Call it on the matching thread after
+	// applyPlacement, with no other engine running.
+	void warmUp(std::size_t orders = DefaultWarmUpOrders);
+
+	// Recent commands and events, for post-mortems. Set its dump path and
+	// latency threshold, and install its crash handlers, before the open.
+	inline FlightRecorder& flightRecorder() { return m_recorder; }
 
 	inline void dumpOrdBook() {
 		m_ordBook.dump();
@@ -50,11 +384,21 @@ public:
 
 protected:
 	struct ClientInfo {
+		TSessionId	sessionId;
+		TClientId	clientId;
 		Callback* pCallback;
 		TOrdId	nextOrdId;
-		std::unordered_map< TOrdId, std::unique_ptr<Order> >	orders;
+		OrdIdTable		orders;
+		RiskLimits		riskLimits;
+		RiskExposure	exposure;
+		bool			conflateExecs;
+		std::vector<Order*>	quotes;		// entered by mass quotes, those done dropped at the next one
+		Throttle		throttle;
+		std::uint64_t	events;		// kept in the histories of its orders
 
-		ClientInfo(Callback* cb) : pCallback(cb), nextOrdId(0) {}
+		ClientInfo(const TSessionId& id, const TClientId& client, Callback* cb) :
+			sessionId(id), clientId(client), pCallback(cb), nextOrdId(0), conflateExecs(false), events(0)
+		{}
 	};
 
 	struct OrdEventResponse
@@ -63,24 +407,174 @@ protected:
 		OrdEvent*	ordEvent;
 	};
 
-	using ClientInfoMap = std::unordered_map<TClientId, ClientInfo>;
+	struct BatchEntry
+	{
+		OrdSide	side;
+		TPrice	px;
+		Order*	pOrder;
+	};
+
+	inline ClientInfo* findClient(const TClientId& clientId)
+	{
+		TSessionId sessionId(sessionOf(clientId));
+		return sessionId == InvalidSessionId ? nullptr : &m_clients[sessionId];
+	}
+
+	// submitNewOrder, submitCanOrder and bulkLoad, which record them
+	OrdRejReason newOrder(std::unique_ptr<Order> upOrder);
+	OrdRejReason cancelOrder(const TClientId& clientId, const TOrdId& orderId);
+	OrdRejReason loadOrders(std::vector<std::unique_ptr<Order>>& orders);
+	// Checks a bulk load as a whole before loadOrders changes anything
+	OrdRejReason validateBulkLoad(const std::vector<std::unique_ptr<Order>>& orders) const;
+	OrdRejReason massQuote(const TClientId& clientId, const QuoteLevel* pBids, std::size_t bidCount,
+		const QuoteLevel* pAsks, std::size_t askCount);
+
+	// newOrder once the client is known
+	OrdRejReason enterOrder(ClientInfo& refCI, std::unique_ptr<Order> upOrder);
+	// Diffs the quotes of one side against levels, withdrawing the quotes not kept
+	void withdrawQuotes(ClientInfo& refCI, OrdSide side, const QuoteLevel* pLevels, std::size_t count,
+		QuoteStatus* pStatus, MassQuoteAck& refAck, std::list<OrdEventResponse>& responses);
+	void enterQuotes(ClientInfo& refCI, OrdSide side, const QuoteLevel* pLevels, std::size_t count,
+		QuoteStatus* pStatus, MassQuoteAck& refAck);
+
+	// onTimer, returns whether the book or the batch schedule changed
+	bool processTimer();
+
+	static OrdCommand orderCommand(OrdCommandType type, const Order& refOrd);
+
+	// Ends every command that may have changed the book, sink or not
+	inline void passOn(const OrdCommand& cmd)
+	{
+		m_ordBook.touch();
+		if (m_pSink) {
+			m_pSink->onCommand(cmd, m_now, m_ordBook.checksum().value());
+		}
+	}
+
+	inline void bookUpdate(BookUpdateType type, const Order* pOrd, const TQty& qty, const TExecId& execId = 0)
+	{
+		++m_updateSeq;
+		if (m_pBookListener) {
+			m_pBookListener->onBookUpdate(BookUpdate{ m_updateSeq, bookOrderKey(pOrd->clientId(), pOrd->ordId()), execId,
+				pOrd->px(), qty, pOrd->side(), type });
+		}
+	}
+	inline void bookTrade(const TPrice& px, const TQty& qty, const TExecId& execId, OrdSide aggressor)
+	{
+		++m_updateSeq;
+		if (m_pBookListener) {
+			m_pBookListener->onBookUpdate(BookUpdate{ m_updateSeq, 0, execId, px, qty, aggressor, BookUpdateType::TRADE });
+		}
+	}
+
+	OrdRejReason rejectCancel(ClientInfo& refCI, Order* pOrd, const TOrdId& orderId, OrdRejReason reason);
 
 	void handleEvents(std::list<OrdEventResponse>& responses);
 
-	void processEvent(Order* order, OrdEvent* ordEvent);
+	// Keeps the client's exposure, open orders and the book checksum in step
+	// with the event
+	void updateExposure(ClientInfo& refCI, Order* order, OrdEvent* ordEvent);
+	void countOpen(ClientInfo& refCI, Order* order);
 
+	void processEvent(ClientInfo& refCI, Order* order, OrdEvent* ordEvent);
+
+	void notifyClient(ClientInfo& refCI, Order* order, OrdEvent* ordEvent);
+
+	// Through the EventPublisher if one is set
+	void ackBulkLoad(ClientInfo& refCI, const TOrdId& firstOrdId, const TOrdId& lastOrdId, OrdRejReason reason);
+	void ackMassQuote(ClientInfo& refCI, const MassQuoteAck& ack);
+
+	// TAlloc is one of the LevelAllocation.h policies
+	template <typename TAlloc>
+	void trade(Order* pOrder, std::list<OrdEventResponse>& responses);
+
+	template <typename TAlloc>
 	void tradeAgainstBids(Order* pOrder, std::list<OrdEventResponse>& responses);
 
+	template <typename TAlloc>
 	void tradeAgainstAsks(Order* pOrder, std::list<OrdEventResponse>& responses);
 
-	void cross(Order* pTakerOrd, Order* pMakerOrd, std::list<OrdEventResponse>& responses);
+	template <typename TAlloc>
+	void sweepLevel(Order* pTakerOrd, PriceLevel& refLevel, std::list<OrdEventResponse>& responses);
+
+	// With ppTakerExec the taker's fill is added to *ppTakerExec, started if nullptr,
+	// and left for the caller to report
+	void cross(Order* pTakerOrd, PriceLevel& refLevel, PriceLevel::Entry& refMaker, const TQty& qtyExec, std::list<OrdEventResponse>& responses,
+		ConflatedExecution** ppTakerExec = nullptr);
+
+	// Queues the next slice of an iceberg whose shown qty was filled behind the level
+	void requeueSlice(PriceLevel& refLevel, Order* pOrder);
+
+	void matchOrder(Order* pOrder, std::list<OrdEventResponse>& responses);
+
+	// ppLevel caches the level between calls for orders of one side and price
+	void restOrder(Order* pOrder, std::list<OrdEventResponse>& responses, PriceLevel** ppLevel = nullptr);
+
+	void queueBatch(Order* pOrder);
+
+	void releaseBatch(std::list<OrdEventResponse>& responses);
+
+	// Sorts [itBegin, itEnd) by side and price and rests them a level at a time
+	void restByLevel(std::vector<BatchEntry>::iterator itBegin, std::vector<BatchEntry>::iterator itEnd,
+		std::list<OrdEventResponse>& responses);
+
+	AuctionResult uncrossBook(std::list<OrdEventResponse>& responses);
+
+	void crossAuction(PriceLevel& refBidLevel, PriceLevel::Entry& refBid, PriceLevel& refAskLevel, PriceLevel::Entry& refAsk,
+		const TPrice& px, std::list<OrdEventResponse>& responses);
+
+	void expireLevel(PriceLevel& refLevel, std::list<OrdEventResponse>& responses);
+
+	void parkStop(Order* pOrder, std::list<OrdEventResponse>& responses);
+
+	// Returns the number of stops injected
+	std::size_t triggerStops(std::list<OrdEventResponse>& responses);
+
+	bool removeFromBook(Order* pOrder);
+
+	void expireOrders(const TTimestamp& now, std::list<OrdEventResponse>& responses);
+
+	std::size_t snapshotOrderCount() const;
+
+	bool writeSnapshot(char* pData, std::size_t orderCount) const;
+
+	bool validateSnapshot(const char* pData, std::size_t size) const;
 
 
 	inline TExecId newExecId() { return ++globalExecId; }
 
 protected:
+	SystemClock		m_sysClock;
+	Clock*			m_pClock;
+	TimingWheel		m_expiryTimers;
+	TTimestamp		m_now;		// clock reading taken by the last onTimer
+	TTimestamp		m_endOfDay;
+	std::size_t		m_maxStopCascade;
+	TradingPhase	m_phase;
+	LevelAllocation	m_allocation;
+	std::vector<TQty>	m_allocScratch;	// per maker shares of a pro-rata fill
+	std::vector<Order*>	m_slicesFilled;	// icebergs filled by the level being swept, to requeue
+	AuctionDepth	m_auctionDepth;		// reused by every uncross
+	TTimestamp		m_batchIntervalNs;
+	TTimestamp		m_nextBatch;
+	std::vector<BatchEntry>	m_batch;	// arrival order, pOrder nullptr once cancelled
+	EventPublisher*	m_pPublisher;
+	CommandSink*	m_pSink;
+	BookListener*	m_pBookListener;
+	MemoryListener*	m_pMemoryListener;
+	TTimestamp		m_memoryIntervalNs;
+	TTimestamp		m_nextMemoryReport;
+	MemoryReport	m_memoryReport;		// reused by every periodic report
+	bool			m_isQuoting;	// a mass quote's events are being handled
+	std::uint64_t	m_seq;		// commands taken
+	std::uint64_t	m_updateSeq;	// book updates made
+	SnapshotJob		m_snapshotJob;
+	TradeStoreWriter	m_tradeStore;
+	TradingStatsRecorder	m_stats;
+	FlightRecorder	m_recorder;
 	OrdBook	m_ordBook;
-	ClientInfoMap	m_clientInfos;
+	std::deque<ClientInfo>	m_clients;			// indexed by TSessionId, a deque so that a ClientInfo& outlives registrations
+	std::vector<TSessionId>	m_sessionByClient;	// indexed by TClientId
 
 	static TExecId	globalExecId;
 };
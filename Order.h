@@ -1,6 +1,8 @@
 #pragma once
 
+#include "MemoryPool.h"
 #include "OrdEvent.h"
+#include "TimingWheel.h"
 
 #include <list>
 #include <string>
@@ -10,18 +12,26 @@
 class Order
 {
 public:
-	using OrdEventList = std::list< std::unique_ptr<OrdEvent> >;
+	using OrdEventList = std::list< std::unique_ptr<OrdEvent>, PoolAllocator< std::unique_ptr<OrdEvent>, MemCategory::HISTORY > >;
 	using ord_iterator = OrdEventList::iterator;
 	using const_ord_iterator = OrdEventList::const_iterator;
 
 public:
-	Order(const TClientId& clientId, OrdSide side, const TPrice& px, const TQty& qty) : 
-		m_clientId(clientId), m_ordId(0), m_side(side), m_px(px), m_qty(qty),
+	// A non-zero pxStop makes a stop (px 0) or stop-limit order, parked until
+	// the last trade price reaches pxStop
+	Order(const TClientId& clientId, OrdSide side, const TPrice& px, const TQty& qty,
+		OrdTif tif = OrdTif::GTC, const TTimestamp& expireTime = 0, const TPrice& pxStop = TPrice(0)) : 
+		m_clientId(clientId), m_sessionId(InvalidSessionId), m_ordId(0), m_side(side), m_px(px), m_qty(qty),
 		m_qtyOutstanding(TQty(0)), m_qtyCancelled(TQty(0)), m_qtyExec(TQty(0)),
-		m_state(OrdStateType::NONE)
+		m_state(OrdStateType::NONE), m_tif(tif), m_expireTime(expireTime), m_expiryTimer(this),
+		m_pxStop(pxStop), m_stopParked(false), m_batchQueued(false), m_conflateExecs(false), m_isQuote(false), m_isOpenCounted(false), m_qtyDisplay(0), m_levelPos(0)
 	{}
 
+	static void* operator new(std::size_t size) { return MemoryPool::instance().allocate(size, MemCategory::ORDER); }
+	static void operator delete(void* p, std::size_t size) { MemoryPool::instance().deallocate(p, size, MemCategory::ORDER); }
+
 	inline const TClientId& clientId() const { return m_clientId; }
+	inline const TSessionId& sessionId() const { return m_sessionId; }
 	inline const TOrdId& ordId() const { return m_ordId; }
 	inline OrdSide side() const { return m_side; }
 	inline const TPrice& px() const { return m_px; }
@@ -30,6 +40,87 @@ public:
 	inline const TQty& qtyCancelled() const { return m_qtyCancelled; }
 	inline const TQty& qtyExec() const { return m_qtyExec; }
 	inline OrdStateType state() const { return m_state; }
+	inline OrdTif tif() const { return m_tif; }
+	inline const TTimestamp& expireTime() const { return m_expireTime; }
+	inline TimerNode& expiryTimer() { return m_expiryTimer; }
+	inline const TPrice& pxStop() const { return m_pxStop; }
+	inline bool isStop() const { return m_pxStop > TPrice(0); }
+	inline bool isStopParked() const { return m_stopParked; }
+	inline bool isBatchQueued() const { return m_batchQueued; }
+	// Price open qty is valued at for exposure, 0 for market orders
+	inline const TPrice& pxExposure() const { return m_px > TPrice(0) ? m_px : m_pxStop; }
+
+	// When taking liquidity, fills against several makers at one price are
+	// reported in one ConflatedExecution per price
+	inline bool conflateExecs() const { return m_conflateExecs; }
+	inline void setConflateExecs(bool conflate) { m_conflateExecs = conflate; }
+
+	// Entered by a mass quote, which reports the order's own events in its ack
+	inline bool isQuote() const { return m_isQuote; }
+	inline void setQuote(bool isQuote) { m_isQuote = isQuote; }
+
+	// An iceberg shows at most qtyDisplay in the book, the engine queues the
+	// next slice behind its level each time the one shown is filled
+	inline bool isIceberg() const { return m_qtyDisplay != 0; }
+	inline const TQty& qtyDisplay() const { return m_qtyDisplay; }
+	inline void setDisplayQty(const TQty& qtyDisplay) { m_qtyDisplay = qtyDisplay; }
+	// Qty a slice queued now shows
+	inline const TQty& qtyToShow() const { return isIceberg() && m_qtyDisplay < m_qtyOutstanding ? m_qtyDisplay : m_qtyOutstanding; }
+
+	// Counted in its client's open orders by the engine
+	inline bool isOpenCounted() const { return m_isOpenCounted; }
+	inline void setOpenCounted(bool isCounted) { m_isOpenCounted = isCounted; }
+
+	inline const std::uint32_t& levelPos() const { return m_levelPos; }
+	inline void setLevelPos(std::uint32_t pos) { m_levelPos = pos; }
+
+	inline void parkStop() { assert(isStop()); m_stopParked = true; }
+	inline void unparkStop() { m_stopParked = false; }
+
+	inline void queueBatch(std::uint32_t pos) { m_batchQueued = true; m_levelPos = pos; }
+	inline void unqueueBatch() { m_batchQueued = false; }
+
+	// Brings back an open order read from a snapshot or bulk loaded, its history starts
+	// with the NEW event and no client is notified
+	inline void restore(const TSessionId& sessionId, const TOrdId& ordId, OrdStateType state,
+		const TQty& qtyOutstanding, const TQty& qtyExec, const TQty& qtyCancelled)
+	{
+		assert(m_ordEvents.empty());
+
+		m_ordEvents.emplace_back(std::make_unique<NewOrdEvent>(ordId, m_side, m_px, m_qty));
+		m_sessionId = sessionId;
+		m_ordId = ordId;
+		m_state = state;
+		m_qtyOutstanding = qtyOutstanding;
+		m_qtyExec = qtyExec;
+		m_qtyCancelled = qtyCancelled;
+	}
+
+	// Takes on what other looks like now, its history and expiry timer aside,
+	// e.g. for a copy handed to another thread along with an event
+	inline void copyState(const Order& other)
+	{
+		m_clientId = other.m_clientId;
+		m_sessionId = other.m_sessionId;
+		m_ordId = other.m_ordId;
+		m_side = other.m_side;
+		m_px = other.m_px;
+		m_qty = other.m_qty;
+		m_qtyOutstanding = other.m_qtyOutstanding;
+		m_qtyCancelled = other.m_qtyCancelled;
+		m_qtyExec = other.m_qtyExec;
+		m_state = other.m_state;
+		m_tif = other.m_tif;
+		m_expireTime = other.m_expireTime;
+		m_pxStop = other.m_pxStop;
+		m_stopParked = other.m_stopParked;
+		m_batchQueued = other.m_batchQueued;
+		m_conflateExecs = other.m_conflateExecs;
+		m_isQuote = other.m_isQuote;
+		m_isOpenCounted = other.m_isOpenCounted;
+		m_qtyDisplay = other.m_qtyDisplay;
+		m_levelPos = other.m_levelPos;
+	}
 
 	inline const NewOrdEvent* getNewOrd() const
 	{
@@ -38,23 +129,24 @@ public:
 		return dynamic_cast<const NewOrdEvent*>(m_ordEvents.front().get());
 	}
 
-	inline NewOrdEvent* addNew(const TOrdId& newOrdId) 
+	inline NewOrdEvent* addNew(const TSessionId& sessionId, const TOrdId& newOrdId) 
 	{
 		// Precondition
 		assert(m_ordEvents.empty());
 		assert(m_state == OrdStateType::NONE);
 
 		m_ordEvents.emplace_back(std::make_unique<NewOrdEvent>(newOrdId, m_side, m_px, m_qty));
+		m_sessionId = sessionId;
 		m_ordId = newOrdId;
 		m_state = OrdStateType::NEW;
 		return dynamic_cast<NewOrdEvent*>(m_ordEvents.back().get());
 	}
 
-	inline NewRejOrdEvent* addNewRej()
+	inline NewRejOrdEvent* addNewRej(OrdRejReason reason = OrdRejReason::NONE)
 	{
 		assert(m_state == OrdStateType::NEW);
 
-		m_ordEvents.emplace_back(std::make_unique<NewRejOrdEvent>(ordId()));
+		m_ordEvents.emplace_back(std::make_unique<NewRejOrdEvent>(ordId(), reason));
 		m_state = OrdStateType::REJECTED;
 		return dynamic_cast<NewRejOrdEvent*>(m_ordEvents.back().get());
 	}
@@ -77,13 +169,13 @@ public:
 		return dynamic_cast<CanOrdEvent*>(m_ordEvents.back().get());
 	}
 
-	inline CanRejOrdEvent* addCanRej()
+	inline CanRejOrdEvent* addCanRej(OrdRejReason reason)
 	{
-		m_ordEvents.emplace_back(std::make_unique<CanRejOrdEvent>());
+		m_ordEvents.emplace_back(std::make_unique<CanRejOrdEvent>(ordId(), reason));
 		return dynamic_cast<CanRejOrdEvent*>(m_ordEvents.back().get());
 	}
 
-	inline CanAckOrdEvent* addCanAck(const TQty& qtyCancelled)
+	inline CanAckOrdEvent* addCanAck(TQty qtyCancelled)
 	{
 		const NewOrdEvent* newOrd(getNewOrd());
 
@@ -91,27 +183,37 @@ public:
 		m_qtyOutstanding -= qtyCancelled;
 		m_qtyCancelled += qtyCancelled;
 		m_state = OrdStateType::CANCELLED;
+		m_expiryTimer.disarm();
 		return dynamic_cast<CanAckOrdEvent*>(m_ordEvents.back().get());
 	}
 
 	inline Execution* addExecution(const TExecId& execId, const TPrice& pxExec, const TQty& qtyExec)
 	{
 		m_ordEvents.emplace_back(std::make_unique<Execution>(execId,  pxExec, qtyExec));
-		m_qtyOutstanding -= qtyExec;
-		m_qtyExec += qtyExec;
-		if (m_qtyOutstanding == 0) {
-			if (m_state != OrdStateType::CANCELLED) {
-				m_state = OrdStateType::COMPLETED;
-			}
-		}
+		fill(qtyExec);
 		return dynamic_cast<Execution*>(m_ordEvents.back().get());
 	}
 
-	inline Expired* addExpired(const TQty& qtyCancelled)
+	// Starts an execution further fills at the same price are added to
+	inline ConflatedExecution* addConflatedExecution(const TExecId& execId, const TPrice& pxExec, const TQty& qtyExec)
+	{
+		m_ordEvents.emplace_back(std::make_unique<ConflatedExecution>(execId, pxExec, qtyExec));
+		fill(qtyExec);
+		return dynamic_cast<ConflatedExecution*>(m_ordEvents.back().get());
+	}
+
+	inline void addConflatedFill(ConflatedExecution* pExec, const TExecId& execId, const TQty& qtyExec)
+	{
+		pExec->addFill(execId, qtyExec);
+		fill(qtyExec);
+	}
+
+	inline Expired* addExpired(TQty qtyCancelled)
 	{
 		m_ordEvents.emplace_back(std::make_unique<Expired>(qtyCancelled));
 		m_qtyOutstanding -= qtyCancelled;
 		m_state = OrdStateType::EXPIRED;
+		m_expiryTimer.disarm();
 		return dynamic_cast<Expired*>(m_ordEvents.back().get());
 	}
 
@@ -123,6 +225,12 @@ public:
 	{
 		std::cout << " [" << m_clientId << ", " << m_ordId << ", " << m_px << ", " << m_qty << ", " << toString(m_state);
 		std::cout << ", " << m_qtyOutstanding << ", " << m_qtyExec << ", " << m_qtyCancelled;
+		if (isStop()) {
+			std::cout << ", STOP " << m_pxStop;
+		}
+		if (isIceberg()) {
+			std::cout << ", DISPLAY " << m_qtyDisplay;
+		}
 		if (dumpOrdEvents && !m_ordEvents.empty()) {
 			std::cout << " :";
 			for (auto& p : m_ordEvents) {
@@ -135,12 +243,37 @@ public:
 	}
 
 protected:
-	OrdEventList	m_ordEvents;
+	inline void fill(const TQty& qtyExec)
+	{
+		m_qtyOutstanding -= qtyExec;
+		m_qtyExec += qtyExec;
+		if (m_qtyOutstanding == 0) {
+			if (m_state != OrdStateType::CANCELLED) {
+				m_state = OrdStateType::COMPLETED;
+			}
+			m_expiryTimer.disarm();
+		}
+	}
+
+	// Fields read by matching and dispatch first, the event history last
 	TClientId		m_clientId;
+	TSessionId		m_sessionId;
 	TOrdId			m_ordId;
 	OrdSide			m_side;
 	TPrice			m_px;
 	TQty			m_qty;
 	TQty			m_qtyOutstanding, m_qtyCancelled, m_qtyExec;
 	OrdStateType	m_state;
+	OrdTif			m_tif;
+	TTimestamp		m_expireTime;
+	TimerNode		m_expiryTimer;	// armed while resting with a DAY/GTD deadline
+	TPrice			m_pxStop;
+	bool			m_stopParked;
+	bool			m_batchQueued;
+	bool			m_conflateExecs;
+	bool			m_isQuote;
+	bool			m_isOpenCounted;
+	TQty			m_qtyDisplay;	// 0 shows all
+	std::uint32_t	m_levelPos;		// index of the PriceLevel entry while resting, of the batch slot while queued
+	OrdEventList	m_ordEvents;
 };
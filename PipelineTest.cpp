@@ -0,0 +1,181 @@
+// PipelineTest.cpp : Runs the same commands through an OrdMEPipeline and
+// straight into an engine and checks the clients are told the same.
+//
+
+#include "OrdMEPipeline.h"
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Records every event with what the order looked like when told of it
+class RecordingClient : public OrdME::Callback
+{
+public:
+	inline const std::vector<std::string>& events() const { return m_events; }
+
+	void onNew(Order* order, NewOrdEvent* event) override { record(order, event); }
+	void onNewRej(Order* order, NewRejOrdEvent* event) override { record(order, event); }
+	void onNewAck(Order* order, NewAckOrdEvent* event) override { record(order, event); }
+	void onCan(Order* order, CanOrdEvent* event) override { record(order, event); }
+	void onCanRej(Order* order, CanRejOrdEvent* event) override
+	{
+		std::ostringstream os;
+
+		os << toString(event->eventType()) << " " << event->canOrdId() << " " << toString(event->reason());
+		if (order) {
+			os << " " << toString(order->state()) << " " << order->qtyOutstanding();
+		}
+		m_events.push_back(os.str());
+	}
+	void onCanAck(Order* order, CanAckOrdEvent* event) override { record(order, event); }
+	void onExec(Order* order, Execution* event) override
+	{
+		std::ostringstream os;
+
+		// Exec ids are process wide, the two engines do not share them
+		os << " " << event->pxExec() << " " << event->qtyExec();
+		record(order, event, os.str());
+	}
+	void onExpiry(Order* order, Expired* event) override { record(order, event); }
+
+protected:
+	void record(const Order* order, const OrdEvent* event, const std::string& detail = std::string())
+	{
+		std::ostringstream os;
+
+		os << toString(event->eventType()) << " " << order->clientId() << " " << order->ordId() << " " << toString(order->state())
+			<< " " << order->qtyOutstanding() << " " << order->qtyExec() << " " << order->qtyCancelled() << detail;
+		m_events.push_back(os.str());
+	}
+
+	std::vector<std::string>	m_events;
+};
+
+struct TestCommand
+{
+	bool		isCancel;
+	TClientId	clientId;
+	OrdSide		side;
+	TPrice		px;
+	TQty		qty;
+	TOrdId		ordId;
+	TQty		qtyDisplay;
+};
+
+// Deterministic mix of resting, crossing, iceberg and cancel commands,
+// cancels of unknown and finished orders included
+static std::vector<TestCommand> makeCommands(std::size_t count)
+{
+	std::vector<TestCommand> commands;
+	std::uint32_t state(12345);
+
+	auto next = [&state]() {
+		state = state * 1103515245 + 12345;
+		return (state >> 8) & 0xffff;
+	};
+	for (std::size_t i = 0; i < count; ++i) {
+		TestCommand cmd{ false, static_cast<TClientId>(next() % 2), next() % 2 ? OrdSide::BUY : OrdSide::SELL,
+			TPrice(static_cast<int>(95 + next() % 11)), static_cast<TQty>(1 + next() % 20), 0, 0 };
+
+		if (next() % 4 == 0) {
+			cmd.isCancel = true;
+			cmd.ordId = 1 + next() % static_cast<TOrdId>(i / 2 + 2);
+		}
+		else if (next() % 8 == 0) {
+			cmd.qtyDisplay = 1 + cmd.qty / 4;
+		}
+		commands.push_back(cmd);
+	}
+	return commands;
+}
+
+static bool check(bool isOk, const std::string& what)
+{
+	if (!isOk) {
+		std::cerr << "FAILED: " << what << std::endl;
+	}
+	return isOk;
+}
+
+int main()
+{
+	const std::vector<TestCommand> commands(makeCommands(20000));
+
+	// Straight into the engine
+	OrdME direct;
+	RecordingClient directClients[2];
+
+	for (TClientId clientId = 0; clientId < 2; ++clientId) {
+		direct.registerClient(clientId, &directClients[clientId]);
+	}
+	for (const TestCommand& cmd : commands) {
+		if (cmd.isCancel) {
+			direct.submitCanOrder(cmd.clientId, cmd.ordId);
+		}
+		else {
+			std::unique_ptr<Order> upOrd(std::make_unique<Order>(cmd.clientId, cmd.side, cmd.px, cmd.qty));
+
+			upOrd->setDisplayQty(cmd.qtyDisplay);
+			direct.submitNewOrder(std::move(upOrd));
+		}
+	}
+
+	// Through the pipeline, a small event ring so the matcher waits on the publisher
+	OrdME piped;
+	RecordingClient pipedClients[2];
+	std::ostringstream journal;
+
+	for (TClientId clientId = 0; clientId < 2; ++clientId) {
+		piped.registerClient(clientId, &pipedClients[clientId]);
+	}
+	{
+		OrdMEPipeline pipeline(piped, 1024, &journal);
+
+		pipeline.start();
+		for (const TestCommand& cmd : commands) {
+			if (cmd.isCancel) {
+				pipeline.submitCanOrder(cmd.clientId, cmd.ordId);
+			}
+			else {
+				pipeline.submitNewOrder(cmd.clientId, cmd.side, cmd.px, cmd.qty, OrdTif::GTC, 0, TPrice(0), cmd.qtyDisplay);
+			}
+		}
+		// Dropped by the decode stage
+		pipeline.submitCanOrder(7, 1);
+		pipeline.stop();
+
+		if (!check(pipeline.dropped() == 1, "unknown client dropped")) return 1;
+	}
+
+	bool isOk(true);
+
+	for (TClientId clientId = 0; clientId < 2; ++clientId) {
+		const std::vector<std::string>& expected(directClients[clientId].events());
+		const std::vector<std::string>& actual(pipedClients[clientId].events());
+
+		isOk &= check(!expected.empty(), "client " + std::to_string(clientId) + " has events");
+		isOk &= check(expected.size() == actual.size(), "client " + std::to_string(clientId) + " event count "
+			+ std::to_string(expected.size()) + " vs " + std::to_string(actual.size()));
+		for (std::size_t i = 0; isOk && i < expected.size(); ++i) {
+			isOk &= check(expected[i] == actual[i], "client " + std::to_string(clientId) + " event " + std::to_string(i)
+				+ ": " + expected[i] + " vs " + actual[i]);
+		}
+	}
+	isOk &= check(direct.bookChecksum() == piped.bookChecksum(), "book checksum");
+
+	std::size_t journalLines(0);
+	std::string line;
+	std::istringstream journalIn(journal.str());
+
+	while (std::getline(journalIn, line)) {
+		++journalLines;
+	}
+	isOk &= check(journalLines == commands.size(), "journal lines " + std::to_string(journalLines));
+
+	if (!isOk) return 1;
+
+	std::cout << "PipelineTest passed, " << directClients[0].events().size() + directClients[1].events().size() << " events" << std::endl;
+	return 0;
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "MemoryPool.h"
+
+#include <cstddef>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#endif
+
+// Where the matching thread runs and where its memory comes from
+struct PlacementConfig
+{
+	int			cpu;			// core the matching thread is pinned to, -1 leaves it to the OS
+	bool		lockMemory;		// keep the process's pages, or at least the pool's, in RAM
+	std::size_t	poolBytes;		// MemoryPool for orders, events and levels, 0 keeps operator new
+	bool		hugePages;		// back the pool with 2M pages if available
+	bool		prefault;		// touch the whole pool up front
+
+	PlacementConfig() : cpu(-1), lockMemory(false), poolBytes(0), hugePages(true), prefault(true) {}
+};
+
+// What applyPlacement managed to do, anything else was left as it was
+struct PlacementResult
+{
+	bool	pinned;
+	bool	pooled;
+	bool	hugePages;
+	bool	lockedAll;		// every current and future page of the process
+	bool	lockedPool;		// only the pool, when locking everything was refused
+
+	PlacementResult() : pinned(false), pooled(false), hugePages(false), lockedAll(false), lockedPool(false) {}
+};
+
+// Pins the calling thread to cpu, returns false where affinity is not supported
+inline bool pinThread(int cpu)
+{
+	if (cpu < 0) return false;
+
+#ifdef _WIN32
+	if (cpu >= static_cast<int>(sizeof(DWORD_PTR) * 8)) return false;
+	return SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << cpu) != 0;
+#elif defined(__linux__)
+	cpu_set_t cpus;
+
+	CPU_ZERO(&cpus);
+	CPU_SET(cpu, &cpus);
+	return pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) == 0;
+#else
+	return false;
+#endif
+}
+
+// Applies config from the thread that is going to match, before the open and
+// before other threads allocate. The pool is reserved before memory is
+// locked so it is locked too. Locking all memory is only attempted without
+// a locked memory limit, as with one future allocations would start failing.
+inline PlacementResult applyPlacement(const PlacementConfig& config)
+{
+	PlacementResult result;
+	MemoryPool& refPool(MemoryPool::instance());
+
+	result.pinned = pinThread(config.cpu);
+
+	if (config.poolBytes > 0 && (refPool.isReserved() || refPool.reserve(config.poolBytes, config.hugePages))) {
+		result.pooled = true;
+		result.hugePages = refPool.isHugePageBacked();
+		if (config.prefault) {
+			refPool.prefault();
+		}
+	}
+
+	if (config.lockMemory) {
+#ifndef _WIN32
+		struct rlimit limit;
+
+		if (::getrlimit(RLIMIT_MEMLOCK, &limit) == 0 && limit.rlim_cur == RLIM_INFINITY) {
+			result.lockedAll = ::mlockall(MCL_CURRENT | MCL_FUTURE) == 0;
+		}
+#endif
+		if (!result.lockedAll && result.pooled) {
+			result.lockedPool = refPool.lock();
+		}
+	}
+	return result;
+}
@@ -0,0 +1,388 @@
+#pragma once
+
+#include "Clock.h"
+#include "MappedFile.h"
+#include "OrdCommand.h"
+#include "OrdMatchingEngine.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Command stream layout, a file meant for shared memory (/dev/shm): a
+// ReplicaRingHeader then a power of 2 count of ReplicaSlots, the command at
+// stream position seq going to slot seq % capacity. Each slot is a seqlock:
+// its stamp is cleared while the primary writes the payload and set to
+// seq + 1 once the payload is whole, so the standby can tell the command it
+// waits for from one that lapped it.
+static constexpr char ReplicaMagic[8] = { 'O', 'R', 'D', 'M', 'E', 'R', 'P', 'L' };
+static constexpr std::uint32_t ReplicaVersion = 2;
+
+struct ReplicaRingHeader
+{
+	char						magic[8];
+	std::uint32_t				version;
+	std::uint32_t				slotSize;
+	std::uint64_t				capacity;
+	std::uint8_t				reserved[40];
+	std::atomic<std::uint64_t>	published;		// commands written, on its own cache line
+	std::uint8_t				pad1[56];
+	std::atomic<std::uint64_t>	consumed;		// commands the standby is done with
+	std::uint8_t				pad2[56];
+};
+
+// The payload is packed into words both sides access atomically
+struct ReplicaSlot
+{
+	std::atomic<std::uint64_t>	stamp;
+	std::atomic<std::uint64_t>	words[7];
+};
+
+static_assert(sizeof(ReplicaRingHeader) == 192, "ReplicaRingHeader layout");
+static_assert(sizeof(ReplicaSlot) == 64, "ReplicaSlot layout");
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "ring positions must be lock free to be shared between processes");
+
+inline std::size_t replicaRingSize(std::size_t capacity)
+{
+	return sizeof(ReplicaRingHeader) + capacity * sizeof(ReplicaSlot);
+}
+
+// One command of the stream as the primary ran it
+struct ReplicaEntry
+{
+	std::uint64_t	seq;
+	TTimestamp		ts;
+	std::uint64_t	checksum;		// primary's book checksum after the command
+	OrdCommand		cmd;
+};
+
+enum class ReplicaLagPolicy {
+	BLOCK,		// the primary waits for the standby to free a slot, up to a time limit
+	OVERWRITE	// the primary never waits, a standby lapped stops at the gap
+};
+
+// Primary side: writes every command its engine passes on into the ring.
+// Runs on the engine thread.
+class ReplicaWriter : public OrdME::CommandSink
+{
+public:
+	static constexpr std::size_t DefaultCapacity = std::size_t(1) << 16;
+	static constexpr TTimestamp DefaultMaxWaitNs = 10000000;	// 10ms
+
+	ReplicaWriter() :
+		m_pHeader(nullptr), m_pSlots(nullptr), m_mask(0), m_published(0),
+		m_policy(ReplicaLagPolicy::BLOCK), m_maxWaitNs(DefaultMaxWaitNs), m_isDetached(false)
+	{}
+	ReplicaWriter(const ReplicaWriter&) = delete;
+	ReplicaWriter& operator=(const ReplicaWriter&) = delete;
+
+	// Creates, or starts afresh, the ring at path holding capacity commands,
+	// rounded up to a power of 2. With BLOCK, a standby still lagging a whole
+	// ring behind after maxWaitNs (0 waits for ever) is given up on, the
+	// primary carrying on as with OVERWRITE.
+	bool create(const std::string& path, std::size_t capacity = DefaultCapacity,
+		ReplicaLagPolicy policy = ReplicaLagPolicy::BLOCK, TTimestamp maxWaitNs = DefaultMaxWaitNs)
+	{
+		std::size_t slots(1);
+
+		while (slots < capacity) {
+			slots <<= 1;
+		}
+		close();
+		if (!m_file.create(path.c_str(), replicaRingSize(slots))) return false;
+
+		m_pHeader = reinterpret_cast<ReplicaRingHeader*>(m_file.data());
+		m_pSlots = reinterpret_cast<ReplicaSlot*>(m_file.data() + sizeof(ReplicaRingHeader));
+		std::memcpy(m_pHeader->magic, ReplicaMagic, sizeof(m_pHeader->magic));
+		m_pHeader->version = ReplicaVersion;
+		m_pHeader->slotSize = sizeof(ReplicaSlot);
+		m_pHeader->capacity = slots;
+		m_pHeader->published.store(0, std::memory_order_release);
+		m_pHeader->consumed.store(0, std::memory_order_release);
+		m_mask = slots - 1;
+		m_published = 0;
+		m_policy = policy;
+		m_maxWaitNs = maxWaitNs;
+		m_isDetached = false;
+		return true;
+	}
+
+	void close()
+	{
+		m_file.close();
+		m_pHeader = nullptr;
+		m_pSlots = nullptr;
+	}
+
+	inline bool isOpen() const { return m_pHeader != nullptr; }
+	inline std::uint64_t published() const { return m_published; }
+	// Set once BLOCK gave up waiting on the standby
+	inline bool isDetached() const { return m_isDetached; }
+
+	void onCommand(const OrdCommand& cmd, const TTimestamp& ts, std::uint64_t checksum) override
+	{
+		if (!m_pHeader) return;
+
+		if (m_policy == ReplicaLagPolicy::BLOCK && !m_isDetached && m_published - m_pHeader->consumed.load(std::memory_order_acquire) > m_mask) {
+			waitForStandby();
+		}
+
+		ReplicaSlot& refSlot(m_pSlots[m_published & m_mask]);
+
+		refSlot.stamp.store(0, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		refSlot.words[0].store(ts, std::memory_order_relaxed);
+		refSlot.words[1].store(checksum, std::memory_order_relaxed);
+		refSlot.words[2].store(static_cast<std::uint64_t>(cmd.px.rawValue()), std::memory_order_relaxed);
+		refSlot.words[3].store(static_cast<std::uint64_t>(cmd.pxStop.rawValue()), std::memory_order_relaxed);
+		refSlot.words[4].store(cmd.expireTime, std::memory_order_relaxed);
+		// A CANCEL's ord id and an order's display qty share the low half
+		refSlot.words[5].store(static_cast<std::uint64_t>(static_cast<std::uint32_t>(cmd.clientId)) << 32 |
+			(cmd.type == OrdCommandType::CANCEL ? cmd.ordId : cmd.qtyDisplay), std::memory_order_relaxed);
+		refSlot.words[6].store(static_cast<std::uint64_t>(cmd.qty) << 32 | static_cast<std::uint64_t>(cmd.type) << 24 |
+			static_cast<std::uint64_t>(cmd.side) << 16 | static_cast<std::uint64_t>(cmd.tif) << 8 | (cmd.conflateExecs ? 1 : 0),
+			std::memory_order_relaxed);
+		refSlot.stamp.store(++m_published, std::memory_order_release);
+		m_pHeader->published.store(m_published, std::memory_order_release);
+	}
+
+protected:
+	void waitForStandby()
+	{
+		auto deadline(std::chrono::steady_clock::now() + std::chrono::nanoseconds(m_maxWaitNs));
+		unsigned spins(0);
+
+		while (m_published - m_pHeader->consumed.load(std::memory_order_acquire) > m_mask) {
+			if (++spins < 1024) continue;
+
+			spins = 0;
+			if (m_maxWaitNs != 0 && std::chrono::steady_clock::now() >= deadline) {
+				m_isDetached = true;
+				return;
+			}
+			std::this_thread::yield();
+		}
+	}
+
+	MappedFile			m_file;
+	ReplicaRingHeader*	m_pHeader;
+	ReplicaSlot*		m_pSlots;
+	std::uint64_t		m_mask;
+	std::uint64_t		m_published;
+	ReplicaLagPolicy	m_policy;
+	TTimestamp			m_maxWaitNs;
+	bool				m_isDetached;
+};
+
+// Standby side: applies the primary's commands, in sequence and at the
+// primary's clock readings, to an engine of its own, set up like the
+// primary's (clients, risk limits, end of day, allocation...) and built on
+// the ReplayClock given. Clients are best registered without callbacks and
+// given theirs once promoted. Both engines must start from the same state,
+// e.g. empty, before the primary's first command. Execution ids being
+// numbered process wide, the standby runs in a process of its own, and a
+// ring has a single standby. Runs on one thread, calling poll() in a loop.
+class OrdMEStandby
+{
+public:
+	enum class Status {
+		FOLLOWING,
+		GAP,		// lapped by the primary, commands were lost
+		DIVERGED,	// book checksum differs from the primary's after a command
+		PROMOTED
+	};
+
+	OrdMEStandby(OrdME& me, ReplayClock& clock) :
+		m_me(me), m_clock(clock), m_pHeader(nullptr), m_pSlots(nullptr), m_mask(0), m_next(0), m_status(Status::FOLLOWING)
+	{}
+	OrdMEStandby(const OrdMEStandby&) = delete;
+	OrdMEStandby& operator=(const OrdMEStandby&) = delete;
+
+	// Attaches to the ring the primary created, following it from its first command
+	bool open(const std::string& path)
+	{
+		m_pHeader = nullptr;
+		if (!m_file.openShared(path.c_str()) || m_file.size() < sizeof(ReplicaRingHeader)) return false;
+
+		ReplicaRingHeader* pHeader = reinterpret_cast<ReplicaRingHeader*>(m_file.data());
+
+		if (std::memcmp(pHeader->magic, ReplicaMagic, sizeof(pHeader->magic)) != 0 || pHeader->version != ReplicaVersion ||
+			pHeader->slotSize != sizeof(ReplicaSlot) || pHeader->capacity == 0 || (pHeader->capacity & (pHeader->capacity - 1)) != 0 ||
+			m_file.size() < replicaRingSize(static_cast<std::size_t>(pHeader->capacity))) {
+			m_file.close();
+			return false;
+		}
+		m_pHeader = pHeader;
+		m_pSlots = reinterpret_cast<ReplicaSlot*>(m_file.data() + sizeof(ReplicaRingHeader));
+		m_mask = pHeader->capacity - 1;
+		m_next = 0;
+		m_status = Status::FOLLOWING;
+		m_pHeader->consumed.store(0, std::memory_order_release);
+		return true;
+	}
+
+	inline Status status() const { return m_status; }
+	// Commands applied so far, the stream position of the next one
+	inline std::uint64_t applied() const { return m_next; }
+	// Commands published by the primary not applied yet
+	inline std::uint64_t lag() const { return m_pHeader ? m_pHeader->published.load(std::memory_order_acquire) - m_next : 0; }
+
+	// Applies up to maxCommands commands published since the last call,
+	// returns how many. Stops for good at a gap or a divergence.
+	std::size_t poll(std::size_t maxCommands = 256)
+	{
+		std::size_t count(0);
+		ReplicaEntry entry;
+
+		while (count < maxCommands && m_status == Status::FOLLOWING && read(entry)) {
+			apply(entry);
+			++m_next;
+			++count;
+		}
+		if (count != 0) {
+			m_pHeader->consumed.store(m_next, std::memory_order_release);
+		}
+		return count;
+	}
+
+	// Applies whatever the primary published before it went away and turns
+	// the engine into a primary, its clock now following the system clock.
+	// The primary must have stopped writing. Fails, changing nothing, if the
+	// standby lost track of the primary.
+	bool promote()
+	{
+		if (m_status != Status::FOLLOWING || !m_pHeader) return false;
+
+		while (poll() != 0) {}
+		if (m_status != Status::FOLLOWING) return false;
+
+		m_clock.goLive();
+		m_status = Status::PROMOTED;
+		m_pHeader = nullptr;
+		m_file.close();
+		return true;
+	}
+
+protected:
+	bool read(ReplicaEntry& refEntry)
+	{
+		std::uint64_t published(m_pHeader->published.load(std::memory_order_acquire));
+
+		if (published <= m_next) return false;
+
+		ReplicaSlot& refSlot(m_pSlots[m_next & m_mask]);
+		std::uint64_t stamp(m_next + 1);
+
+		// Published means the slot was whole, any other stamp means it has been written over since
+		if (published - m_next > m_mask + 1 || refSlot.stamp.load(std::memory_order_acquire) != stamp) {
+			m_status = Status::GAP;
+			return false;
+		}
+
+		std::uint64_t words[7];
+
+		for (std::size_t i = 0; i < 7; ++i) {
+			words[i] = refSlot.words[i].load(std::memory_order_relaxed);
+		}
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (refSlot.stamp.load(std::memory_order_relaxed) != stamp) {
+			m_status = Status::GAP;
+			return false;
+		}
+
+		OrdCommand& refCmd(refEntry.cmd);
+
+		refEntry.seq = m_next;
+		refEntry.ts = words[0];
+		refEntry.checksum = words[1];
+		refCmd.px = TPrice(TPrice::RawValue{ static_cast<std::int64_t>(words[2]) });
+		refCmd.pxStop = TPrice(TPrice::RawValue{ static_cast<std::int64_t>(words[3]) });
+		refCmd.expireTime = words[4];
+		refCmd.clientId = static_cast<TClientId>(static_cast<std::int32_t>(words[5] >> 32));
+		refCmd.qty = static_cast<TQty>(words[6] >> 32);
+		refCmd.type = static_cast<OrdCommandType>((words[6] >> 24) & 0xff);
+		refCmd.side = static_cast<OrdSide>((words[6] >> 16) & 0xff);
+		refCmd.tif = static_cast<OrdTif>((words[6] >> 8) & 0xff);
+		refCmd.ordId = refCmd.type == OrdCommandType::CANCEL ? static_cast<TOrdId>(words[5]) : 0;
+		refCmd.qtyDisplay = refCmd.type == OrdCommandType::CANCEL ? 0 : static_cast<TQty>(words[5]);
+		refCmd.conflateExecs = (words[6] & 1) != 0;
+		return true;
+	}
+
+	std::unique_ptr<Order> makeOrder(const OrdCommand& refCmd) const
+	{
+		std::unique_ptr<Order> upOrd(std::make_unique<Order>(refCmd.clientId, refCmd.side, refCmd.px, refCmd.qty,
+			refCmd.tif, refCmd.expireTime, refCmd.pxStop));
+
+		upOrd->setConflateExecs(refCmd.conflateExecs);
+		upOrd->setDisplayQty(refCmd.qtyDisplay);
+		return upOrd;
+	}
+
+	void apply(const ReplicaEntry& refEntry)
+	{
+		const OrdCommand& refCmd(refEntry.cmd);
+
+		if (refCmd.type == OrdCommandType::BULK_ORDER) {
+			m_bulk.push_back(makeOrder(refCmd));
+			return;
+		}
+		if (refCmd.type == OrdCommandType::QUOTE_LEVEL) {
+			(refCmd.side == OrdSide::BUY ? m_quoteBids : m_quoteAsks).push_back(QuoteLevel{ refCmd.px, refCmd.qty });
+			return;
+		}
+
+		m_clock.set(refEntry.ts);
+		switch (refCmd.type) {
+		case OrdCommandType::NEW:
+			m_me.submitNewOrder(makeOrder(refCmd));
+			break;
+		case OrdCommandType::CANCEL:
+			m_me.submitCanOrder(refCmd.clientId, refCmd.ordId);
+			break;
+		case OrdCommandType::TIMER:
+			m_me.onTimer();
+			break;
+		case OrdCommandType::UNCROSS:
+			m_me.uncross();
+			break;
+		case OrdCommandType::CALL_AUCTION:
+			m_me.beginCallAuction();
+			break;
+		case OrdCommandType::BATCH_AUCTION:
+			m_me.beginBatchAuction(refCmd.expireTime);
+			break;
+		case OrdCommandType::BULK_LOAD:
+			m_me.bulkLoad(m_bulk);
+			m_bulk.clear();
+			break;
+		case OrdCommandType::MASS_QUOTE:
+			m_me.submitMassQuote(refCmd.clientId, m_quoteBids.data(), m_quoteBids.size(), m_quoteAsks.data(), m_quoteAsks.size());
+			m_quoteBids.clear();
+			m_quoteAsks.clear();
+			break;
+		default:
+			break;
+		}
+		if (m_me.bookChecksum() != refEntry.checksum) {
+			m_status = Status::DIVERGED;
+		}
+	}
+
+	OrdME&								m_me;
+	ReplayClock&						m_clock;
+	MappedFile							m_file;
+	ReplicaRingHeader*					m_pHeader;
+	ReplicaSlot*						m_pSlots;
+	std::uint64_t						m_mask;
+	std::uint64_t						m_next;
+	Status								m_status;
+	std::vector<std::unique_ptr<Order>>	m_bulk;		// BULK_ORDERs waiting for their BULK_LOAD
+	std::vector<QuoteLevel>				m_quoteBids;	// QUOTE_LEVELs waiting for their MASS_QUOTE
+	std::vector<QuoteLevel>				m_quoteAsks;
+};
@@ -0,0 +1,159 @@
+// ReplicationTest.cpp : Runs a primary and a standby through one replica
+// ring and checks they end with the same orders and book.
+//
+
+#include "Replication.h"
+
+#include <cstdio>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Keeps the latest state of every order it is told of, and the mass quote acks
+class StateClient : public OrdME::Callback
+{
+public:
+	using TOrders = std::map<std::pair<TClientId, TOrdId>, std::string>;
+
+	inline const TOrders& orders() const { return m_orders; }
+	inline const std::vector<std::string>& quoteAcks() const { return m_quoteAcks; }
+
+	void onNew(Order* order, NewOrdEvent*) override { update(order); }
+	void onNewRej(Order* order, NewRejOrdEvent*) override { update(order); }
+	void onNewAck(Order* order, NewAckOrdEvent*) override { update(order); }
+	void onCan(Order* order, CanOrdEvent*) override { update(order); }
+	void onCanRej(Order* order, CanRejOrdEvent*) override { update(order); }
+	void onCanAck(Order* order, CanAckOrdEvent*) override { update(order); }
+	void onExec(Order* order, Execution*) override { update(order); }
+	void onExpiry(Order* order, Expired*) override { update(order); }
+
+	void onMassQuoteAck(const MassQuoteAck& ack) override
+	{
+		std::ostringstream os;
+
+		os << ack.clientId << " " << toString(ack.reason) << " " << ack.kept << " " << ack.added << " " << ack.cancelled
+			<< " " << ack.rejected;
+		m_quoteAcks.push_back(os.str());
+	}
+
+protected:
+	void update(const Order* order)
+	{
+		if (!order) return;
+
+		std::ostringstream os;
+
+		os << toString(order->state()) << " " << order->qtyOutstanding() << " " << order->qtyExec() << " " << order->qtyCancelled();
+		m_orders[std::make_pair(order->clientId(), order->ordId())] = os.str();
+	}
+
+	TOrders						m_orders;
+	std::vector<std::string>	m_quoteAcks;
+};
+
+static bool check(bool isOk, const std::string& what)
+{
+	if (!isOk) {
+		std::cerr << "FAILED: " << what << std::endl;
+	}
+	return isOk;
+}
+
+int main()
+{
+	static const char* path = "ReplicationTest.rpl";
+	const TClientId clientCount(3);
+
+	ManualClock clock(1000000000ULL);
+	OrdME primary(&clock);
+	ReplicaWriter writer;
+	StateClient primaryClients[clientCount];
+
+	if (!check(writer.create(path, 1024), "ring created")) return 1;
+
+	ReplayClock replayClock;
+	OrdME standby(&replayClock);
+	OrdMEStandby follower(standby, replayClock);
+	StateClient standbyClients[clientCount];
+
+	for (TClientId clientId = 0; clientId < clientCount; ++clientId) {
+		primary.registerClient(clientId, &primaryClients[clientId]);
+		standby.registerClient(clientId, &standbyClients[clientId]);
+	}
+	if (!check(follower.open(path), "ring opened")) return 1;
+	primary.setCommandSink(&writer);
+
+	// Deterministic mix of limit, iceberg, cancel and mass quote commands,
+	// the standby catching up after each one
+	std::vector<TOrdId> ordIds(clientCount, 0);
+	std::uint32_t state(4242);
+	auto next = [&state]() {
+		state = state * 1103515245 + 12345;
+		return (state >> 8) & 0xffff;
+	};
+
+	for (int i = 0; i < 20000; ++i) {
+		TClientId clientId(static_cast<TClientId>(next() % clientCount));
+		std::uint32_t op(next() % 20);
+
+		clock.advance(1000 + next() % 1000);
+		if (op < 10) {
+			std::unique_ptr<Order> upOrd(std::make_unique<Order>(clientId, next() % 2 ? OrdSide::BUY : OrdSide::SELL,
+				TPrice(static_cast<int>(95 + next() % 11)), static_cast<TQty>(1 + next() % 40)));
+
+			if (op < 3) {
+				upOrd->setDisplayQty(1 + upOrd->qty() / 5);
+			}
+			if (primary.submitNewOrder(std::move(upOrd)) == OrdRejReason::NONE) {
+				++ordIds[clientId];
+			}
+		}
+		else if (op < 17) {
+			if (ordIds[clientId] != 0) {
+				primary.submitCanOrder(clientId, 1 + next() % ordIds[clientId]);
+			}
+		}
+		else {
+			int mid(static_cast<int>(97 + next() % 7));
+			QuoteLevel bids[2] = { { TPrice(mid - 1), static_cast<TQty>(5 + next() % 10) }, { TPrice(mid - 2), 10 } };
+			QuoteLevel asks[2] = { { TPrice(mid + 1), static_cast<TQty>(5 + next() % 10) }, { TPrice(mid + 2), 10 } };
+
+			primary.submitMassQuote(clientId, bids, 2, asks, 2);
+		}
+		follower.poll();
+		if (!check(follower.status() == OrdMEStandby::Status::FOLLOWING, "standby following at command " + std::to_string(i))) {
+			return 1;
+		}
+	}
+	while (follower.poll() != 0) {}
+	primary.setCommandSink(nullptr);
+	writer.close();
+	std::remove(path);
+
+	bool isOk(true);
+
+	isOk &= check(follower.status() == OrdMEStandby::Status::FOLLOWING, "standby following");
+	isOk &= check(!writer.isDetached(), "standby kept up");
+	isOk &= check(follower.applied() == writer.published(), "standby applied " + std::to_string(follower.applied())
+		+ " of " + std::to_string(writer.published()));
+	isOk &= check(standby.commandSeq() == primary.commandSeq(), "command seq");
+	isOk &= check(standby.bookChecksum() == primary.bookChecksum(), "book checksum");
+	isOk &= check(standby.ordBook().orderCount() == primary.ordBook().orderCount(), "resting orders");
+	for (TClientId clientId = 0; clientId < clientCount; ++clientId) {
+		const StateClient::TOrders& expected(primaryClients[clientId].orders());
+		const StateClient::TOrders& actual(standbyClients[clientId].orders());
+
+		isOk &= check(!expected.empty(), "client " + std::to_string(clientId) + " has orders");
+		isOk &= check(expected == actual, "client " + std::to_string(clientId) + " order states");
+		isOk &= check(primaryClients[clientId].quoteAcks() == standbyClients[clientId].quoteAcks(),
+			"client " + std::to_string(clientId) + " mass quote acks");
+	}
+
+	if (!isOk) return 1;
+
+	std::cout << "ReplicationTest passed, " << writer.published() << " commands" << std::endl;
+	return 0;
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <thread>
+#include <vector>
+
+// Published position of one pipeline stage, padded to its own cache line so
+// stages spinning on each other do not false share.
+class Sequence
+{
+public:
+	static constexpr std::int64_t Initial = -1;
+
+	Sequence(std::int64_t value = Initial) : m_value(value) {}
+	Sequence(const Sequence&) = delete;
+	Sequence& operator=(const Sequence&) = delete;
+
+	inline std::int64_t get() const { return m_value.load(std::memory_order_acquire); }
+	inline void set(std::int64_t value) { m_value.store(value, std::memory_order_release); }
+
+protected:
+	char						m_padBefore[64];
+	std::atomic<std::int64_t>	m_value;
+	char						m_padAfter[64 - sizeof(std::atomic<std::int64_t>)];
+};
+
+// Waits until every dependent sequence has reached seq, returns the lowest
+// of them so a consumer can take the whole available batch at once
+class SequenceBarrier
+{
+public:
+	SequenceBarrier(std::vector<const Sequence*> dependents) : m_dependents(std::move(dependents)) {}
+
+	inline std::int64_t available() const
+	{
+		std::int64_t minSeq(std::numeric_limits<std::int64_t>::max());
+
+		for (const Sequence* pSeq : m_dependents) {
+			std::int64_t seq(pSeq->get());
+
+			if (seq < minSeq) minSeq = seq;
+		}
+		return minSeq;
+	}
+
+	// Gives up once stop returns true and nothing reached seq
+	template <typename Stop>
+	inline std::int64_t waitFor(std::int64_t seq, Stop&& stop) const
+	{
+		unsigned spins(0);
+
+		for (;;) {
+			std::int64_t avail(available());
+
+			if (avail >= seq || stop()) return avail;
+			if (++spins > SpinsBeforeYield) {
+				std::this_thread::yield();
+			}
+		}
+	}
+
+protected:
+	static constexpr unsigned SpinsBeforeYield = 1000;
+
+	std::vector<const Sequence*>	m_dependents;
+};
+
+// Pre-allocated ring of slots shared by a single producer and any number of
+// consumers, each tracking its own Sequence. The producer claims a slot only
+// once every gating consumer has moved past the previous lap.
+template <typename T>
+class RingBuffer
+{
+public:
+	explicit RingBuffer(std::size_t capacity) :
+		m_mask(capacity - 1), m_slots(capacity), m_gating({}), m_claimed(Sequence::Initial)
+	{
+		assert(capacity > 0 && (capacity & (capacity - 1)) == 0);
+	}
+	RingBuffer(const RingBuffer&) = delete;
+	RingBuffer& operator=(const RingBuffer&) = delete;
+
+	inline std::size_t capacity() const { return m_slots.size(); }
+	inline const Sequence& cursor() const { return m_cursor; }
+
+	inline T& operator[](std::int64_t seq) { return m_slots[static_cast<std::size_t>(seq) & m_mask]; }
+	inline const T& operator[](std::int64_t seq) const { return m_slots[static_cast<std::size_t>(seq) & m_mask]; }
+
+	// Consumers whose progress bounds the producer, set before any claim
+	inline void setGating(std::vector<const Sequence*> gating) { m_gating = SequenceBarrier(std::move(gating)); }
+
+	inline std::int64_t claim()
+	{
+		std::int64_t seq(++m_claimed);
+
+		m_gating.waitFor(seq - static_cast<std::int64_t>(capacity()), []() { return false; });
+		return seq;
+	}
+
+	inline void publish(std::int64_t seq) { m_cursor.set(seq); }
+
+protected:
+	std::size_t			m_mask;
+	std::vector<T>		m_slots;
+	Sequence			m_cursor;
+	SequenceBarrier		m_gating;
+	std::int64_t		m_claimed;	// producer only
+};
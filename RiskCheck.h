@@ -0,0 +1,93 @@
+#pragma once
+
+#include "Defn.h"
+#include "Order.h"
+
+#include <cstdint>
+
+// Per-client pre-trade limits, 0 disables a limit
+struct RiskLimits
+{
+	TQty			maxOrdQty;
+	TNotional		maxNotional;		// per order
+	std::uint32_t	priceBandBps;		// around the reference price
+	TNotional		maxGrossExposure;	// open buy + open sell
+	TNotional		maxNetExposure;		// |open buy - open sell|
+
+	RiskLimits() :
+		maxOrdQty(0), maxNotional(0), priceBandBps(0), maxGrossExposure(0), maxNetExposure(0)
+	{}
+};
+
+// Open notional per side, valued at Order::pxExposure(). Added on ack and
+// released on fill, cancel and expiry so the counters track open orders.
+class RiskExposure
+{
+public:
+	RiskExposure() : m_buy(0), m_sell(0) {}
+
+	inline const TNotional& buy() const { return m_buy; }
+	inline const TNotional& sell() const { return m_sell; }
+	inline TNotional gross() const { return m_buy + m_sell; }
+	inline TNotional net() const { return m_buy - m_sell; }
+
+	inline void onOpen(const Order* pOrd, const TQty& qty)
+	{
+		side(pOrd->side()) += notional(pOrd->pxExposure(), qty);
+	}
+
+	inline void onRelease(const Order* pOrd, const TQty& qty)
+	{
+		side(pOrd->side()) -= notional(pOrd->pxExposure(), qty);
+	}
+
+	inline static TNotional notional(const TPrice& px, const TQty& qty)
+	{
+		return px.rawValue() * static_cast<TNotional>(qty);
+	}
+
+protected:
+	inline TNotional& side(OrdSide side) { return side == OrdSide::BUY ? m_buy : m_sell; }
+
+	TNotional	m_buy;
+	TNotional	m_sell;
+};
+
+// O(1) check of a new order against the client limits and current exposure.
+// Market orders are valued at pxRef and skip the price band.
+inline OrdRejReason checkNewOrder(const RiskLimits& limits, const RiskExposure& exposure,
+	const Order* pOrd, const TPrice& pxRef)
+{
+	if (limits.maxOrdQty != 0 && pOrd->qty() > limits.maxOrdQty) {
+		return OrdRejReason::MAX_ORDER_QTY;
+	}
+
+	const TPrice& pxOrd(pOrd->pxExposure());
+	TNotional notional(RiskExposure::notional(pxOrd > TPrice(0) ? pxOrd : pxRef, pOrd->qty()));
+
+	if (limits.maxNotional != 0 && notional > limits.maxNotional) {
+		return OrdRejReason::MAX_NOTIONAL;
+	}
+
+	if (limits.priceBandBps != 0 && pxOrd > TPrice(0) && pxRef > TPrice(0)) {
+		std::int64_t diff(pxOrd.rawValue() - pxRef.rawValue());
+
+		if ((diff < 0 ? -diff : diff) * 10000 > pxRef.rawValue() * static_cast<std::int64_t>(limits.priceBandBps)) {
+			return OrdRejReason::PRICE_BAND;
+		}
+	}
+
+	if (limits.maxGrossExposure != 0 && exposure.gross() + notional > limits.maxGrossExposure) {
+		return OrdRejReason::MAX_GROSS_EXPOSURE;
+	}
+
+	if (limits.maxNetExposure != 0) {
+		TNotional net(exposure.net() + (pOrd->side() == OrdSide::BUY ? notional : -notional));
+
+		if ((net < 0 ? -net : net) > limits.maxNetExposure) {
+			return OrdRejReason::MAX_NET_EXPOSURE;
+		}
+	}
+
+	return OrdRejReason::NONE;
+}
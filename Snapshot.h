@@ -0,0 +1,262 @@
+#pragma once
+
+#include "Defn.h"
+#include "MappedFile.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#ifndef _WIN32
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+// Book image layout. Fixed width little endian records without pointers:
+// a header, one SnapshotClient per registered client, then one
+// SnapshotOrder per open order in the sequence it was queued, so restoring
+// them in file order rebuilds every queue as it was.
+static constexpr char SnapshotMagic[8] = { 'O', 'R', 'D', 'M', 'E', 'S', 'N', 'P' };
+static constexpr std::uint32_t SnapshotVersion = 4;
+
+struct SnapshotHeader
+{
+	char			magic[8];
+	std::uint32_t	version;
+	std::uint32_t	phase;				// TradingPhase
+	std::uint64_t	execId;				// last one handed out
+	std::int64_t	pxLastTrade;		// raw
+	std::uint64_t	batchIntervalNs;
+	std::uint64_t	nextBatch;			// engine clock
+	std::uint64_t	clientCount;
+	std::uint64_t	orderCount;
+	std::uint64_t	seq;				// commands taken
+	std::uint64_t	checksum;			// BookChecksum of the orders
+	std::uint64_t	updateSeq;			// book updates made
+};
+
+struct SnapshotClient
+{
+	std::int32_t	clientId;
+	std::uint32_t	nextOrdId;			// last id handed out
+};
+
+enum class SnapshotOrdPlace : std::uint8_t {
+	LEVEL,
+	STOP,
+	BATCH
+};
+
+static constexpr std::uint8_t SnapshotOrdFlagConflateExecs = 1;
+static constexpr std::uint8_t SnapshotOrdFlagQuote = 2;
+
+struct SnapshotOrder
+{
+	std::int64_t	px;					// raw
+	std::int64_t	pxStop;				// raw
+	std::uint64_t	expireTime;
+	std::int32_t	clientId;
+	std::uint32_t	ordId;
+	std::uint32_t	qty;
+	std::uint32_t	qtyOutstanding;
+	std::uint32_t	qtyExec;
+	std::uint32_t	qtyCancelled;
+	std::uint32_t	qtyDisplay;			// 0 but for icebergs
+	std::uint32_t	qtyShown;			// of qtyOutstanding, what its LEVEL entry shows
+	std::uint8_t	side;				// OrdSide
+	std::uint8_t	state;				// OrdStateType
+	std::uint8_t	tif;				// OrdTif
+	std::uint8_t	place;				// SnapshotOrdPlace
+	std::uint8_t	flags;				// SnapshotOrdFlag*
+	std::uint8_t	reserved[3];
+};
+
+static_assert(sizeof(SnapshotHeader) == 88, "SnapshotHeader layout");
+static_assert(sizeof(SnapshotClient) == 8, "SnapshotClient layout");
+static_assert(sizeof(SnapshotOrder) == 64, "SnapshotOrder layout");
+
+inline std::size_t snapshotSize(std::size_t clientCount, std::size_t orderCount)
+{
+	return sizeof(SnapshotHeader) + clientCount * sizeof(SnapshotClient) + orderCount * sizeof(SnapshotOrder);
+}
+
+// Sequential writer into a mapped image
+class SnapshotOut
+{
+public:
+	SnapshotOut(char* pData) : m_pData(pData), m_pos(0) {}
+
+	template <typename T>
+	inline T& next()
+	{
+		T* p = reinterpret_cast<T*>(m_pData + m_pos);
+
+		std::memset(p, 0, sizeof(T));
+		m_pos += sizeof(T);
+		return *p;
+	}
+
+	inline std::size_t pos() const { return m_pos; }
+
+protected:
+	char*		m_pData;
+	std::size_t	m_pos;
+};
+
+// Sequential reader over a mapped image, nullptr once it runs out
+class SnapshotIn
+{
+public:
+	SnapshotIn(const char* pData, std::size_t size) : m_pData(pData), m_size(size), m_pos(0) {}
+
+	template <typename T>
+	inline const T* next()
+	{
+		if (m_size - m_pos < sizeof(T)) return nullptr;
+
+		const T* p = reinterpret_cast<const T*>(m_pData + m_pos);
+
+		m_pos += sizeof(T);
+		return p;
+	}
+
+protected:
+	const char*	m_pData;
+	std::size_t	m_size;
+	std::size_t	m_pos;
+};
+
+// Writes an image into path through a temporary file renamed into place
+// once complete, so a crash never leaves a torn snapshot behind. On POSIX
+// the write runs in a forked child: the parent only pays for the fork and
+// carries on matching while the child serialises its copy-on-write view of
+// the book. Elsewhere it writes in line.
+class SnapshotJob
+{
+public:
+	enum class Status {
+		IDLE,
+		RUNNING,
+		DONE,
+		FAILED
+	};
+
+	SnapshotJob() : m_status(Status::IDLE)
+#ifndef _WIN32
+		, m_pid(-1)
+#endif
+	{}
+	SnapshotJob(const SnapshotJob&) = delete;
+	SnapshotJob& operator=(const SnapshotJob&) = delete;
+
+	~SnapshotJob() { wait(); }
+
+	// write(char* pData) fills exactly size bytes and returns false on error.
+	// Returns false without starting if a snapshot is still running.
+	template <typename Write>
+	bool start(const std::string& path, std::size_t size, Write&& write)
+	{
+		if (poll() == Status::RUNNING) return false;
+
+		// Paths are built before forking, the child must not allocate
+		m_path = path;
+		m_tmpPath = path + ".tmp";
+
+#ifdef _WIN32
+		m_status = writeImage(m_tmpPath.c_str(), m_path.c_str(), size, write) ? Status::DONE : Status::FAILED;
+		return m_status == Status::DONE;
+#else
+		pid_t pid = ::fork();
+
+		if (pid < 0) {
+			m_status = Status::FAILED;
+			return false;
+		}
+		if (pid == 0) {
+			::_exit(writeImage(m_tmpPath.c_str(), m_path.c_str(), size, write) ? 0 : 1);
+		}
+		m_pid = pid;
+		m_status = Status::RUNNING;
+		return true;
+#endif
+	}
+
+	// Same as start but in the calling process, returns once written
+	template <typename Write>
+	bool run(const std::string& path, std::size_t size, Write&& write)
+	{
+		if (poll() == Status::RUNNING) return false;
+
+		m_path = path;
+		m_tmpPath = path + ".tmp";
+		m_status = writeImage(m_tmpPath.c_str(), m_path.c_str(), size, write) ? Status::DONE : Status::FAILED;
+		return m_status == Status::DONE;
+	}
+
+	// Reaps the child without blocking
+	Status poll()
+	{
+#ifndef _WIN32
+		if (m_status == Status::RUNNING) {
+			int wstatus(0);
+			pid_t pid = ::waitpid(m_pid, &wstatus, WNOHANG);
+
+			if (pid == m_pid || pid < 0) {
+				reap(pid == m_pid ? wstatus : -1);
+			}
+		}
+#endif
+		return m_status;
+	}
+
+	Status wait()
+	{
+#ifndef _WIN32
+		if (m_status == Status::RUNNING) {
+			int wstatus(0);
+			pid_t pid;
+
+			do {
+				pid = ::waitpid(m_pid, &wstatus, 0);
+			} while (pid < 0 && errno == EINTR);
+			reap(pid == m_pid ? wstatus : -1);
+		}
+#endif
+		return m_status;
+	}
+
+protected:
+	template <typename Write>
+	static bool writeImage(const char* tmpPath, const char* path, std::size_t size, Write& write)
+	{
+		MappedFile file;
+
+		if (!file.create(tmpPath, size)) return false;
+		if (!write(file.data()) || !file.sync()) return false;
+		file.close();
+
+#ifdef _WIN32
+		return MoveFileExA(tmpPath, path, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+		return std::rename(tmpPath, path) == 0;
+#endif
+	}
+
+#ifndef _WIN32
+	void reap(int wstatus)
+	{
+		m_status = wstatus >= 0 && WIFEXITED(wstatus) && WEXITSTATUS(wstatus) == 0 ? Status::DONE : Status::FAILED;
+		m_pid = -1;
+	}
+#endif
+
+	Status		m_status;
+	std::string	m_path;
+	std::string	m_tmpPath;
+#ifndef _WIN32
+	pid_t		m_pid;
+#endif
+};
@@ -0,0 +1,93 @@
+// StopTest.cpp : Checks that a sweep through several levels triggers the
+// stops crossed by any of its trade prices, not only by the last one.
+//
+
+#include "OrdMatchingEngine.h"
+
+#include <iostream>
+#include <memory>
+#include <string>
+
+static bool check(bool isOk, const std::string& what)
+{
+	if (!isOk) {
+		std::cerr << "FAILED: " << what << std::endl;
+	}
+	return isOk;
+}
+
+static TPrice px(std::int64_t raw)
+{
+	return TPrice(TPrice::RawValue{ raw });
+}
+
+static void submit(OrdME& me, const TClientId& clientId, OrdSide side, const TPrice& pxLimit, const TQty& qty,
+	const TPrice& pxStop = TPrice(0))
+{
+	me.submitNewOrder(std::make_unique<Order>(clientId, side, pxLimit, qty, OrdTif::GTC, 0, pxStop));
+}
+
+// A sell sweeps the bids at 103 then 101: the buy stop at 102.50 was
+// crossed by the first fill, the sell stop at 99 by none
+static bool sellSweep()
+{
+	OrdME me;
+	bool isOk(true);
+
+	for (TClientId clientId = 0; clientId < 3; ++clientId) {
+		me.registerClient(clientId, nullptr);
+	}
+	submit(me, 0, OrdSide::BUY, px(10000), 1);
+	submit(me, 1, OrdSide::SELL, px(10000), 1);
+	submit(me, 2, OrdSide::BUY, px(10400), 1, px(10250));
+	submit(me, 2, OrdSide::SELL, px(9800), 1, px(9900));
+	isOk &= check(me.ordBook().stopCount() == 2, "sell sweep: stops parked");
+
+	submit(me, 0, OrdSide::BUY, px(10300), 1);
+	submit(me, 0, OrdSide::BUY, px(10100), 1);
+	submit(me, 1, OrdSide::SELL, px(10100), 2);
+
+	isOk &= check(me.ordBook().lastTradePx() == px(10100), "sell sweep: last trade at 101");
+	isOk &= check(me.ordBook().stopCount() == 1, "sell sweep: buy stop at 102.50 triggered by the fill at 103");
+	isOk &= check(me.ordBook().hasLimitBid() && me.ordBook().bestLimitBid().px() == px(10400),
+		"sell sweep: triggered buy stop rests at 104");
+	return isOk;
+}
+
+// A buy sweeps the asks at 99 then 101: the sell stop at 99.50 was
+// crossed by the first fill, the buy stop at 102 by none
+static bool buySweep()
+{
+	OrdME me;
+	bool isOk(true);
+
+	for (TClientId clientId = 0; clientId < 3; ++clientId) {
+		me.registerClient(clientId, nullptr);
+	}
+	submit(me, 0, OrdSide::BUY, px(10000), 1);
+	submit(me, 1, OrdSide::SELL, px(10000), 1);
+	submit(me, 2, OrdSide::SELL, px(9600), 1, px(9950));
+	submit(me, 2, OrdSide::BUY, px(10300), 1, px(10200));
+	isOk &= check(me.ordBook().stopCount() == 2, "buy sweep: stops parked");
+
+	submit(me, 1, OrdSide::SELL, px(9900), 1);
+	submit(me, 1, OrdSide::SELL, px(10100), 1);
+	submit(me, 0, OrdSide::BUY, px(10100), 2);
+
+	isOk &= check(me.ordBook().lastTradePx() == px(10100), "buy sweep: last trade at 101");
+	isOk &= check(me.ordBook().stopCount() == 1, "buy sweep: sell stop at 99.50 triggered by the fill at 99");
+	isOk &= check(me.ordBook().hasLimitAsk() && me.ordBook().bestLimitAsk().px() == px(9600),
+		"buy sweep: triggered sell stop rests at 96");
+	return isOk;
+}
+
+int main()
+{
+	bool isOk(sellSweep());
+
+	isOk &= buySweep();
+	if (!isOk) return 1;
+
+	std::cout << "StopTest passed" << std::endl;
+	return 0;
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include "Defn.h"
+
+#include <cstdint>
+
+// Per-client message rate and open order limits, 0 disables a limit. Up to
+// burst messages can come at once, then msgsPerSec on average.
+struct ThrottleLimits
+{
+	std::uint32_t	msgsPerSec;
+	std::uint32_t	burst;
+	std::uint32_t	maxOpenOrders;
+
+	ThrottleLimits() : msgsPerSec(0), burst(0), maxOpenOrders(0) {}
+};
+
+struct ThrottleStats
+{
+	std::uint64_t	messages;		// new orders and mass quotes let through
+	std::uint64_t	throttled;		// rejected for the message rate
+	std::uint64_t	openRejects;	// orders or quotes rejected for the open order limit
+	std::uint32_t	openOrders;
+
+	ThrottleStats() : messages(0), throttled(0), openRejects(0), openOrders(0) {}
+};
+
+// Token bucket kept as a GCRA: one theoretical arrival time, advanced by
+// the emission interval per message taken, instead of a token count to
+// refill. A message is let through unless it comes more than the burst
+// tolerance ahead of it. O(1) and no division per message.
+class Throttle
+{
+public:
+	Throttle() : m_intervalNs(0), m_toleranceNs(0), m_tat(0) {}
+
+	void setLimits(const ThrottleLimits& limits)
+	{
+		m_limits = limits;
+		m_intervalNs = limits.msgsPerSec == 0 ? 0 : 1000000000ULL / limits.msgsPerSec;
+		m_toleranceNs = m_intervalNs * (limits.burst > 1 ? limits.burst - 1 : 0);
+		m_tat = 0;
+	}
+
+	inline const ThrottleLimits& limits() const { return m_limits; }
+	inline const ThrottleStats& stats() const { return m_stats; }
+
+	// Takes a message at now, one that would open an order is also held to
+	// the open order limit
+	inline OrdRejReason onMessage(const TTimestamp& now, bool opensOrder)
+	{
+		if (m_intervalNs != 0) {
+			TTimestamp tat(m_tat > now ? m_tat : now);
+
+			if (tat - now > m_toleranceNs) {
+				++m_stats.throttled;
+				return OrdRejReason::THROTTLED;
+			}
+			m_tat = tat + m_intervalNs;
+		}
+		if (opensOrder && !canOpen()) {
+			return OrdRejReason::MAX_OPEN_ORDERS;
+		}
+		++m_stats.messages;
+		return OrdRejReason::NONE;
+	}
+
+	// Counts a rejection if the open order limit is reached
+	inline bool canOpen()
+	{
+		if (m_limits.maxOpenOrders == 0 || m_stats.openOrders < m_limits.maxOpenOrders) return true;
+
+		++m_stats.openRejects;
+		return false;
+	}
+
+	inline void onOpen() { ++m_stats.openOrders; }
+	inline void onClose() { --m_stats.openOrders; }
+
+protected:
+	ThrottleLimits	m_limits;
+	ThrottleStats	m_stats;
+	TTimestamp		m_intervalNs;
+	TTimestamp		m_toleranceNs;
+	TTimestamp		m_tat;		// theoretical arrival time of the next message
+};
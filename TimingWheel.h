@@ -0,0 +1,227 @@
+#pragma once
+
+#include "Defn.h"
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+
+class TimingWheel;
+
+// Intrusive timer link, embedded in the object that owns the deadline.
+// Arm and disarm are O(1) list splices; destroying the node disarms it.
+class TimerNode
+{
+public:
+	explicit TimerNode(void* pOwner = nullptr) :
+		m_pPrev(nullptr), m_pNext(nullptr), m_pWheel(nullptr), m_tick(0), m_pOwner(pOwner)
+	{}
+	TimerNode(const TimerNode&) = delete;
+	TimerNode& operator=(const TimerNode&) = delete;
+	~TimerNode() { disarm(); }
+
+	inline bool isArmed() const { return m_pWheel != nullptr; }
+	inline void* owner() const { return m_pOwner; }
+
+	inline void disarm();
+
+protected:
+	friend class TimingWheel;
+
+	inline void unlink()
+	{
+		m_pPrev->m_pNext = m_pNext;
+		m_pNext->m_pPrev = m_pPrev;
+		m_pPrev = m_pNext = nullptr;
+	}
+
+	inline void linkBefore(TimerNode& head)
+	{
+		m_pNext = &head;
+		m_pPrev = head.m_pPrev;
+		head.m_pPrev->m_pNext = this;
+		head.m_pPrev = this;
+	}
+
+	TimerNode*		m_pPrev;
+	TimerNode*		m_pNext;
+	TimingWheel*	m_pWheel;
+	std::uint64_t	m_tick;
+	void*			m_pOwner;
+};
+
+// Hierarchical timing wheel: NumLevels wheels of NumSlots slots each, level n
+// covering NumSlots^(n+1) ticks. Timers beyond the top level are parked in the
+// top level and re-evaluated as it cascades.
+class TimingWheel
+{
+public:
+	static constexpr unsigned LevelBits = 8;
+	static constexpr unsigned NumSlots = 1u << LevelBits;
+	static constexpr unsigned NumLevels = 4;
+	static constexpr std::uint64_t SlotMask = NumSlots - 1;
+
+	TimingWheel(const TTimestamp& tickNs, const TTimestamp& now) :
+		m_tickNs(tickNs), m_currTick(now / tickNs), m_armed(0)
+	{
+		assert(tickNs > 0);
+
+		for (auto& level : m_slots) {
+			for (auto& head : level) {
+				head.m_pPrev = head.m_pNext = &head;
+			}
+		}
+	}
+	TimingWheel(const TimingWheel&) = delete;
+	TimingWheel& operator=(const TimingWheel&) = delete;
+
+	~TimingWheel()
+	{
+		for (auto& level : m_slots) {
+			for (auto& head : level) {
+				while (head.m_pNext != &head) {
+					head.m_pNext->disarm();
+				}
+				head.m_pPrev = head.m_pNext = nullptr;
+			}
+		}
+	}
+
+	inline const TTimestamp& tickNs() const { return m_tickNs; }
+	inline TTimestamp now() const { return m_currTick * m_tickNs; }
+	inline std::size_t armed() const { return m_armed; }
+
+	// Fires on the first advance to a time >= expiry, deadlines at or before
+	// the current tick fire on the next advance
+	inline void arm(TimerNode& node, const TTimestamp& expiry)
+	{
+		node.disarm();
+
+		std::uint64_t tick((expiry + m_tickNs - 1) / m_tickNs);
+
+		node.m_tick = tick > m_currTick ? tick : m_currTick + 1;
+		node.m_pWheel = this;
+		insert(node);
+		++m_armed;
+	}
+
+	// Fires every timer whose tick is <= now, in tick order. fn(TimerNode*)
+	// is called with the node already disarmed. Ticks with nothing to fire
+	// or cascade are skipped, the cost does not grow with the time elapsed.
+	template <typename Fn>
+	inline void advance(const TTimestamp& now, Fn&& fn)
+	{
+		std::uint64_t target(now / m_tickNs);
+
+		while (m_currTick < target) {
+			std::uint64_t next(m_armed == 0 ? target + 1 : nextTick());
+
+			if (next > target) {
+				m_currTick = target;
+				break;
+			}
+			m_currTick = next;
+			cascade();
+
+			TimerNode& head(m_slots[0][m_currTick & SlotMask]);
+
+			while (head.m_pNext != &head) {
+				TimerNode* pNode = head.m_pNext;
+
+				pNode->disarm();
+				fn(pNode);
+			}
+		}
+	}
+
+protected:
+	friend class TimerNode;
+
+	inline static unsigned digit(std::uint64_t tick, unsigned level)
+	{
+		return static_cast<unsigned>((tick >> (LevelBits * level)) & SlotMask);
+	}
+
+	inline void insert(TimerNode& node)
+	{
+		for (unsigned level = 0; level < NumLevels; ++level) {
+			unsigned shift(LevelBits * (level + 1));
+
+			if ((node.m_tick >> shift) == (m_currTick >> shift)) {
+				node.linkBefore(m_slots[level][digit(node.m_tick, level)]);
+				return;
+			}
+		}
+		// Out of range: park in the top-level slot that cascades as the top
+		// level starts its next turn, no in range timer is ever put there
+		node.linkBefore(m_slots[NumLevels - 1][0]);
+	}
+
+	// First tick after the current one that fires a level 0 slot or cascades
+	// a higher one. Timers only sit in slots ahead of the current tick's digit
+	// at their level, but for those parked out of range in the top level.
+	inline std::uint64_t nextTick() const
+	{
+		for (unsigned level = 0; level < NumLevels; ++level) {
+			unsigned shift(LevelBits * level);
+			std::uint64_t span((m_currTick >> (shift + LevelBits)) << (shift + LevelBits));
+
+			for (unsigned slot = digit(m_currTick, level) + 1; slot < NumSlots; ++slot) {
+				const TimerNode& head(m_slots[level][slot]);
+
+				if (head.m_pNext != &head) {
+					return span + (std::uint64_t(slot) << shift);
+				}
+			}
+		}
+
+		// Only parked timers left, they cascade as the top level starts its next turn
+		unsigned shift(LevelBits * NumLevels);
+
+		return ((m_currTick >> shift) + 1) << shift;
+	}
+
+	// Redistribute the higher-level slots whose span starts at the current tick
+	inline void cascade()
+	{
+		unsigned top(0);
+
+		while (top + 1 < NumLevels && digit(m_currTick, top) == 0) {
+			++top;
+		}
+		for (unsigned level = top; level > 0; --level) {
+			TimerNode& head(m_slots[level][digit(m_currTick, level)]);
+
+			if (head.m_pNext == &head) continue;
+
+			// Detached first, timers still out of range are parked back in this slot
+			TimerNode pending;
+
+			pending.m_pNext = head.m_pNext;
+			pending.m_pPrev = head.m_pPrev;
+			pending.m_pNext->m_pPrev = pending.m_pPrev->m_pNext = &pending;
+			head.m_pPrev = head.m_pNext = &head;
+
+			while (pending.m_pNext != &pending) {
+				TimerNode* pNode = pending.m_pNext;
+
+				pNode->unlink();
+				insert(*pNode);
+			}
+		}
+	}
+
+	TTimestamp		m_tickNs;
+	std::uint64_t	m_currTick;
+	std::size_t		m_armed;
+	TimerNode		m_slots[NumLevels][NumSlots];
+};
+
+inline void TimerNode::disarm()
+{
+	if (m_pWheel) {
+		unlink();
+		--m_pWheel->m_armed;
+		m_pWheel = nullptr;
+	}
+}
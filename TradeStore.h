@@ -0,0 +1,480 @@
+#pragma once
+
+#include "Defn.h"
+#include "MappedFile.h"
+#include "TradingStats.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+// Trade store layout. A directory holding one file per column with a fixed
+// width value per trade, and an index file: a TradeStoreHeader followed by
+// one TradeBlockIndex per block of TradeBlockRows trades. Trades are written
+// in place and published by raising the header's row count last, so readers
+// mapping the same files can scan while the engine appends.
+static constexpr char TradeStoreMagic[8] = { 'O', 'R', 'D', 'M', 'E', 'T', 'R', 'D' };
+static constexpr std::uint32_t TradeStoreVersion = 1;
+static constexpr std::size_t TradeBlockRows = 4096;
+static constexpr std::size_t TradeMinBlocks = 16;		// capacity of a new store, doubled as it fills
+
+enum class TradeColumn {
+	EXEC_ID,
+	TIMESTAMP,
+	PX,
+	QTY,
+	TAKER_SIDE,
+	MAKER_CLIENT_ID,
+	MAKER_ORD_ID,
+	TAKER_CLIENT_ID,
+	TAKER_ORD_ID,
+	COUNT
+};
+
+static constexpr std::size_t TradeColumnCount = static_cast<std::size_t>(TradeColumn::COUNT);
+
+static const char* const TradeColumnFile[] = {
+	"execId.col",
+	"ts.col",
+	"px.col",
+	"qty.col",
+	"takerSide.col",
+	"makerClientId.col",
+	"makerOrdId.col",
+	"takerClientId.col",
+	"takerOrdId.col"
+};
+
+static constexpr std::size_t TradeColumnWidth[] = {
+	sizeof(TExecId),
+	sizeof(TTimestamp),
+	sizeof(std::int64_t),		// raw price
+	sizeof(TQty),
+	sizeof(std::uint8_t),	// OrdSide, NONE for auction trades
+	sizeof(TClientId),
+	sizeof(TOrdId),
+	sizeof(TClientId),
+	sizeof(TOrdId)
+};
+
+struct TradeStoreHeader
+{
+	char						magic[8];
+	std::uint32_t				version;
+	std::uint32_t				blockRows;
+	std::atomic<std::uint64_t>	rows;			// trades published to readers
+	std::uint8_t				reserved[40];
+};
+
+// Bounds of one block, final once the block is full
+struct TradeBlockIndex
+{
+	TTimestamp		minTs;
+	TTimestamp		maxTs;
+	std::int64_t	minPx;			// raw
+	std::int64_t	maxPx;			// raw
+	std::uint64_t	qty;
+	double			notional;		// sum of raw px * qty
+	TExecId			firstExecId;
+	TExecId			lastExecId;
+	std::uint8_t	reserved[8];
+};
+
+static_assert(sizeof(TradeStoreHeader) == 64, "TradeStoreHeader layout");
+static_assert(sizeof(TradeBlockIndex) == 64, "TradeBlockIndex layout");
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "row count must be lock free to be shared between processes");
+
+struct TradeRecord
+{
+	TExecId		execId;
+	TTimestamp	ts;
+	TPrice		px;
+	TQty		qty;
+	OrdSide		takerSide;		// NONE when the trade came out of an auction
+	TClientId	makerClientId;
+	TOrdId		makerOrdId;
+	TClientId	takerClientId;	// buyer in an auction
+	TOrdId		takerOrdId;
+};
+
+inline std::string tradeStorePath(const std::string& dir, const char* file)
+{
+	return dir.empty() || dir.back() == '/' ? dir + file : dir + '/' + file;
+}
+
+inline std::size_t tradeIndexSize(std::size_t blocks)
+{
+	return sizeof(TradeStoreHeader) + blocks * sizeof(TradeBlockIndex);
+}
+
+// Appends trades to a store, creating it or carrying on where the last
+// writer stopped. There must be only one writer per directory.
+class TradeStoreWriter
+{
+public:
+	TradeStoreWriter() : m_pHeader(nullptr), m_pIndex(nullptr), m_rows(0), m_capacity(0) {}
+	TradeStoreWriter(const TradeStoreWriter&) = delete;
+	TradeStoreWriter& operator=(const TradeStoreWriter&) = delete;
+
+	~TradeStoreWriter() { close(); }
+
+	inline bool isOpen() const { return m_pHeader != nullptr; }
+	inline std::uint64_t rows() const { return m_rows; }
+
+	bool open(const std::string& dir)
+	{
+		close();
+
+#ifdef _WIN32
+		_mkdir(dir.c_str());
+#else
+		::mkdir(dir.c_str(), 0755);
+#endif
+		if (!m_indexFile.open(tradeStorePath(dir, "trades.idx").c_str(), tradeIndexSize(TradeMinBlocks))) return false;
+
+		TradeStoreHeader* pHeader = reinterpret_cast<TradeStoreHeader*>(m_indexFile.data());
+
+		if (std::memcmp(pHeader->magic, TradeStoreMagic, sizeof(TradeStoreMagic)) != 0) {
+			std::memcpy(pHeader->magic, TradeStoreMagic, sizeof(TradeStoreMagic));
+			pHeader->version = TradeStoreVersion;
+			pHeader->blockRows = TradeBlockRows;
+			pHeader->rows.store(0, std::memory_order_release);
+		}
+		else if (pHeader->version != TradeStoreVersion || pHeader->blockRows != TradeBlockRows) {
+			m_indexFile.close();
+			return false;
+		}
+
+		std::size_t blocks((m_indexFile.size() - sizeof(TradeStoreHeader)) / sizeof(TradeBlockIndex));
+
+		for (std::size_t i = 0; i < TradeColumnCount; ++i) {
+			std::string path(tradeStorePath(dir, TradeColumnFile[i]));
+
+			if (!m_cols[i].open(path.c_str(), blocks * TradeBlockRows * TradeColumnWidth[i])) {
+				close();
+				return false;
+			}
+		}
+		m_pHeader = pHeader;
+		m_pIndex = reinterpret_cast<TradeBlockIndex*>(m_indexFile.data() + sizeof(TradeStoreHeader));
+		m_rows = pHeader->rows.load(std::memory_order_acquire);
+		m_capacity = blocks * TradeBlockRows;
+		if (m_rows > m_capacity) {
+			close();
+			return false;
+		}
+
+		// The last writer may have indexed trades it never published
+		if (m_rows % TradeBlockRows != 0) {
+			reindexBlock(m_rows / TradeBlockRows);
+		}
+		return true;
+	}
+
+	// Publishes the trade to readers once every column has it. Returns false,
+	// and closes the store, if the files cannot grow.
+	inline bool append(const TradeRecord& rec)
+	{
+		if (m_rows == m_capacity && !grow()) {
+			close();
+			return false;
+		}
+
+		std::size_t row(static_cast<std::size_t>(m_rows));
+
+		column<TExecId>(TradeColumn::EXEC_ID)[row] = rec.execId;
+		column<TTimestamp>(TradeColumn::TIMESTAMP)[row] = rec.ts;
+		column<std::int64_t>(TradeColumn::PX)[row] = rec.px.rawValue();
+		column<TQty>(TradeColumn::QTY)[row] = rec.qty;
+		column<std::uint8_t>(TradeColumn::TAKER_SIDE)[row] = static_cast<std::uint8_t>(rec.takerSide);
+		column<TClientId>(TradeColumn::MAKER_CLIENT_ID)[row] = rec.makerClientId;
+		column<TOrdId>(TradeColumn::MAKER_ORD_ID)[row] = rec.makerOrdId;
+		column<TClientId>(TradeColumn::TAKER_CLIENT_ID)[row] = rec.takerClientId;
+		column<TOrdId>(TradeColumn::TAKER_ORD_ID)[row] = rec.takerOrdId;
+
+		indexRow(m_pIndex[row / TradeBlockRows], row % TradeBlockRows == 0, rec.execId, rec.ts, rec.px.rawValue(), rec.qty);
+
+		m_pHeader->rows.store(++m_rows, std::memory_order_release);
+		return true;
+	}
+
+	// Flushes the mapped files to disk
+	bool sync()
+	{
+		if (!isOpen()) return false;
+
+		bool isSynced(true);
+
+		for (MappedFile& refCol : m_cols) {
+			isSynced = refCol.sync() && isSynced;
+		}
+		return m_indexFile.sync() && isSynced;
+	}
+
+	void close()
+	{
+		for (MappedFile& refCol : m_cols) {
+			refCol.close();
+		}
+		m_indexFile.close();
+		m_pHeader = nullptr;
+		m_pIndex = nullptr;
+		m_rows = 0;
+		m_capacity = 0;
+	}
+
+protected:
+	template <typename T>
+	inline T* column(TradeColumn col)
+	{
+		return reinterpret_cast<T*>(m_cols[static_cast<std::size_t>(col)].data());
+	}
+
+	inline static void indexRow(TradeBlockIndex& refBlock, bool isFirst, TExecId execId, TTimestamp ts, std::int64_t px, TQty qty)
+	{
+		if (isFirst) {
+			refBlock = TradeBlockIndex{ ts, ts, px, px, qty, static_cast<double>(px) * qty, execId, execId, {} };
+			return;
+		}
+		refBlock.minTs = std::min(refBlock.minTs, ts);
+		refBlock.maxTs = std::max(refBlock.maxTs, ts);
+		refBlock.minPx = std::min(refBlock.minPx, px);
+		refBlock.maxPx = std::max(refBlock.maxPx, px);
+		refBlock.qty += qty;
+		refBlock.notional += static_cast<double>(px) * qty;
+		refBlock.lastExecId = execId;
+	}
+
+	void reindexBlock(std::size_t block)
+	{
+		std::size_t rowEnd(static_cast<std::size_t>(m_rows));
+
+		for (std::size_t row = block * TradeBlockRows; row < rowEnd; ++row) {
+			indexRow(m_pIndex[block], row % TradeBlockRows == 0, column<TExecId>(TradeColumn::EXEC_ID)[row],
+				column<TTimestamp>(TradeColumn::TIMESTAMP)[row], column<std::int64_t>(TradeColumn::PX)[row],
+				column<TQty>(TradeColumn::QTY)[row]);
+		}
+	}
+
+	// Columns grow before the index so a reader never sees an indexed block
+	// past the end of a column
+	bool grow()
+	{
+		std::size_t blocks(m_capacity / TradeBlockRows * 2);
+
+		for (std::size_t i = 0; i < TradeColumnCount; ++i) {
+			if (!m_cols[i].resize(blocks * TradeBlockRows * TradeColumnWidth[i])) return false;
+		}
+		if (!m_indexFile.resize(tradeIndexSize(blocks))) return false;
+
+		m_pHeader = reinterpret_cast<TradeStoreHeader*>(m_indexFile.data());
+		m_pIndex = reinterpret_cast<TradeBlockIndex*>(m_indexFile.data() + sizeof(TradeStoreHeader));
+		m_capacity = blocks * TradeBlockRows;
+		return true;
+	}
+
+	MappedFile			m_indexFile;
+	MappedFile			m_cols[TradeColumnCount];
+	TradeStoreHeader*	m_pHeader;
+	TradeBlockIndex*	m_pIndex;
+	std::uint64_t		m_rows;
+	std::uint64_t		m_capacity;
+};
+
+// Totals of the trades matched by a scan
+struct TradeSummary
+{
+	std::uint64_t	trades;
+	std::uint64_t	qty;
+	double			notional;		// sum of raw px * qty
+	TPrice			pxLow;
+	TPrice			pxHigh;
+
+	TradeSummary() : trades(0), qty(0), notional(0), pxLow(0), pxHigh(0) {}
+
+	inline TPrice vwap() const { return vwapPx(notional, qty); }
+};
+
+// Read only view of a store, possibly while a writer appends to it. The
+// rows visible are those published when open or refresh last ran.
+class TradeStoreReader
+{
+public:
+	TradeStoreReader() : m_rows(0) {}
+	TradeStoreReader(const TradeStoreReader&) = delete;
+	TradeStoreReader& operator=(const TradeStoreReader&) = delete;
+
+	inline bool isOpen() const { return m_indexFile.isOpen(); }
+	inline std::uint64_t rows() const { return m_rows; }
+
+	bool open(const std::string& dir)
+	{
+		m_dir = dir;
+		m_rows = 0;
+		for (MappedFile& refCol : m_cols) {
+			refCol.close();
+		}
+		if (!m_indexFile.openRead(tradeStorePath(dir, "trades.idx").c_str()) || m_indexFile.size() < sizeof(TradeStoreHeader)) {
+			m_indexFile.close();
+			return false;
+		}
+
+		const TradeStoreHeader* pHeader = header();
+
+		if (std::memcmp(pHeader->magic, TradeStoreMagic, sizeof(TradeStoreMagic)) != 0 ||
+			pHeader->version != TradeStoreVersion || pHeader->blockRows != TradeBlockRows) {
+			m_indexFile.close();
+			return false;
+		}
+		refresh();
+		return true;
+	}
+
+	// Takes in the trades published since, mapping the files again if the
+	// writer has grown them. Returns the number of rows visible.
+	std::uint64_t refresh()
+	{
+		if (!isOpen()) return 0;
+
+		std::uint64_t rows(header()->rows.load(std::memory_order_acquire));
+		std::size_t blocks((static_cast<std::size_t>(rows) + TradeBlockRows - 1) / TradeBlockRows);
+
+		if (m_indexFile.size() < tradeIndexSize(blocks) && !remap(m_indexFile, "trades.idx", tradeIndexSize(blocks))) return m_rows;
+
+		for (std::size_t i = 0; i < TradeColumnCount; ++i) {
+			if (m_cols[i].size() < rows * TradeColumnWidth[i] && !remap(m_cols[i], TradeColumnFile[i], rows * TradeColumnWidth[i])) return m_rows;
+		}
+		m_rows = rows;
+		return m_rows;
+	}
+
+	// Raw column of rows() values, T as in TradeColumnWidth
+	template <typename T>
+	inline const T* column(TradeColumn col) const
+	{
+		return reinterpret_cast<const T*>(m_cols[static_cast<std::size_t>(col)].data());
+	}
+
+	inline std::size_t blockCount() const { return (static_cast<std::size_t>(m_rows) + TradeBlockRows - 1) / TradeBlockRows; }
+
+	inline const TradeBlockIndex& blockIndex(std::size_t block) const
+	{
+		return reinterpret_cast<const TradeBlockIndex*>(m_indexFile.data() + sizeof(TradeStoreHeader))[block];
+	}
+
+	inline TradeRecord record(std::size_t row) const
+	{
+		return TradeRecord{
+			column<TExecId>(TradeColumn::EXEC_ID)[row],
+			column<TTimestamp>(TradeColumn::TIMESTAMP)[row],
+			TPrice(TPrice::RawValue{ column<std::int64_t>(TradeColumn::PX)[row] }),
+			column<TQty>(TradeColumn::QTY)[row],
+			static_cast<OrdSide>(column<std::uint8_t>(TradeColumn::TAKER_SIDE)[row]),
+			column<TClientId>(TradeColumn::MAKER_CLIENT_ID)[row],
+			column<TOrdId>(TradeColumn::MAKER_ORD_ID)[row],
+			column<TClientId>(TradeColumn::TAKER_CLIENT_ID)[row],
+			column<TOrdId>(TradeColumn::TAKER_ORD_ID)[row]
+		};
+	}
+
+	// Count, volume, notional and price range of the trades with from <= ts < to.
+	// Full blocks inside the range are taken from the index without reading
+	// the columns, blocks outside it are skipped, only the blocks straddling
+	// a bound are scanned.
+	TradeSummary summary(const TTimestamp& from, const TTimestamp& to) const
+	{
+		TradeSummary result;
+		std::int64_t pxLow(std::numeric_limits<std::int64_t>::max());
+		std::int64_t pxHigh(std::numeric_limits<std::int64_t>::min());
+
+		const TTimestamp* pTs(column<TTimestamp>(TradeColumn::TIMESTAMP));
+		const std::int64_t* pPx(column<std::int64_t>(TradeColumn::PX));
+		const TQty* pQty(column<TQty>(TradeColumn::QTY));
+
+		for (std::size_t block = 0, blocks = blockCount(); block < blocks && from < to; ++block) {
+			const TradeBlockIndex& refBlock(blockIndex(block));
+			std::size_t rowBegin(block * TradeBlockRows);
+			std::size_t rowEnd(std::min<std::size_t>(rowBegin + TradeBlockRows, static_cast<std::size_t>(m_rows)));
+
+			if (refBlock.maxTs < from || refBlock.minTs >= to) continue;
+
+			if (refBlock.minTs >= from && refBlock.maxTs < to && rowEnd - rowBegin == TradeBlockRows) {
+				result.trades += TradeBlockRows;
+				result.qty += refBlock.qty;
+				result.notional += refBlock.notional;
+				pxLow = std::min(pxLow, refBlock.minPx);
+				pxHigh = std::max(pxHigh, refBlock.maxPx);
+				continue;
+			}
+
+			double notional(0);
+
+			for (std::size_t row = rowBegin; row < rowEnd; ++row) {
+				if (pTs[row] < from || pTs[row] >= to) continue;
+
+				++result.trades;
+				result.qty += pQty[row];
+				notional += static_cast<double>(pPx[row]) * pQty[row];
+				pxLow = std::min(pxLow, pPx[row]);
+				pxHigh = std::max(pxHigh, pPx[row]);
+			}
+			result.notional += notional;
+		}
+		if (result.trades > 0) {
+			result.pxLow = TPrice(TPrice::RawValue{ pxLow });
+			result.pxHigh = TPrice(TPrice::RawValue{ pxHigh });
+		}
+		return result;
+	}
+
+	// Calls fn(const TradeRecord&) for every trade with from <= ts < to in
+	// the sequence they happened
+	template <typename Fn>
+	void forEachTrade(const TTimestamp& from, const TTimestamp& to, Fn&& fn) const
+	{
+		const TTimestamp* pTs(column<TTimestamp>(TradeColumn::TIMESTAMP));
+
+		for (std::size_t block = 0, blocks = blockCount(); block < blocks; ++block) {
+			const TradeBlockIndex& refBlock(blockIndex(block));
+
+			if (refBlock.maxTs < from || refBlock.minTs >= to) continue;
+
+			std::size_t rowEnd(std::min<std::size_t>((block + 1) * TradeBlockRows, static_cast<std::size_t>(m_rows)));
+
+			for (std::size_t row = block * TradeBlockRows; row < rowEnd; ++row) {
+				if (pTs[row] >= from && pTs[row] < to) {
+					fn(record(row));
+				}
+			}
+		}
+	}
+
+protected:
+	inline const TradeStoreHeader* header() const { return reinterpret_cast<const TradeStoreHeader*>(m_indexFile.data()); }
+
+	bool remap(MappedFile& refFile, const char* file, std::size_t minSize)
+	{
+		MappedFile mapped;
+
+		if (!mapped.openRead(tradeStorePath(m_dir, file).c_str()) || mapped.size() < minSize) return false;
+
+		refFile.close();
+		refFile.swap(mapped);
+		return true;
+	}
+
+	std::string		m_dir;
+	MappedFile		m_indexFile;
+	MappedFile		m_cols[TradeColumnCount];
+	std::uint64_t	m_rows;
+};
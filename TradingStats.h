@@ -0,0 +1,125 @@
+#pragma once
+
+#include "Defn.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Volume weighted average of a raw notional, rounded to the nearest tick
+inline TPrice vwapPx(double notional, std::uint64_t qty)
+{
+	return qty == 0 ? TPrice(0) : TPrice(TPrice::RawValue{ static_cast<std::int64_t>(notional / qty + (notional >= 0 ? 0.5 : -0.5)) });
+}
+
+// Trading activity over a period of the engine clock
+struct TradingStats
+{
+	TTimestamp		start;
+	TPrice			open;
+	TPrice			high;
+	TPrice			low;
+	TPrice			last;
+	std::uint64_t	volume;
+	double			notional;		// sum of raw px * qty
+	std::uint64_t	trades;
+	std::uint64_t	orders;			// accepted
+	std::uint64_t	cancels;		// acknowledged
+
+	TradingStats(const TTimestamp& ts = 0) :
+		start(ts), open(0), high(0), low(0), last(0), volume(0), notional(0), trades(0), orders(0), cancels(0)
+	{}
+
+	inline TPrice vwap() const { return vwapPx(notional, volume); }
+
+	inline void onTrade(const TPrice& px, const TQty& qty)
+	{
+		if (trades == 0) {
+			open = px;
+			high = px;
+			low = px;
+		}
+		else {
+			high = std::max(high, px);
+			low = std::min(low, px);
+		}
+		last = px;
+		volume += qty;
+		notional += static_cast<double>(px.rawValue()) * qty;
+		++trades;
+	}
+};
+
+// Session totals plus, once an interval is set, the stats of the last few
+// intervals of the engine clock in a ring. Intervals start on multiples of
+// the interval and only those with activity take a slot.
+class TradingStatsRecorder
+{
+public:
+	TradingStatsRecorder(const TTimestamp& start = 0) : m_total(start), m_intervalNs(0), m_head(0), m_size(0) {}
+
+	inline const TradingStats& total() const { return m_total; }
+
+	// count 0 or intervalNs 0 keeps the totals only
+	void setInterval(const TTimestamp& intervalNs, std::size_t count)
+	{
+		m_intervalNs = count == 0 ? 0 : intervalNs;
+		m_buckets.assign(m_intervalNs == 0 ? 0 : count, TradingStats());
+		m_head = 0;
+		m_size = 0;
+	}
+	inline const TTimestamp& interval() const { return m_intervalNs; }
+
+	inline std::size_t intervalCount() const { return m_size; }
+
+	// ago 0 is the latest interval, up to intervalCount() - 1
+	inline const TradingStats& intervalStats(std::size_t ago) const
+	{
+		return m_buckets[(m_head + m_buckets.size() - ago) % m_buckets.size()];
+	}
+
+	inline void onTrade(const TTimestamp& now, const TPrice& px, const TQty& qty)
+	{
+		m_total.onTrade(px, qty);
+		if (m_intervalNs != 0) {
+			bucket(now).onTrade(px, qty);
+		}
+	}
+
+	inline void onOrder(const TTimestamp& now)
+	{
+		++m_total.orders;
+		if (m_intervalNs != 0) {
+			++bucket(now).orders;
+		}
+	}
+
+	inline void onCancel(const TTimestamp& now)
+	{
+		++m_total.cancels;
+		if (m_intervalNs != 0) {
+			++bucket(now).cancels;
+		}
+	}
+
+protected:
+	inline TradingStats& bucket(const TTimestamp& now)
+	{
+		TTimestamp start(now - now % m_intervalNs);
+
+		// A clock stepping back keeps adding to the latest interval
+		if (m_size == 0 || start > m_buckets[m_head].start) {
+			m_head = (m_head + 1) % m_buckets.size();
+			m_buckets[m_head] = TradingStats(start);
+			m_size = std::min(m_size + 1, m_buckets.size());
+		}
+		return m_buckets[m_head];
+	}
+
+	TradingStats				m_total;
+	TTimestamp					m_intervalNs;
+	std::vector<TradingStats>	m_buckets;
+	std::size_t					m_head;		// latest interval
+	std::size_t					m_size;
+};